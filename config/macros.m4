@@ -352,3 +352,93 @@ AC_DEFUN([AX_PROG_MRNET],
 	AX_FLAGS_RESTORE()
 	AC_LANG_RESTORE()
 ])
+
+# AX_PROG_MPI
+# -----------
+# Optional MPI support for the back-ends (BackEnd::InitMPI)
+AC_DEFUN([AX_PROG_MPI],
+[
+	AX_FLAGS_SAVE()
+	AC_LANG_SAVE()
+	AC_LANG([C++])
+
+	AC_ARG_WITH(mpi,
+		AC_HELP_STRING(
+			[--with-mpi@<:@=DIR@:>@],
+			[enable the MPI bootstrap of the back-ends, using the MPI installation in DIR]
+		),
+		[mpi_paths="$withval"],
+		[mpi_paths="no"]
+	)
+
+	AC_ARG_VAR([MPI_LIBS], [libraries to link with MPI, by default taken from mpicxx])
+
+	MPI_INSTALLED="no"
+	if test "${mpi_paths}" != "no" ; then
+		if test "${mpi_paths}" = "yes" ; then
+			dnl Guess the installation from the compiler wrapper in the PATH
+			AC_PATH_PROG(MPICXX, mpicxx, [])
+			if test "x${MPICXX}" != "x" ; then
+				mpi_paths=`dirname \`dirname ${MPICXX}\``
+			fi
+		fi
+
+		dnl Search for MPI installation
+		AX_FIND_INSTALLATION([MPI], [$mpi_paths], [mpi])
+
+		if test "x${MPI_HOME}" != "x" ; then
+			CXXFLAGS="${CXXFLAGS} ${MPI_CXXFLAGS}"
+			CPPFLAGS="${CPPFLAGS} ${MPI_CXXFLAGS}"
+			AC_CHECK_HEADERS([mpi.h], [MPI_INSTALLED="yes"], [])
+		fi
+
+		if test "${MPI_INSTALLED}" = "yes" ; then
+			dnl Libraries given by the user, or taken from the compiler wrapper, which knows 
+			dnl the right ones for every implementation (-lmpi_cxx, -lmpicxx, -lmpifort, ...)
+			AC_MSG_CHECKING([for the MPI libraries])
+			if test "x${MPI_LIBS}" = "x" ; then
+				if test "x${MPICXX}" = "x" -a -x ${MPI_HOME}/bin/mpicxx ; then
+					MPICXX="${MPI_HOME}/bin/mpicxx"
+				fi
+				if test "x${MPICXX}" != "x" ; then
+					dnl Open MPI prints the link flags with -showme:link, MPICH and Intel MPI print the whole command line with -show
+					MPI_LIBS=`${MPICXX} -showme:link 2>/dev/null`
+					if test "x${MPI_LIBS}" = "x" ; then
+						for flag in `${MPICXX} -show 2>/dev/null` ; do
+							case "${flag}" in
+								-L*|-l*|-Wl,*|-pthread) MPI_LIBS="${MPI_LIBS} ${flag}" ;;
+							esac
+						done
+						MPI_LIBS=`echo ${MPI_LIBS}`
+					fi
+				fi
+				if test "x${MPI_LIBS}" = "x" ; then
+					MPI_LIBS="-lmpi"
+				fi
+			fi
+			AC_MSG_RESULT([${MPI_LIBS}])
+
+			LIBS="${LIBS} -L${MPI_LIBSDIR} ${MPI_LIBS}"
+			AC_LINK_IFELSE(
+				[AC_LANG_PROGRAM([#include <mpi.h>], [MPI_Init(0, 0);])],
+				[],
+				[AC_MSG_WARN([cannot link with the MPI libraries '${MPI_LIBS}', set MPI_LIBS to the right ones])
+				 MPI_INSTALLED="no"]
+			)
+		fi
+
+		if test "${MPI_INSTALLED}" = "yes" ; then
+			AC_SUBST(MPI_CXXFLAGS)
+			AC_SUBST(MPI_LIBSDIR)
+			AC_SUBST(MPI_LIBS)
+			AC_DEFINE([HAVE_MPI], 1, [Define to 1 if MPI is installed in the system])
+		else
+			AC_MSG_WARN([MPI support has been disabled])
+		fi
+	fi
+
+	AM_CONDITIONAL(HAVE_MPI, test "${MPI_INSTALLED}" = "yes")
+
+	AX_FLAGS_RESTORE()
+	AC_LANG_RESTORE()
+])
@@ -25,6 +25,7 @@
 #include "BackEnd.h"
 #include "BackProtocol.h"
 #include "PendingConnections.h"
+#include "Rendezvous.h"
 #include <sstream>
 
 using std::cerr;
@@ -38,6 +39,9 @@ using namespace Synapse;
  */
 BackEnd::BackEnd()
 {
+   loopThreadStarted = false;
+   loopPreProtocol   = NULL;
+   loopPostProtocol  = NULL;
 }
 
 
@@ -108,13 +112,49 @@ int BackEnd::Init (int wRank, char *parHostname, int parPort, int parRank)
 }
 
 
+/**
+ * Starts the network connecting pending backends (remote instantiation), asking 
+ * the rendezvous server of the front-end where to connect (see FrontEnd::EnableRendezvous).
+ * The back-ends do not touch the filesystem this way.
+ * @param wRank           Backend world rank.
+ * @param rendezvousHost  Host where the front-end runs.
+ * @param rendezvousPort  Port of the rendezvous server.
+ * @return 0 on success; -1 otherwise.
+ */
+int BackEnd::Init (int wRank, const char *rendezvousHost, int rendezvousPort)
+{
+   ConnectionsRecord parent;
+
+   if (RendezvousQuery(rendezvousHost, rendezvousPort, wRank, parent) != 0)
+   {
+      cerr << "[BE " << wRank << "] failed to get the connection information from the rendezvous server." << endl;
+      return -1;
+   }
+   return Init(wRank, parent.host, parent.port, parent.parentRank);
+}
+
+
 /**
  * Reads the connection file from the environment variable SYNAPSE_BE_CONNECTIONS and starts the network.
+ * If SYNAPSE_RENDEZVOUS is defined instead ("host:port"), asks the rendezvous server of the front-end.
  * @param wRank Backend world rank.
  * @return 0 if the MRNet starts successfully; -1 otherwise.
  */
 int BackEnd::Init (int wRank)
 {
+   char *env_SYNAPSE_RENDEZVOUS = getenv("SYNAPSE_RENDEZVOUS");
+   if (env_SYNAPSE_RENDEZVOUS != NULL)
+   {
+      string rendezvous(env_SYNAPSE_RENDEZVOUS);
+      size_t colon = rendezvous.rfind(':');
+      if (colon == string::npos)
+      {
+         cerr << "[BE " << wRank << "] ERROR: SYNAPSE_RENDEZVOUS has to be 'host:port'!" << endl;
+         return -1;
+      }
+      return Init(wRank, rendezvous.substr(0, colon).c_str(), atoi(rendezvous.substr(colon + 1).c_str()));
+   }
+
    char *env_SYNAPSE_BE_CONNECTIONS = getenv("SYNAPSE_BE_CONNECTIONS");
    if (env_SYNAPSE_BE_CONNECTIONS == NULL)
    {
@@ -143,8 +183,63 @@ int BackEnd::CommonInit()
       cerr << "[BE " << WhoAmI() << "] net::recv() failure" << endl;
       return -1;
    }
-   return 0;
+   if (WatchTopology() != 0)
+   {
+      return -1;
+   }
+   return StartMetrics();
+}
+
+
+#if defined(SYNAPSE_MPI)
+/**
+ * Starts the network connecting pending backends (remote instantiation) from an MPI program. 
+ * The task with rank 0 reads the connections file and scatters the connection information to 
+ * the rest, and then all of them connect. Has to be called by all the tasks in the communicator.
+ * @param comm            Communicator of the back-ends, their rank in it is their back-end rank.
+ * @param connectionsFile Backends connections file.
+ * @return 0 on success; -1 otherwise.
+ */
+int BackEnd::InitMPI (MPI_Comm comm, const char *connectionsFile)
+{
+   char parHostname[64], parPort[10], parRank[10];
+   int  wRank;
+
+   MPI_Comm_rank(comm, &wRank);
+
+   PendingConnections BE_connex(connectionsFile);
+   if (BE_connex.ScatterParentInfo(comm, parHostname, parPort, parRank) == -1)
+   {
+      cerr << "[BE " << wRank << "] failed to get the connection information from the connections file '" << connectionsFile << "'." << endl;
+      return -1;
+   }
+   Remote_Instantiation = true;
+
+   net = Connect(wRank, (char *)parHostname, (char *)parPort, (char *)parRank);
+   assert(net);
+
+   return CommonInit();
+}
+
+
+/**
+ * Wrapper for InitMPI(MPI_Comm, const char *) that reads the connections file from the environment 
+ * variable SYNAPSE_BE_CONNECTIONS.
+ * @param comm Communicator of the back-ends, their rank in it is their back-end rank.
+ * @return 0 on success; -1 otherwise.
+ */
+int BackEnd::InitMPI (MPI_Comm comm)
+{
+   char *env_SYNAPSE_BE_CONNECTIONS = getenv("SYNAPSE_BE_CONNECTIONS");
+   if (env_SYNAPSE_BE_CONNECTIONS == NULL)
+   {
+      cerr << "[BE] ERROR: SYNAPSE_BE_CONNECTIONS environment variable is not defined!" << endl;
+      cerr << "[BE] Make it point to the back-ends connection file." << endl;
+      return -1;
+   }
+   return InitMPI(comm, ((const char *)env_SYNAPSE_BE_CONNECTIONS));
 }
+#endif
 
 
 /**
@@ -209,13 +304,23 @@ NETWORK * BackEnd::Connect(int wRank, char *parHostname, char *parPort, char *pa
 
 /**
  * Loads an user-protocol for the back-end side of the MRNet.
- * @param prot Protocol to load in the back-end.
+ * @param prot       Protocol to load in the back-end.
+ * @param lazy_setup Optional argument set to false by default. When true, the streams of the
+ *                   protocol are received when the front-end dispatches it for the first time.
+ *                   It has to match the setting used in the front-end.
  * @return 0 on success; -1 otherwise.
  */
-int BackEnd::LoadProtocol(Protocol *prot)
+int BackEnd::LoadProtocol(Protocol *prot, bool lazy_setup)
 {
+   /* The numeric ID is assigned first, it is checked against the FE's when the streams are announced */
+   MRNetApp::LoadProtocol(prot);
    ((BackProtocol *)prot)->Init(this);
-   return MRNetApp::LoadProtocol(prot);
+
+   if (! lazy_setup)
+   {
+      return ((BackProtocol *)prot)->SetupStreams();
+   }
+   return 0;
 }
 
 
@@ -226,10 +331,10 @@ int BackEnd::LoadProtocol(Protocol *prot)
  */
 void BackEnd::Loop(callback_function preProtocol, callback_function postProtocol)
 {
-   Protocol *prot;
    int next_tag;
-   int err = 0;
-   char *prot_id;
+   unsigned int countErr;
+   uint32_t req_id;
+   vector<uint64_t> batchACK;
    PACKET_new(p);
 
    if (stControl == NULL) return;
@@ -237,22 +342,76 @@ void BackEnd::Loop(callback_function preProtocol, callback_function postProtocol
    do
    {
       /* Read the next protocol request */
-      MRN_STREAM_RECV(stControl, &next_tag, p, TAG_ANY);
-      /* Leave the loop on TAG_EXIT */
-      if (next_tag != TAG_EXIT) 
       {
-         PACKET_unpack(p, "%s", &prot_id);
-         /* Fetch the back-end protocol */
-         prot = MRNetApp::FetchProtocol(string(prot_id));
+         TraceScope trace(TRACE_PHASE, TRACE_WAIT_REQUEST);
+         MRN_STREAM_RECV(stControl, &next_tag, p, TAG_ANY);
+      }
+      countErr = 0;
+      req_id   = 0;
+      batchACK.clear();
+
+      if (next_tag == TAG_PROT_ID)
+      {
+         uint32_t prot_idx;
+         if (Unpack(p, req_id, prot_idx) != 0)
+         {
+            cerr << "[BE " << WhoAmI() << "] ERROR: Malformed protocol request" << endl;
+            countErr = 1;
+         }
+         else
+         {
+            countErr = (RunProtocol(prot_idx, preProtocol, postProtocol) != 0 ? 1 : 0);
+         }
+      }
+      else if (next_tag == TAG_PROT_BATCH)
+      {
+         uint32_t *prot_idxs;
+         uint32_t  count;
+         PACKET_unpack(p, "%ud %aud", &req_id, &prot_idxs, &count);
+         /* The ACK word goes first, followed by the errors of every protocol of the batch */
+         batchACK.assign(count + 1, 0);
+         for (unsigned int i=0; i<count; i++)
+         {
+            batchACK[i+1] = (RunProtocol(prot_idxs[i], preProtocol, postProtocol) != 0 ? 1 : 0);
+            countErr += batchACK[i+1];
+         }
+         batchACK[0] = ACK_WORD(req_id, countErr);
+         free(prot_idxs);
+      }
+
+      else if (next_tag == TAG_STREAM)
+      {
+         /* Streams of a protocol loaded in lazy mode, sent before its first dispatch */
+         StreamAnnouncement announcement;
+         BackProtocol::UnpackAnnouncement(p, announcement);
+
+         BackProtocol *prot = (BackProtocol *)MRNetApp::FetchProtocol(announcement.protIdx);
          if (prot != NULL)
          {
-            /* Execute the back-end side of the protocol */
-            if (preProtocol  != NULL) preProtocol(prot_id, prot);
-            err = prot->Run();
-            if (postProtocol != NULL) postProtocol(prot_id, prot);
+            prot->SetupStreams(announcement);
+         }
+         else
+         {
+            cerr << "[BE " << WhoAmI() << "] Protocol #" << announcement.protIdx << " is not loaded!" << endl;
+            free(announcement.protID);
+            free(announcement.streamIDs);
+            MRN_STREAM_SEND(stControl, TAG_ACK, "%d", 0);
+         }
+         continue;
+      }
+
+      /* Leave the loop on TAG_EXIT, otherwise notify success or errors matching the request ID */
+      if (next_tag != TAG_EXIT) 
+      {
+         TraceScope trace(TRACE_PHASE, TRACE_ACK_SEND);
+         if (next_tag == TAG_PROT_BATCH)
+         {
+            MRN_STREAM_SEND(stControl, TAG_ACK, "%auld", &batchACK[0], batchACK.size());
+         }
+         else
+         {
+            MRN_STREAM_SEND(stControl, TAG_ACK, "%uld", ACK_WORD(req_id, countErr)); /* 0 success, +N errors */
          }
-         /* Notify success or errors  */
-         MRN_STREAM_SEND(stControl, TAG_ACK, "%d", err*(-1)); /* 0 success, +1 error */
       } 
    } while (next_tag != TAG_EXIT);
 
@@ -260,11 +419,118 @@ void BackEnd::Loop(callback_function preProtocol, callback_function postProtocol
    Shutdown();
 }
 
+
+/**
+ * Runs the back-end side of a protocol, calling the user callbacks before and after.
+ * @param prot_idx     The numeric protocol identifier.
+ * @param preProtocol  Callback invoked before the protocol runs (optional).
+ * @param postProtocol Callback invoked after the protocol runs (optional).
+ * @return the return code of the protocol; -1 if the protocol is not loaded.
+ */
+int BackEnd::RunProtocol(unsigned int prot_idx, callback_function preProtocol, callback_function postProtocol)
+{
+   int err = -1;
+
+   /* Fetch the back-end protocol */
+   Protocol *prot = MRNetApp::FetchProtocol(prot_idx);
+   if (prot != NULL)
+   {
+      /* Execute the back-end side of the protocol */
+      TraceScope     dispatch(TRACE_DISPATCH, prot_idx + 1);
+      struct timeval run_start;
+      if (preProtocol != NULL)
+      {
+         TraceScope trace(TRACE_PHASE, TRACE_PRE_CALLBACK);
+         preProtocol(prot->ID(), prot);
+      }
+      if (metricsEnabled) gettimeofday(&run_start, NULL);
+      {
+         TraceScope trace(TRACE_PHASE, TRACE_BE_RUN);
+         err = prot->Run();
+         /* Push out the messages the protocol left buffered (see MRN_STREAM_SEND_BUFFERED) */
+         FlushPending();
+      }
+      prot->RecordPhase(PHASE_RUN, &run_start);
+      CountDispatch(prot->GetMetrics(), (err != 0));
+      if (postProtocol != NULL)
+      {
+         TraceScope trace(TRACE_PHASE, TRACE_POST_CALLBACK);
+         postProtocol(prot->ID(), prot);
+      }
+   }
+   else
+   {
+      cerr << "[BE " << WhoAmI() << "] Protocol #" << prot_idx << " is not loaded!" << endl;
+   }
+   return err;
+}
+
 void BackEnd::Loop()
 {
   Loop(NULL, NULL);
 }
 
+/**
+ * Entry point of the loop thread.
+ * @param arg The BackEnd object.
+ */
+void * BackEnd::LoopThreadMain(void *arg)
+{
+   BackEnd *be = (BackEnd *)arg;
+
+   be->Loop(be->loopPreProtocol, be->loopPostProtocol);
+   return NULL;
+}
+
+
+/**
+ * Runs Loop() in a new thread and returns immediately, so that the application keeps its own threads. 
+ * From then on, the loop thread is the only one that talks to the network. The application hands data 
+ * to the protocols pushing records into an SPSCRing or MPSCRing (see RingBuffer.h), that the protocols 
+ * drain in their Run(), so the application never blocks on network activity.
+ * @param preProtocol  Callback invoked before every protocol runs (optional).
+ * @param postProtocol Callback invoked after every protocol runs (optional).
+ * @return 0 on success; -1 otherwise.
+ */
+int BackEnd::StartLoopThread(callback_function preProtocol, callback_function postProtocol)
+{
+   if (loopThreadStarted)
+   {
+      cerr << "[BE " << WhoAmI() << "] ERROR: The loop thread is already running!" << endl;
+      return -1;
+   }
+
+   loopPreProtocol  = preProtocol;
+   loopPostProtocol = postProtocol;
+
+   if (pthread_create(&loopThread, NULL, LoopThreadMain, this) != 0)
+   {
+      cerr << "[BE " << WhoAmI() << "] ERROR: Could not create the loop thread!" << endl;
+      return -1;
+   }
+   loopThreadStarted = true;
+   return 0;
+}
+
+int BackEnd::StartLoopThread()
+{
+   return StartLoopThread(NULL, NULL);
+}
+
+
+/**
+ * Waits for the loop thread to finish, which happens after the front-end shuts down the network.
+ */
+void BackEnd::JoinLoopThread()
+{
+   if (loopThreadStarted)
+   {
+      pthread_join(loopThread, NULL);
+      loopThreadStarted = false;
+   }
+}
+
+
 /**
  * Shutdown the MRNet.
  */
@@ -284,6 +550,10 @@ void BackEnd::Shutdown()
    }
 #endif
 
+   /* Last dump of the metrics, and the trace */
+   StopMetricsDump();
+   WriteTrace();
+
    /* FE delete of the net will cause us to exit, wait for it */
    NETWORK_waitfor_ShutDown(net);
 
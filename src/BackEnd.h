@@ -23,7 +23,12 @@
 #ifndef __BACKEND_H__
 #define __BACKEND_H__
 
+#include <pthread.h>
 #include "MRNetApp.h"
+#include "RingBuffer.h"
+#if defined(SYNAPSE_MPI)
+# include <mpi.h>
+#endif
 
 using std::string;
 
@@ -40,15 +45,31 @@ class BackEnd : public MRNetApp
       int  Init(int argc,  char *argv[]);
       int  Init(int wRank, const char *connectionsFile);
       int  Init(int wRank, char *parHostname, int parPort, int parRank);
+      int  Init(int wRank, const char *rendezvousHost, int rendezvousPort);
       int  Init(int wRank);
-      int  LoadProtocol(Protocol *prot);
+#if defined(SYNAPSE_MPI)
+      int  InitMPI(MPI_Comm comm, const char *connectionsFile);
+      int  InitMPI(MPI_Comm comm);
+#endif
+      int  LoadProtocol(Protocol *prot, bool lazy_setup=false);
 
       void Loop(callback_function preProtocol, callback_function postProtocol);
       void Loop();
+      int  StartLoopThread(callback_function preProtocol, callback_function postProtocol);
+      int  StartLoopThread();
+      void JoinLoopThread();
       void Shutdown();
 
    private:
+      pthread_t         loopThread;        /* Runs Loop() when started with StartLoopThread() */
+      bool              loopThreadStarted;
+      callback_function loopPreProtocol;
+      callback_function loopPostProtocol;
+
+      static void * LoopThreadMain(void *arg);
+
       int       CommonInit();
+      int       RunProtocol(unsigned int prot_idx, callback_function preProtocol, callback_function postProtocol);
       NETWORK * Connect(int wRank, const char *connectionsFile);
       NETWORK * Connect(int wRank, char *parHostname, char *parPort, char *parRank);
       int       getParentInfo(const char *file, int rank, char *phost, char *pport, char *prank);
@@ -21,6 +21,8 @@
 \*****************************************************************************/
 
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
 #include "BackProtocol.h"
 #include "BackEnd.h"
 
@@ -30,28 +32,132 @@ using namespace Synapse;
 
 
 /**
- * Calls the user-defined BE initialization routine for this protocol and 
- * then receives all the streams that were created in the front-end.
+ * Binds the protocol to the back-end. The streams are received later in SetupStreams().
  * @param be The BackEnd object.
  */
 void BackProtocol::Init(MRNetApp *BE)
 {
+   barrierWait = 0;
+   streamsMissing = false;
    mrnApp = BE;
-   AnnounceStreams();
-   Setup(); /* User-defined in the specific protocol object implementation */
+}
+
+
+/**
+ * Receives all the streams that were created in the front-end and then calls 
+ * the user-defined BE initialization routine for this protocol. 
+ * @return 0 on success; -1 otherwise.
+ */
+int BackProtocol::SetupStreams(void)
+{
+   TraceScope trace(TRACE_PHASE, TRACE_ANNOUNCE);
+   streamsMissing = false;
+   int rc = AnnounceStreams();
+   return ConfirmStreams(rc);
+}
+
+
+/**
+ * Same as SetupStreams(), for a stream announcement that was already received by the back-end 
+ * (lazy set up of the streams upon the first dispatch of the protocol).
+ * @param announcement The TAG_STREAM message for this protocol.
+ * @return 0 on success; -1 otherwise.
+ */
+int BackProtocol::SetupStreams(StreamAnnouncement &announcement)
+{
+   TraceScope trace(TRACE_PHASE, TRACE_ANNOUNCE);
+   streamsMissing = false;
+   int rc = AnnounceStreams(announcement);
+   return ConfirmStreams(rc);
+}
+
+
+/**
+ * Calls the user-defined BE initialization routine once the streams are announced, and confirms 
+ * the set up to the front-end only when Setup() got all the streams it registers. Otherwise the 
+ * protocol stays not ready, and is set up again with the next announcement of the front-end.
+ * @param announced Result of AnnounceStreams.
+ * @return 0 on success; -1 otherwise.
+ */
+int BackProtocol::ConfirmStreams(int announced)
+{
+   int rc = announced;
+
+   if (rc == 0)
+   {
+      Setup(); /* User-defined in the specific protocol object implementation */
+      if (streamsMissing) rc = -1;
+   }
+   if (rc != 0)
+   {
+      while (! registeredStreams.empty()) registeredStreams.pop();
+   }
+   streamsReady = (rc == 0);
+
+   /* Send reception confirmation (the FE detects the mismatch when it misses our ACK) */
+   MRN_STREAM_SEND(mrnApp->stControl, TAG_ACK, "%d", (rc == 0 ? 1 : 0));
+   return rc;
 }
 
 
 /**
  * Retrieves a new stream that was registered in the front-end. The streams 
- * have to be registered in the same order than in the FE!
- * @param new_stream Stream that was registered in the front-end.
+ * have to be registered in the same order than in the FE! Streams that the FE 
+ * registered with Register_SharedStream are retrieved the same way.
+ * @param new_stream Stream that was registered in the front-end; NULL if the front-end 
+ *                   announced fewer streams (e.g. it failed to create them), and SetupStreams fails.
  */
 void BackProtocol::Register_Stream(STREAM *& new_stream)
 {
+   if (registeredStreams.empty())
+   {
+      cerr << "[BE " << WhoAmI() << "] ERROR: BackProtocol::Register_Stream: Protocol '" << ID() << "' has no more streams announced" << endl;
+      new_stream = NULL;
+      streamsMissing = true;
+      return;
+   }
    new_stream = registeredStreams.front();
    /* Remove the stream from the queue */
    registeredStreams.pop();
+   if (metricsEnabled) LabelStreamMetrics(new_stream, ID());
+}
+
+
+
+/**
+ * Retrieves a stream that the front-end registered with Register_CompressedStream. The 
+ * payloads sent through it with SendPayload are compressed above the protocol's compression 
+ * threshold (see SetCompressionThreshold).
+ * @param new_stream Stream that was registered in the front-end.
+ */
+void BackProtocol::Register_CompressedStream(STREAM *& new_stream)
+{
+   Register_Stream(new_stream);
+   if (new_stream != NULL) SetCompression(new_stream, compressionThreshold);
+}
+
+
+/**
+ * Unpacks a TAG_STREAM message sent by FrontProtocol::AnnounceStreams. The caller has to
+ * free the protocol name and the stream ID's.
+ * @param p            The TAG_STREAM packet.
+ * @param announcement The unpacked contents.
+ */
+void BackProtocol::UnpackAnnouncement(PACKET_PTR p, StreamAnnouncement &announcement)
+{
+   announcement.protIdx      = 0;
+   announcement.protID       = NULL;
+   announcement.countStreams = 0;
+   announcement.streamIDs    = NULL;
+
+#if defined(ANNOUNCE_STREAMS_SINGLE_PACKET)
+   /* The protocol numeric ID and name, and the ID's of all the streams that were created */
+   PACKET_unpack(p, "%ud %s %aud", &announcement.protIdx, &announcement.protID, 
+                                   &announcement.streamIDs, &announcement.countStreams);
+#else
+   /* The protocol numeric ID and name, and the number of streams that were created */
+   PACKET_unpack(p, "%ud %s %ud", &announcement.protIdx, &announcement.protID, &announcement.countStreams);
+#endif
 }
 
 
@@ -66,17 +172,56 @@ int BackProtocol::AnnounceStreams()
 {
    int tag;
    PACKET_new(p);
-   unsigned int countStreams = 0;
+   StreamAnnouncement announcement;
 
-   /* Read the number of streams that were created */
    MRN_STREAM_RECV(mrnApp->stControl, &tag, p, TAG_STREAM);
-   PACKET_unpack(p, "%d", &countStreams);
+   UnpackAnnouncement(p, announcement);
+   PACKET_delete(p);
+
+   return AnnounceStreams(announcement);
+}
+
+
+/**
+ * Registers the streams listed in the given announcement. The reception is confirmed to the front-end 
+ * by ConfirmStreams, once Setup() took them.
+ * @param announcement The TAG_STREAM message for this protocol.
+ * @return 0 on success; -1 otherwise.
+ */
+int BackProtocol::AnnounceStreams(StreamAnnouncement &announcement)
+{
+   bool match = true;
+
+   /* The protocols have to be loaded in the same order in the FE and BEs */
+   if ((announcement.protIdx != Index()) || (ID() != announcement.protID))
+   {
+      cerr << "[BE " << WhoAmI() << "] ERROR: BackProtocol::AnnounceStreams: Protocol '" << ID() << "' (#" << Index() 
+           << ") does not match the front-end's '" << announcement.protID << "' (#" << announcement.protIdx << ")" << endl;
+      match = false;
+   }
+   free(announcement.protID);
 
    /* DEBUG -- Number of streams 
-   std::cout << "[BE " << WhoAmI() << "] BackProtocol::AnnounceStreams: Receiving " << countStreams << " streams" << std::endl; */
+   std::cout << "[BE " << WhoAmI() << "] BackProtocol::AnnounceStreams: Receiving " << announcement.countStreams << " streams" << std::endl; */
 
+#if defined(ANNOUNCE_STREAMS_SINGLE_PACKET)
+   /* The streams were already created in this back-end when the FE called new_Stream, just look them up */
+   for (unsigned int i=0; i<announcement.countStreams; i++)
+   {
+      STREAM *newStream = NETWORK_get_Stream(mrnApp->net, announcement.streamIDs[i]);
+      if (newStream == NULL)
+      {
+         cerr << "[BE " << WhoAmI() << "] ERROR: BackProtocol::AnnounceStreams: Unknown stream #" << announcement.streamIDs[i] << endl;
+         match = false;
+      }
+      registeredStreams.push(newStream);
+   }
+   free(announcement.streamIDs);
+#else
    /* Receive them 1 by 1 */
-   for (unsigned int i=0; i<countStreams; i++)
+   int tag;
+   PACKET_new(p);
+   for (unsigned int i=0; i<announcement.countStreams; i++)
    {
       STREAM *newStream;
       MRN_NETWORK_RECV(mrnApp->net, &tag, p, TAG_STREAM, &newStream, true);
@@ -84,27 +229,198 @@ int BackProtocol::AnnounceStreams()
       std::cout <<  "[BE " << WhoAmI() << "] BackProtocol::AnnounceStreams: Received stream #" << newStream->get_Id() << std::endl; */
       registeredStreams.push(newStream);
    }
-   /* Send reception confirmation */
-   MRN_STREAM_SEND(mrnApp->stControl, TAG_ACK, "%d", 1);
    PACKET_delete(p);
+#endif
 
-   return 0;
+   return (match ? 0 : -1);
 }
 
+
+/**
+ * Blocks the back-end until all the back-ends enter the barrier and the front-end releases them.
+ * @return 0 on success; -1 otherwise.
+ */
 int BackProtocol::Barrier()
+{
+  BarrierBegin();
+  return BarrierEnd();
+}
+
+
+/**
+ * First half of a split-phase barrier. Notifies the arrival of this back-end without waiting, 
+ * so that local work can be done while the barrier propagates. Nothing else can be received 
+ * from the control stream until BarrierEnd() is called.
+ * @return 0 on success; -1 otherwise.
+ */
+int BackProtocol::BarrierBegin()
+{
+  gettimeofday(&barrierStart, NULL);
+  MRN_STREAM_SEND(mrnApp->stControl, TAG_ACK, "%d", 1);
+  return 0;
+}
+
+
+/**
+ * Second half of a split-phase barrier. Waits until the front-end releases the back-ends.
+ * If the protocol enabled the timed barrier, reports how long this back-end waited since BarrierBegin().
+ * @return 0 on success; -1 otherwise.
+ */
+int BackProtocol::BarrierEnd()
 {
   int tag;
   PACKET_new(p);
   unsigned int countACKs = 0;
+  int rc = 0;
+  struct timeval now;
+  TraceScope trace(TRACE_BARRIER, Index() + 1);
 
-  MRN_STREAM_SEND(mrnApp->stControl, TAG_ACK, "%d", 1);
   MRN_STREAM_RECV(mrnApp->stControl, &tag, p, TAG_ACK);
-  PACKET_unpack(p, "%d", &countACKs);
+  PACKET_unpack(p, "%d %d", &countACKs, &rc);
+
+  gettimeofday(&now, NULL);
+  barrierWait = (now.tv_sec - barrierStart.tv_sec) + (now.tv_usec - barrierStart.tv_usec) / 1000000.0;
+  RecordPhase(PHASE_BARRIER, &barrierStart);
  
-  if (countACKs != mrnApp->NumBackEnds())
+  /* The front-end checks the ACKs count, as only it knows how many back-ends survive */
+  if (rc != 0)
   {
-      cerr << "[BE] " << WhoAmI() << "] ERROR: BackProtocol::Barrier: " << countACKs << " ACKs received, expected " << mrnApp->NumBackEnds() << endl;
+      cerr << "[BE] " << WhoAmI() << "] ERROR: BackProtocol::Barrier: " << countACKs << " ACKs received by the front-end" << endl;
       return -1;
   }
+
+  if (stBarrierMin != NULL)
+  {
+    MRN_STREAM_SEND(stBarrierMin, TAG_BARRIER_STATS, "%lf", barrierWait);
+    MRN_STREAM_SEND(stBarrierMax, TAG_BARRIER_STATS, "%lf", barrierWait);
+    MRN_STREAM_SEND(stBarrierSum, TAG_BARRIER_STATS, "%lf", barrierWait);
+  }
   return 0;
 }
+
+
+/**
+ * Makes every barrier of this protocol report how long this back-end waited in it. Call it from 
+ * Setup() at the same position where the front-end calls FrontProtocol::EnableTimedBarrier().
+ */
+void BackProtocol::EnableTimedBarrier()
+{
+  Register_Stream(stBarrierMin);
+  Register_Stream(stBarrierMax);
+  Register_Stream(stBarrierSum);
+}
+
+
+/**
+ * Returns how long this back-end waited in the last barrier.
+ * @return the seconds waited.
+ */
+double BackProtocol::GetBarrierWait()
+{
+  return barrierWait;
+}
+
+
+/**
+ * Sends a large buffer to the front-end, split in chunks that are pipelined through the tree. 
+ * The front-end receives the buffers of all the back-ends with FrontProtocol::ReceiveLarge, 
+ * and gives credits to this back-end to keep at most a window of chunks in flight.
+ * @param stream The stream (registered with TFILTER_NULL and SFILTER_DONTWAIT).
+ * @param buffer The data to send.
+ * @param size   Size of the data.
+ * @return 0 on success; -1 otherwise.
+ */
+int BackProtocol::StreamLarge(STREAM *stream, const void *buffer, size_t size)
+{
+   int tag, rc = 0;
+   PACKET_new(p);
+   unsigned int num_chunks = ChunkCount(size, chunkSize);
+   unsigned int granted    = 0;
+
+   for (unsigned int seq=0; (seq<num_chunks) && (rc == 0); seq++)
+   {
+      while ((seq >= chunkWindow + granted) && (rc == 0))
+      {
+         unsigned int rank = 0, credits = 0;
+         MRN_STREAM_RECV(stream, &tag, p, TAG_CHUNK_CREDIT);
+         rc = PACKET_unpack(p, "%ud %ud", &rank, &credits);
+         granted = (credits == CHUNK_CREDITS_ALL ? num_chunks : granted + credits);
+      }
+
+      size_t   offset = (size_t)seq * chunkSize;
+      uint32_t length = (size - offset < chunkSize ? size - offset : chunkSize);
+      if (rc == 0)
+      {
+         MRN_STREAM_SEND(stream, TAG_CHUNK, "%ud %ud %ud %ud %uld %auc", WhoAmI(), WhoAmI(true), seq, chunkWindow, 
+                         (uint64_t)size, (unsigned char *)buffer + offset, length);
+      }
+   }
+   PACKET_delete(p);
+   return (rc == -1 ? -1 : 0);
+}
+
+
+/**
+ * Receives a large buffer broadcast by the front-end with FrontProtocol::StreamLarge, giving 
+ * credits to the front-end as the chunks are consumed. When the chunks come out of order, the 
+ * buffer is dropped but the rest of the chunks are still drained, with all the credits given 
+ * at once so that the front-end does not wait for this back-end.
+ * @param stream The stream (registered with TFILTER_NULL and SFILTER_DONTWAIT).
+ * @param buffer Set to the data received.
+ * @return 0 on success; -1 otherwise.
+ */
+int BackProtocol::ReceiveLarge(STREAM *stream, vector<unsigned char> &buffer)
+{
+   int tag, rc = 0;
+   PACKET_new(p);
+   uint32_t     chunk_len  = 0;
+   unsigned int num_chunks = 1, consumed = 0, granted = 0;
+
+   while (consumed < num_chunks)
+   {
+      unsigned int   rank = 0, net_rank = 0, seq = 0, window = 0;
+      uint64_t       total = 0;
+      unsigned char *data = NULL;
+      uint32_t       length = 0;
+
+      MRN_STREAM_RECV(stream, &tag, p, TAG_CHUNK);
+      if (PACKET_unpack(p, "%ud %ud %ud %ud %uld %auc", &rank, &net_rank, &seq, &window, &total, &data, &length) == -1)
+      {
+         rc = -1;
+         break;
+      }
+      if ((seq == 0) && (consumed == 0))
+      {
+         buffer.resize(total);
+         chunk_len  = length;
+         num_chunks = ChunkCount(total, length);
+      }
+      if ((rc == 0) && ((seq != consumed) || ((uint64_t)seq * chunk_len + length > buffer.size())))
+      {
+         cerr << "[BE " << WhoAmI() << "] ERROR: BackProtocol::ReceiveLarge: Unexpected chunk #" << seq << endl;
+         rc = -1;
+         buffer.clear();
+         if (window + granted < num_chunks)
+         {
+            granted = num_chunks;
+            MRN_STREAM_SEND(stream, TAG_CHUNK_CREDIT, "%ud %ud", WhoAmI(true), CHUNK_CREDITS_ALL);
+         }
+      }
+      else if (rc == 0)
+      {
+         if (length > 0) memcpy(&buffer[(size_t)seq * chunk_len], data, length);
+
+         unsigned int credits = CreditsToGrant(consumed + 1, granted, window, num_chunks);
+         if (credits > 0)
+         {
+            granted += credits;
+            MRN_STREAM_SEND(stream, TAG_CHUNK_CREDIT, "%ud %ud", WhoAmI(true), credits);
+         }
+      }
+      free(data);
+      consumed ++;
+   }
+   PACKET_delete(p);
+   return rc;
+}
+
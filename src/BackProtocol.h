@@ -23,19 +23,50 @@
 #ifndef __BE_PROTOCOL_H__
 #define __BE_PROTOCOL_H__
 
+#include <vector>
+#include <sys/time.h>
 #include "Protocol.h"
 
+using std::vector;
+
 namespace Synapse {
 
+/* Contents of the TAG_STREAM message the front-end sends when a protocol's streams are set up */
+typedef struct
+{
+   uint32_t  protIdx;
+   char     *protID;
+   uint32_t  countStreams;
+   uint32_t *streamIDs; /* NULL unless ANNOUNCE_STREAMS_SINGLE_PACKET */
+} StreamAnnouncement;
+
 class BackProtocol : public Protocol
 {
    public:
       void Init(MRNetApp *BE);
+      int  SetupStreams(void);
+      int  SetupStreams(StreamAnnouncement &announcement);
       void Register_Stream(STREAM *& new_stream);
+      void Register_CompressedStream(STREAM *& new_stream);
       int Barrier();
+      int BarrierBegin();
+      int BarrierEnd();
+      void EnableTimedBarrier();
+      double GetBarrierWait();
+      int StreamLarge (STREAM *stream, const void *buffer, size_t size);
+      int ReceiveLarge(STREAM *stream, vector<unsigned char> &buffer);
+
+      static void UnpackAnnouncement(PACKET_PTR p, StreamAnnouncement &announcement);
 
    protected:
       int AnnounceStreams();
+      int AnnounceStreams(StreamAnnouncement &announcement);
+      int ConfirmStreams(int announced);
+
+   private:
+      struct timeval barrierStart;
+      double         barrierWait;    /* Seconds waited in the last barrier */
+      bool           streamsMissing; /* Set when Setup() asks for more streams than were announced */
 };
 
 } /* namespace Synapse */
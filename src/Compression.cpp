@@ -0,0 +1,134 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#include <map>
+#include <stdlib.h>
+#include <pthread.h>
+#include "Compression.h"
+
+using std::map;
+using namespace Synapse;
+
+#define PAYLOAD_FORMAT "%ud %uld %auc"
+
+/* Compression threshold of the streams registered with SetCompression */
+static map<STREAM *, size_t> compressedStreams;
+static pthread_mutex_t       compressedStreamsLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Enables the compression of the payloads sent through the given stream with SendPayload.
+ * @param stream    The stream.
+ * @param threshold Payloads smaller than this many bytes are sent uncompressed.
+ */
+void Synapse::SetCompression(STREAM *stream, size_t threshold)
+{
+   pthread_mutex_lock(&compressedStreamsLock);
+   compressedStreams[stream] = threshold;
+   pthread_mutex_unlock(&compressedStreamsLock);
+}
+
+
+/**
+ * Sends a payload through the stream and flushes it. The payload is compressed if the stream 
+ * was registered with SetCompression and the payload is over its threshold and compresses.
+ * @param stream The stream.
+ * @param tag    Message tag.
+ * @param buffer The payload.
+ * @param size   Size of the payload.
+ * @return 0 on success; -1 otherwise.
+ */
+int Synapse::SendPayload(STREAM *stream, int tag, const void *buffer, size_t size)
+{
+   bool                  compress  = false;
+   size_t                threshold = 0;
+   vector<unsigned char> compressed;
+   unsigned int          codec = COMPRESSION_NONE;
+   TraceScope            trace(TRACE_SEND, tag, stream);
+
+   pthread_mutex_lock(&compressedStreamsLock);
+   map<STREAM *, size_t>::iterator it = compressedStreams.find(stream);
+   if (it != compressedStreams.end())
+   {
+      compress  = true;
+      threshold = it->second;
+   }
+   pthread_mutex_unlock(&compressedStreamsLock);
+
+   if (compress) codec = CompressPayload(buffer, size, threshold, compressed);
+
+   const unsigned char *data   = (const unsigned char *)buffer;
+   uint32_t             length = size;
+   if (codec != COMPRESSION_NONE)
+   {
+      data   = &compressed[0];
+      length = compressed.size();
+   }
+   int rc = STREAM_send(stream, tag, PAYLOAD_FORMAT, codec, (uint64_t)size, (unsigned char *)data, length);
+   return FlushTyped(stream, tag, PAYLOAD_FORMAT, rc, length);
+}
+
+
+/**
+ * Unpacks a payload sent with SendPayload, decompressing it if needed.
+ * @param p       The packet received.
+ * @param payload Set to the uncompressed payload.
+ * @return 0 on success; -1 if the packet does not hold a payload or it is corrupt.
+ */
+int Synapse::UnpackPayload(PACKET_PTR &p, vector<unsigned char> &payload)
+{
+   unsigned int   codec    = COMPRESSION_NONE;
+   uint64_t       raw_size = 0;
+   unsigned char *data     = NULL;
+   uint32_t       length   = 0;
+
+   payload.clear();
+   if (PACKET_unpack(p, PAYLOAD_FORMAT, &codec, &raw_size, &data, &length) == -1) return -1;
+
+   int rc = DecompressPayload(codec, data, length, raw_size, payload);
+   if (rc == -1)
+   {
+      fprintf(stderr, "Synapse::UnpackPayload: corrupt payload (codec=%u, size=%u, uncompressed size=%lu).\n", 
+              codec, length, (unsigned long)raw_size);
+      payload.clear();
+   }
+   free(data);
+   return rc;
+}
+
+
+/**
+ * Receives a payload sent with SendPayload from the stream (blocking), decompressing it if needed.
+ * @param stream   The stream.
+ * @param expected The expected tag (or TAG_ANY).
+ * @param payload  Set to the uncompressed payload.
+ * @return 0 on success; -1 otherwise.
+ */
+int Synapse::RecvPayload(STREAM *stream, int expected, vector<unsigned char> &payload)
+{
+   PACKET_new(p);
+   int rc = RecvTyped(stream, expected, p);
+   if (rc == 0) rc = UnpackPayload(p, payload);
+   PACKET_delete(p);
+   return rc;
+}
+
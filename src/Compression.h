@@ -0,0 +1,237 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#ifndef __COMPRESSION_H__
+#define __COMPRESSION_H__
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "MRNet_wrappers.h"
+
+#define COMPRESSION_NONE      0
+#define COMPRESSION_LZF       1
+#define COMPRESSION_THRESHOLD 1024 /* Default bytes below which the payloads are sent uncompressed
+                                      (can be overriden with SYNAPSE_COMPRESSION_THRESHOLD) */
+
+using std::vector;
+
+namespace Synapse {
+
+/**
+ * Payload compression for the streams registered with Register_CompressedStream. The payloads 
+ * travel as "%ud %uld %auc" (codec, uncompressed size, data), so the receivers always know 
+ * whether to decompress. The codec produces the LZF format (small back-references within an 
+ * 8 KB window) and is meant to be cheap rather than to compress the most. It is inline so 
+ * that the filters of the tree can use it without linking the Synapse libraries.
+ */
+
+#define LZF_HASH_LOG    13
+#define LZF_MAX_LITERAL 32
+#define LZF_MAX_OFFSET  8192
+#define LZF_MAX_MATCH   264  /* 2 + 7 + 255 */
+#define LZF_MAX_EXPANSION (LZF_MAX_MATCH / 3) /* Most bytes restored per compressed byte (longest match in 3 bytes) */
+
+/**
+ * Compresses a buffer in the LZF format.
+ * @param in      Input buffer.
+ * @param in_len  Size of the input.
+ * @param out     Output buffer.
+ * @param out_len Size of the output buffer.
+ * @return the size of the compressed data; 0 if it does not fit in out_len.
+ */
+inline size_t LZFCompress(const unsigned char *in, size_t in_len, unsigned char *out, size_t out_len)
+{
+   uint32_t htab[1 << LZF_HASH_LOG]; /* Last position + 1 of every 3-byte sequence */
+   size_t   ip = 0, op = 1, lit = 0;  /* out[op - lit - 1] holds the length of the current literal run */
+
+   if ((in_len == 0) || (out_len < 2)) return 0;
+   memset(htab, 0, sizeof(htab));
+
+   while (ip < in_len)
+   {
+      size_t match_len = 0, offset = 0;
+
+      if (ip + 2 < in_len)
+      {
+         uint32_t seq = (in[ip] << 16) | (in[ip + 1] << 8) | in[ip + 2];
+         uint32_t h   = ((seq * 2654435761U) >> (32 - LZF_HASH_LOG)) & ((1 << LZF_HASH_LOG) - 1);
+         size_t   ref = htab[h];
+
+         htab[h] = ip + 1;
+         if ((ref > 0) && (ip - ref < LZF_MAX_OFFSET) &&
+             (in[ref - 1] == in[ip]) && (in[ref] == in[ip + 1]) && (in[ref + 1] == in[ip + 2]))
+         {
+            size_t max_len = (in_len - ip < LZF_MAX_MATCH ? in_len - ip : LZF_MAX_MATCH);
+
+            offset    = ip - ref;
+            match_len = 3;
+            while ((match_len < max_len) && (in[ref - 1 + match_len] == in[ip + match_len])) match_len ++;
+         }
+      }
+
+      if (match_len > 0)
+      {
+         /* Close the literal run, or drop its empty header */
+         if (lit > 0) out[op - lit - 1] = lit - 1;
+         else         op --;
+
+         if (op + 4 > out_len) return 0;
+         size_t len = match_len - 2;
+         if (len < 7)
+         {
+            out[op++] = (len << 5) | (offset >> 8);
+         }
+         else
+         {
+            out[op++] = (7 << 5) | (offset >> 8);
+            out[op++] = len - 7;
+         }
+         out[op++] = offset & 0xff;
+
+         op ++; /* Header of the next literal run */
+         lit = 0;
+         ip += match_len;
+      }
+      else
+      {
+         if (op + 1 >= out_len) return 0;
+         out[op++] = in[ip++];
+         if (++ lit == LZF_MAX_LITERAL)
+         {
+            out[op - lit - 1] = lit - 1;
+            op ++;
+            lit = 0;
+         }
+      }
+   }
+   if (lit > 0) out[op - lit - 1] = lit - 1;
+   else         op --;
+
+   return op;
+}
+
+/**
+ * Decompresses a buffer in the LZF format.
+ * @param in      Compressed data.
+ * @param in_len  Size of the compressed data.
+ * @param out     Output buffer.
+ * @param out_len Size of the output buffer.
+ * @return the size of the decompressed data; 0 if the data is corrupt or does not fit in out_len.
+ */
+inline size_t LZFDecompress(const unsigned char *in, size_t in_len, unsigned char *out, size_t out_len)
+{
+   size_t ip = 0, op = 0;
+
+   while (ip < in_len)
+   {
+      size_t ctrl = in[ip++];
+
+      if (ctrl < LZF_MAX_LITERAL)
+      {
+         /* Literal run */
+         ctrl ++;
+         if ((ip + ctrl > in_len) || (op + ctrl > out_len)) return 0;
+         memcpy(out + op, in + ip, ctrl);
+         ip += ctrl;
+         op += ctrl;
+      }
+      else
+      {
+         /* Back-reference, copied byte by byte because it can overlap */
+         size_t len = ctrl >> 5;
+         if (len == 7)
+         {
+            if (ip >= in_len) return 0;
+            len += in[ip++];
+         }
+         if (ip >= in_len) return 0;
+         size_t offset = ((ctrl & 0x1f) << 8) + in[ip++] + 1;
+
+         len += 2;
+         if ((offset > op) || (op + len > out_len)) return 0;
+         for (size_t i = 0; i < len; i++, op++) out[op] = out[op - offset];
+      }
+   }
+   return op;
+}
+
+/**
+ * Compresses a payload if it is worth it.
+ * @param data      The payload.
+ * @param size      Size of the payload.
+ * @param threshold Payloads smaller than this are not compressed.
+ * @param out       Set to the compressed data (empty if not compressed).
+ * @return COMPRESSION_LZF if the payload was compressed into out; COMPRESSION_NONE otherwise.
+ */
+inline unsigned int CompressPayload(const void *data, size_t size, size_t threshold, vector<unsigned char> &out)
+{
+   out.clear();
+   if ((size == 0) || (size < threshold)) return COMPRESSION_NONE;
+
+   out.resize(size);
+   size_t compressed = LZFCompress((const unsigned char *)data, size, &out[0], size - 1);
+   if (compressed == 0)
+   {
+      /* Does not compress */
+      out.clear();
+      return COMPRESSION_NONE;
+   }
+   out.resize(compressed);
+   return COMPRESSION_LZF;
+}
+
+/**
+ * Restores a payload sent with SendPayload. Filters that need to look into the payloads 
+ * decompress them with this, and compress their output again with CompressPayload.
+ * @param codec    The codec of the payload.
+ * @param data     The payload as received.
+ * @param size     Size of the payload as received.
+ * @param raw_size Size of the uncompressed payload.
+ * @param out      Set to the uncompressed payload.
+ * @return 0 on success; -1 if the payload is corrupt.
+ */
+inline int DecompressPayload(unsigned int codec, const void *data, size_t size, uint64_t raw_size, vector<unsigned char> &out)
+{
+   out.clear();
+   if (codec == COMPRESSION_NONE)
+   {
+      if (size != raw_size) return -1;
+      out.resize(size);
+      if (size > 0) memcpy(&out[0], data, size);
+      return 0;
+   }
+   /* The size comes from the sender, check it can be right before allocating it */
+   if ((codec != COMPRESSION_LZF) || (raw_size == 0) || (raw_size > (uint64_t)size * LZF_MAX_EXPANSION)) return -1;
+   out.resize(raw_size);
+   return (LZFDecompress((const unsigned char *)data, size, &out[0], raw_size) == raw_size ? 0 : -1);
+}
+
+void SetCompression(STREAM *stream, size_t threshold=COMPRESSION_THRESHOLD);
+int  SendPayload   (STREAM *stream, int tag, const void *buffer, size_t size);
+int  UnpackPayload (PACKET_PTR &p, vector<unsigned char> &payload);
+int  RecvPayload   (STREAM *stream, int expected, vector<unsigned char> &payload);
+
+} /* namespace Synapse */
+
+#endif /* __COMPRESSION_H__ */
@@ -23,8 +23,12 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
 #include "FrontEnd.h"
 #include "FrontProtocol.h"
 #include "PendingConnections.h"
@@ -33,9 +37,12 @@ using std::cerr;
 using std::cout;
 using std::endl;
 using std::ifstream;
+using std::stringstream;
 using namespace MRN;
 using namespace Synapse;
 
+int split(const std::string &s, char delim, std::vector<std::string> &tokens);
+
 
 /**
  * FrontEnd constructor 
@@ -47,6 +54,36 @@ FrontEnd::FrontEnd()
    PendingBackends        = 0;
    InitCompleted          = false;
    ShutdownCalled         = false; 
+   ConnectTimeout         = MAX_WAIT_RETRIES;
+   nextRequestID          = 1;
+   DegradedMode           = false;
+   RendezvousPort         = -1;
+
+   char *env_SYNAPSE_CONNECT_TIMEOUT = getenv("SYNAPSE_CONNECT_TIMEOUT");
+   if ((env_SYNAPSE_CONNECT_TIMEOUT != NULL) && (atoi(env_SYNAPSE_CONNECT_TIMEOUT) > 0))
+   {
+      ConnectTimeout = atoi(env_SYNAPSE_CONNECT_TIMEOUT);
+   }
+
+   char *env_SYNAPSE_DEGRADED_MODE = getenv("SYNAPSE_DEGRADED_MODE");
+   if ((env_SYNAPSE_DEGRADED_MODE != NULL) && (atoi(env_SYNAPSE_DEGRADED_MODE) > 0))
+   {
+      DegradedMode = true;
+   }
+
+   char *env_SYNAPSE_RENDEZVOUS_PORT = getenv("SYNAPSE_RENDEZVOUS_PORT");
+   if ((env_SYNAPSE_RENDEZVOUS_PORT != NULL) && (atoi(env_SYNAPSE_RENDEZVOUS_PORT) >= 0))
+   {
+      RendezvousPort = atoi(env_SYNAPSE_RENDEZVOUS_PORT);
+   }
+
+   lastReport.reqID    = 0;
+   lastReport.expected = 0;
+   lastReport.received = 0;
+
+   pthread_mutex_init(&attachLock, NULL);
+   pthread_cond_init(&attachCond, NULL);
+   gettimeofday(&attachEpoch, NULL);
 }
 
 
@@ -70,7 +107,8 @@ void BE_Join_Callback(Event *evt, void *fe_ptr)
    if ( (evt->get_Class() == Event::TOPOLOGY_EVENT) &&
         (evt->get_Type() == TopologyEvent::TOPOL_ADD_BE) )
    {
-      fe->numBackendsConnected ++;
+      TopologyEvent::TopolEventData *data = (TopologyEvent::TopolEventData *)evt->get_Data();
+      fe->BackendJoined( (data != NULL) ? data->_rank : 0 );
    }
 }
 
@@ -86,8 +124,232 @@ void BE_Quit_Callback(Event *evt, void *fe_ptr)
    if ( (evt->get_Class() == Event::TOPOLOGY_EVENT) &&
         (evt->get_Type() == TopologyEvent::TOPOL_REMOVE_NODE) )
    {
-      fe->numBackendsConnected --;
+      TopologyEvent::TopolEventData *data = (TopologyEvent::TopolEventData *)evt->get_Data();
+      fe->BackendLeft( (data != NULL) ? data->_rank : 0 );
+   }
+}
+
+
+/**
+ * Accounts a new back-end attached to the network and wakes up WaitForBackends(). 
+ * Called from the MRNet event thread through BE_Join_Callback.
+ * @param rank MRNet rank of the back-end that attached.
+ */
+void FrontEnd::BackendJoined(unsigned int rank)
+{
+   struct timeval now;
+   BackendAttach  attach;
+
+   gettimeofday(&now, NULL);
+   attach.rank    = rank;
+   attach.seconds = (now.tv_sec - attachEpoch.tv_sec) + (now.tv_usec - attachEpoch.tv_usec) / 1000000.0;
+
+   RecordAttach(attach.seconds);
+
+   pthread_mutex_lock(&attachLock);
+   if (joinedBackEnds.insert(rank).second) numBackendsConnected ++;
+   attachTimes.push_back(attach);
+   pthread_cond_signal(&attachCond);
+   pthread_mutex_unlock(&attachLock);
+}
+
+
+/**
+ * Accounts a process that left the network. Called from the MRNet event thread through BE_Quit_Callback.
+ * The removals are reported for every process of the tree, so only the back-ends counted by BackendJoined 
+ * are discounted. After the initialization, the back-ends that leave are no longer expected to answer 
+ * (see ExpectedACKs).
+ * @param rank MRNet rank of the process that left.
+ */
+void FrontEnd::BackendLeft(unsigned int rank)
+{
+   pthread_mutex_lock(&attachLock);
+   if (joinedBackEnds.erase(rank) > 0)
+   {
+      numBackendsConnected --;
+   }
+   if ((initialBackEnds.find(rank) != initialBackEnds.end()) && (lostBackEnds.insert(rank).second))
+   {
+      CountBackendLost();
+      cerr << "[FE] WARNING: Back-end rank " << rank << " left the network" << endl;
+   }
+   pthread_mutex_unlock(&attachLock);
+}
+
+
+/**
+ * Enables the degraded mode, where the dispatches keep going with the surviving back-ends when 
+ * some of them fail, instead of failing the whole run. Has to be called before Init(), because 
+ * it also enables MRNet failure recovery. Can be enabled setting SYNAPSE_DEGRADED_MODE=1 too.
+ * @param enable true to enable the degraded mode; false to disable it.
+ */
+void FrontEnd::EnableDegradedMode(bool enable)
+{
+   DegradedMode = enable;
+}
+
+
+/**
+ * Returns how many back-ends contribute to the reductions of the control stream. In degraded 
+ * mode, these are the back-ends that were connected at initialization minus those lost since.
+ * @return the number of back-ends expected to answer.
+ */
+unsigned int FrontEnd::ExpectedACKs(void)
+{
+   unsigned int expected;
+
+   if ((! DegradedMode) || (initialBackEnds.size() == 0))
+   {
+      return stControl->size();
+   }
+   pthread_mutex_lock(&attachLock);
+   expected = initialBackEnds.size() - lostBackEnds.size();
+   pthread_mutex_unlock(&attachLock);
+   return expected;
+}
+
+
+/**
+ * Checks whether a back-end left the network after the initialization.
+ * @param rank MRNet rank of the back-end.
+ * @return true if the back-end was lost; false otherwise.
+ */
+bool FrontEnd::IsBackendLost(unsigned int rank)
+{
+   bool lost;
+
+   pthread_mutex_lock(&attachLock);
+   lost = (lostBackEnds.find(rank) != lostBackEnds.end());
+   pthread_mutex_unlock(&attachLock);
+   return lost;
+}
+
+
+/**
+ * Returns how many back-ends left the network after the initialization.
+ * @return the number of back-ends lost.
+ */
+unsigned int FrontEnd::CountLostBackEnds(void)
+{
+   unsigned int lost;
+
+   pthread_mutex_lock(&attachLock);
+   lost = lostBackEnds.size();
+   pthread_mutex_unlock(&attachLock);
+   return lost;
+}
+
+
+/**
+ * Checks whether the degraded mode is enabled (see EnableDegradedMode).
+ * @return true if the dispatches go on with the surviving back-ends; false otherwise.
+ */
+bool FrontEnd::IsDegraded(void)
+{
+   return DegradedMode;
+}
+
+
+/**
+ * Checks the number of ACKs received through the control stream, and records the outcome 
+ * in the dispatch report. In degraded mode, fewer ACKs than back-ends means the reduction 
+ * completed with the survivors: the missing ranks are reported and the check succeeds.
+ * @param countACKs Number of ACKs received.
+ * @param what      Name of the operation that is being acknowledged, for the messages.
+ * @return 0 if all the expected back-ends answered; -1 otherwise.
+ */
+int FrontEnd::CheckACKs(unsigned int countACKs, string what)
+{
+   unsigned int expected    = ExpectedACKs();
+   unsigned int lastMissing = lastReport.missingRanks.size();
+
+   lastReport.expected = expected;
+   lastReport.received = countACKs;
+   lastReport.missingRanks.clear();
+   if (DegradedMode)
+   {
+      pthread_mutex_lock(&attachLock);
+      lastReport.missingRanks.assign(lostBackEnds.begin(), lostBackEnds.end());
+      pthread_mutex_unlock(&attachLock);
+   }
+
+   /* In degraded mode, fewer ACKs than expected means a back-end died before its MRNet event reached us */
+   if ((countACKs > expected) || ((countACKs < expected) && ((! DegradedMode) || (countACKs == 0))))
+   {
+      cerr << "[FE] ERROR: " << what << ": " << countACKs << " ACKs received, expected " << expected << endl;
+      return -1;
+   }
+
+   /* Warn every time more back-ends are lost */
+   if ((countACKs < expected) || (lastReport.missingRanks.size() != lastMissing))
+   {
+      cerr << "[FE] WARNING: " << what << ": completed with " << countACKs << " back-ends, "
+           << lastReport.missingRanks.size() << " lost:";
+      for (unsigned int i=0; i<lastReport.missingRanks.size(); i++)
+      {
+         cerr << " " << lastReport.missingRanks[i];
+      }
+      cerr << endl;
    }
+   return 0;
+}
+
+
+/**
+ * Makes the no-BE instantiation run a rendezvous server, where the back-ends ask for their 
+ * parent by rank (see BackEnd::Init(int, const char *, int)) instead of reading the connections 
+ * file. Has to be called before Init(). Can be enabled setting SYNAPSE_RENDEZVOUS_PORT too.
+ * @param port TCP port to listen on, or 0 to pick any free port (see GetRendezvousPort).
+ */
+void FrontEnd::EnableRendezvous(int port)
+{
+   RendezvousPort = port;
+}
+
+
+/**
+ * Returns the port of the rendezvous server, to pass it to the back-ends.
+ * @return the TCP port; -1 if the server is not running.
+ */
+int FrontEnd::GetRendezvousPort(void)
+{
+   return rendezvous.GetPort();
+}
+
+
+/**
+ * Returns the ACKs collected for the last request completed, and which back-ends were missing.
+ * @return the dispatch report.
+ */
+const DispatchReport & FrontEnd::GetLastDispatchReport(void)
+{
+   return lastReport;
+}
+
+
+/**
+ * Sets how many seconds Connect() waits for the back-ends to attach before giving up.
+ * @param seconds The connection deadline.
+ */
+void FrontEnd::SetConnectTimeout(unsigned int seconds)
+{
+   if (seconds > 0) ConnectTimeout = seconds;
+}
+
+
+/**
+ * Returns the attach time of every back-end, in the order they connected. The MRNet event thread 
+ * keeps appending to them as back-ends attach, so the caller gets a copy.
+ * @return vector of (rank, seconds since the connections file was published).
+ */
+vector<BackendAttach> FrontEnd::GetAttachTimes(void)
+{
+   vector<BackendAttach> attaches;
+
+   pthread_mutex_lock(&attachLock);
+   attaches = attachTimes;
+   pthread_mutex_unlock(&attachLock);
+   return attaches;
 }
 
 
@@ -121,9 +383,9 @@ int FrontEnd::Init(const char *TopologyFile, const char *BackendExe, const char
    }
 
    /* Register callbacks */
-   if ( ! net->set_FailureRecovery(false) )
+   if ( ! net->set_FailureRecovery(DegradedMode) )
    {
-      cerr << "[FE] ERROR: Failed to disable failure recovery" << endl;
+      cerr << "[FE] ERROR: Failed to " << (DegradedMode ? "enable" : "disable") << " failure recovery" << endl;
       delete net;
       return -1;
    }
@@ -144,6 +406,8 @@ int FrontEnd::Init(const char *TopologyFile, const char *BackendExe, const char
 
 /** 
  * Normal instantiation that reads the topology from the environment variable SYNAPSE_TOPOLOGY. 
+ * If set to "auto", a balanced topology is generated for SYNAPSE_NUM_BE back-ends instead 
+ * (see TopologyGenerator::FromEnvironment).
  * @param BackendExe The backend executable to start.
  * @param BackendArgs The arguments of the backend.
  * @return 0 if the MRNet starts successfully; -1 otherwise.
@@ -154,18 +418,55 @@ int FrontEnd::Init(const char *BackendExe, const char **BackendArgs)
    if (env_SYNAPSE_TOPOLOGY == NULL)
    {
       cerr << "[FE] ERROR: SYNAPSE_TOPOLOGY environment variable is not defined!" << endl; 
-      cerr << "[FE] Make it point to the MRNet topology file." << endl;
+      cerr << "[FE] Make it point to the MRNet topology file, or set it to 'auto' to generate it." << endl;
       return -1;
    }
+   if (TopologyGenerator::Requested(env_SYNAPSE_TOPOLOGY))
+   {
+      char *env_SYNAPSE_NUM_BE = getenv("SYNAPSE_NUM_BE");
+      if (env_SYNAPSE_NUM_BE == NULL)
+      {
+         cerr << "[FE] ERROR: SYNAPSE_NUM_BE environment variable is not defined!" << endl;
+         cerr << "[FE] Specify how many back-ends have to be spawned in the generated topology." << endl;
+         return -1;
+      }
+      TopologyGenerator topology;
+      if (TopologyGenerator::FromEnvironment(topology) != 0) return -1;
+      return Init(topology, BackendExe, BackendArgs, atoi(env_SYNAPSE_NUM_BE));
+   }
    return Init(((const char *)env_SYNAPSE_TOPOLOGY), BackendExe, BackendArgs);
 }
 
 
+/**
+ * Instantiates the MRNet and spawns the backends, in a balanced topology generated for the given 
+ * number of back-ends.
+ * @param topology    Generator of the topology (fan-out or depth, and hosts).
+ * @param BackendExe  The backend executable to start.
+ * @param BackendArgs The arguments of the backend.
+ * @param numBackends Number of backends to spawn.
+ * @return 0 if the MRNet starts successfully; -1 otherwise.
+ */
+int FrontEnd::Init(TopologyGenerator &topology, const char *BackendExe, const char **BackendArgs, unsigned int numBackends)
+{
+   string TopologyFile;
+
+   if (topology.WriteTemp(numBackends, true, TopologyFile) != 0)
+   {
+      cerr << "[FE] ERROR: Cannot generate the topology for " << numBackends << " back-ends" << endl;
+      return -1;
+   }
+   int rc = Init(TopologyFile.c_str(), BackendExe, BackendArgs);
+   unlink(TopologyFile.c_str());
+   return rc;
+}
+
+
 /**
  * Instantiates the MRNet except the backends, and waits for these to connect.
  * @param TopologyFile    Topology of the network (not including backends).
  * @param numBackends     Number of backends that will be manually spawned.
- * @param ConnectionsFile File where backends connections will be written to.
+ * @param ConnectionsFile File where backends connections will be written to (NULL to only use the rendezvous server, see EnableRendezvous).
  * @param wait_for_BEs    Optional argument set to true by default. In this case,
  *                        the front-end waits for the back-ends to connect and 
  *                        completes the initialization. Otherwise, the user will
@@ -187,9 +488,9 @@ int FrontEnd::Init(const char *TopologyFile, unsigned int numBackends, const cha
    }
 
    /* Register callbacks */
-   if ( ! net->set_FailureRecovery(false) )
+   if ( ! net->set_FailureRecovery(DegradedMode) )
    {
-      cerr << "[FE] ERROR: Failed to disable failure recovery" << endl;
+      cerr << "[FE] ERROR: Failed to " << (DegradedMode ? "enable" : "disable") << " failure recovery" << endl;
       delete net;
       return -1;
    }
@@ -214,15 +515,40 @@ int FrontEnd::Init(const char *TopologyFile, unsigned int numBackends, const cha
       return -1;
    }
 
-   /* Write connection information to the specified file */
-   PendingConnections BE_connex(ConnectionsFile);
-   if (BE_connex.Write(net, numBackends) != 0)
+   /* Compute where every back-end connects */
+   vector<ConnectionsRecord> records;
+   if (PendingConnections::Assign(net, numBackends, records) != 0)
    {
-      cerr << "[FE] ERROR: Cannot write connections file '" << ConnectionsFile << "'" << endl;
       delete net;
       return -1;
    }
-   else ConnectionsFileWritten = true;
+
+   /* Serve the connection information to the back-ends that ask for it */
+   gettimeofday(&attachEpoch, NULL);
+   if (RendezvousPort != -1)
+   {
+      if (rendezvous.Start(RendezvousPort, records) != 0)
+      {
+         cerr << "[FE] ERROR: Cannot start the rendezvous server" << endl;
+         delete net;
+         return -1;
+      }
+      cout << "[FE] Rendezvous server listening on port " << rendezvous.GetPort() << endl;
+   }
+
+   /* Write connection information to the specified file */
+   if (ConnectionsFile != NULL)
+   {
+      PendingConnections BE_connex(ConnectionsFile);
+      if (BE_connex.Write(records) != 0)
+      {
+         cerr << "[FE] ERROR: Cannot write connections file '" << ConnectionsFile << "'" << endl;
+         rendezvous.Stop();
+         delete net;
+         return -1;
+      }
+      else ConnectionsFileWritten = true;
+   }
 
    /* Do the last part of the initialization right away or return the control to the user 
     * who will call Connect() manually. 
@@ -240,7 +566,9 @@ int FrontEnd::Init(const char *TopologyFile, unsigned int numBackends, const cha
 
 /**
  * No back-ends instantiation that reads the topology from the environment variable SYNAPSE_TOPOLOGY,
- * the number of back-ends from SYNAPSE_NUM_BE, and the connections file from SYNAPSE_BE_CONNECTIONS.
+ * the number of back-ends from SYNAPSE_NUM_BE, and the connections file from SYNAPSE_BE_CONNECTIONS
+ * (optional if the rendezvous server is enabled). If SYNAPSE_TOPOLOGY is set to "auto", a balanced 
+ * topology is generated for the number of back-ends (see TopologyGenerator::FromEnvironment).
  *
  * @param wait_for_BEs    Optional argument set to true by default. In this case,
  *                        the front-end waits for the back-ends to connect and 
@@ -255,7 +583,7 @@ int FrontEnd::Init(bool wait_for_BEs)
    if (env_SYNAPSE_TOPOLOGY == NULL)
    {
       cerr << "[FE] ERROR: SYNAPSE_TOPOLOGY environment variable is not defined!" << endl;
-      cerr << "[FE] Make it point to the MRNet topology file." << endl;
+      cerr << "[FE] Make it point to the MRNet topology file, or set it to 'auto' to generate it." << endl;
       return -1;
    }
    char *env_SYNAPSE_NUM_BE = getenv("SYNAPSE_NUM_BE");
@@ -266,16 +594,46 @@ int FrontEnd::Init(bool wait_for_BEs)
       return -1;
    }
    char *env_SYNAPSE_BE_CONNECTIONS = getenv("SYNAPSE_BE_CONNECTIONS");
-   if (env_SYNAPSE_BE_CONNECTIONS == NULL)
+   if ((env_SYNAPSE_BE_CONNECTIONS == NULL) && (RendezvousPort == -1))
    {
       cerr << "[FE] ERROR: SYNAPSE_BE_CONNECTIONS environment variable is not defined!" << endl;
       cerr << "[FE] Make it point to the back-ends connection file." << endl;
       return -1;
    }
+   if (TopologyGenerator::Requested(env_SYNAPSE_TOPOLOGY))
+   {
+      TopologyGenerator topology;
+      if (TopologyGenerator::FromEnvironment(topology) != 0) return -1;
+      return Init(topology, atoi(env_SYNAPSE_NUM_BE), ((const char *)env_SYNAPSE_BE_CONNECTIONS), wait_for_BEs);
+   }
    return Init(((const char *)env_SYNAPSE_TOPOLOGY), atoi(env_SYNAPSE_NUM_BE), ((const char *)env_SYNAPSE_BE_CONNECTIONS), wait_for_BEs);
 }
 
 
+/**
+ * Instantiates the MRNet except the backends in a balanced topology generated for the given number 
+ * of back-ends, where every leaf serves up to fan-out back-ends, and waits for these to connect.
+ * @param topology        Generator of the topology (fan-out or depth, and hosts).
+ * @param numBackends     Number of backends that will be manually spawned.
+ * @param ConnectionsFile File where backends connections will be written to (NULL to only use the rendezvous server).
+ * @param wait_for_BEs    Wait for the back-ends to connect, or let the user call Connect() later.
+ * @return 0 if the MRNet starts successfully; -1 otherwise.
+ */
+int FrontEnd::Init(TopologyGenerator &topology, unsigned int numBackends, const char *ConnectionsFile, bool wait_for_BEs)
+{
+   string TopologyFile;
+
+   if (topology.WriteTemp(numBackends, false, TopologyFile) != 0)
+   {
+      cerr << "[FE] ERROR: Cannot generate the topology for " << numBackends << " back-ends" << endl;
+      return -1;
+   }
+   int rc = Init(TopologyFile.c_str(), numBackends, ConnectionsFile, wait_for_BEs);
+   unlink(TopologyFile.c_str());
+   return rc;
+}
+
+
 /**
  * In the remote instantiation mode, this is the second part of the Init() function. 
  * Init() can call this function automatically if specified, otherwise you have to 
@@ -289,7 +647,12 @@ int FrontEnd::Init(bool wait_for_BEs)
 int FrontEnd::Connect()
 {
    /* Wait for back-ends to connect */
-   if ( WaitForBackends(PendingBackends) != 0 )  
+   int rc = WaitForBackends(PendingBackends);
+
+   /* All back-ends know their parent already */
+   rendezvous.Stop();
+
+   if ( rc != 0 )  
    {
       delete net;
       return -1;
@@ -322,38 +685,81 @@ int FrontEnd::CommonInit()
       return -1;
    }
 
+   /* Take the topology snapshot once all back-ends are in */
+   if (WatchTopology() != 0)
+   {
+      return -1;
+   }
+
+   /* From now on, the back-ends that leave are accounted as lost */
+   TopologySnapshot snapshot = GetTopology();
+   pthread_mutex_lock(&attachLock);
+   initialBackEnds.insert(snapshot.beRanks.begin(), snapshot.beRanks.end());
+   pthread_mutex_unlock(&attachLock);
+
+   /* Load the filters listed in SYNAPSE_PRELOAD_FILTERS before the protocols ask for them */
+   char *env_SYNAPSE_PRELOAD_FILTERS = getenv("SYNAPSE_PRELOAD_FILTERS");
+   if (env_SYNAPSE_PRELOAD_FILTERS != NULL)
+   {
+      vector<string> filter_names;
+      split(env_SYNAPSE_PRELOAD_FILTERS, ',', filter_names);
+      PreloadFilters(filter_names);
+   }
+
+   if (StartMetrics() != 0)
+   {
+      return -1;
+   }
+
    InitCompleted = true;
    return 0;
 }
 
 
 /**
- * Waits for all the backends to connect to the network. 
+ * Waits for all the backends to connect to the network. The wait sleeps on a condition
+ * that BE_Join_Callback signals, so it returns as soon as the last back-end attaches, 
+ * or fails when the connection deadline (see SetConnectTimeout) expires.
  * @param numBackends     Number of backends to wait for. 
- * @param ConnectionsFile File where backends connections will be written to.
  * @return 0 on success; -1 otherwise.
  */
 int FrontEnd::WaitForBackends(unsigned int numBackends) 
 {
+   struct timeval  now;
+   struct timespec deadline;
+   time_t          lastReport = 0;
+   unsigned int    countWaitFor = numBackends, lastWaitFor = 0;
+   int             rc = 0;
+
+   gettimeofday(&now, NULL);
+   deadline.tv_sec  = now.tv_sec + ConnectTimeout;
+   deadline.tv_nsec = now.tv_usec * 1000;
+
    /* Wait for backends to attach */
-   unsigned int retries=0;
-   unsigned int countWaitFor=numBackends, lastWaitFor=0;
-   do
+   pthread_mutex_lock(&attachLock);
+   while ((numBackendsConnected < numBackends) && (rc != ETIMEDOUT))
    {
       countWaitFor = numBackends - numBackendsConnected;
-      if (countWaitFor != lastWaitFor)
+      gettimeofday(&now, NULL);
+      if ((countWaitFor != lastWaitFor) && (now.tv_sec != lastReport))
+      {
          cout << "Waiting for " << countWaitFor << " backends to connect..." << endl;
-      lastWaitFor = countWaitFor;
-      retries ++;
-      sleep(1);
-   } while ((numBackendsConnected != numBackends) && (retries < MAX_WAIT_RETRIES));
+         lastWaitFor = countWaitFor;
+         lastReport  = now.tv_sec;
+      }
+      rc = pthread_cond_timedwait(&attachCond, &attachLock, &deadline);
+   }
+   countWaitFor = (numBackendsConnected < numBackends ? numBackends - numBackendsConnected : 0);
+   pthread_mutex_unlock(&attachLock);
 
-   if (numBackendsConnected != numBackends)
+   ReportAttachTimes();
+
+   if (countWaitFor > 0)
    {
       cerr << "[FE] ERROR: Connection time-out! " 
-           << numBackends - numBackendsConnected 
+           << countWaitFor
            << " backends failed to connect within " 
-           << MAX_WAIT_RETRIES << " seconds" << endl;
+           << ConnectTimeout << " seconds" << endl;
       return -1;
    }
    else
@@ -363,6 +769,53 @@ int FrontEnd::WaitForBackends(unsigned int numBackends)
    }
 }
 
+
+static bool SlowerAttach(const BackendAttach &a, const BackendAttach &b)
+{
+   return a.seconds > b.seconds;
+}
+
+/**
+ * Prints a histogram of the back-ends attach times and the hosts of the slowest ones,
+ * to spot which nodes are delaying the start-up.
+ */
+void FrontEnd::ReportAttachTimes(void)
+{
+   const unsigned int NUM_BUCKETS = 10, NUM_SLOWEST = 5;
+   vector<BackendAttach> sorted;
+   unsigned int buckets[NUM_BUCKETS] = { 0 };
+
+   pthread_mutex_lock(&attachLock);
+   sorted = attachTimes;
+   pthread_mutex_unlock(&attachLock);
+
+   if (sorted.size() == 0) return;
+
+   std::sort(sorted.begin(), sorted.end(), SlowerAttach);
+   double max_secs = sorted[0].seconds;
+   double width    = (max_secs > 0 ? max_secs / NUM_BUCKETS : 1);
+
+   for (unsigned int i=0; i<sorted.size(); i++)
+   {
+      unsigned int b = (unsigned int)(sorted[i].seconds / width);
+      if (b >= NUM_BUCKETS) b = NUM_BUCKETS - 1;
+      buckets[b] ++;
+   }
+
+   cout << "[FE] Back-ends attach times (seconds since the connections file was written):" << endl;
+   for (unsigned int b=0; b<NUM_BUCKETS; b++)
+   {
+      cout << "[FE]   [" << b * width << ", " << (b + 1) * width << ") " << buckets[b] << endl;
+   }
+   for (unsigned int i=0; (i<NUM_SLOWEST) && (i<sorted.size()); i++)
+   {
+      NetworkTopology::Node *node = net->get_NetworkTopology()->find_Node(sorted[i].rank);
+      cout << "[FE]   Slowest #" << i+1 << ": rank " << sorted[i].rank 
+           << " (" << (node != NULL ? node->get_HostName() : "unknown host") << ") "
+           << sorted[i].seconds << "s" << endl;
+   }
+}
+
 bool FrontEnd::isUp()
 {
   return (InitCompleted) && (!ShutdownCalled);
@@ -389,65 +842,383 @@ bool FrontEnd::isConnectionsFileWritten()
 int FrontEnd::Dispatch(string prot_id, int &status, Protocol *& prot)
 {
    status = -1;
+   prot   = NULL;
+
+   /* DispatchAsync and Wait trace the request and its completion, like for any asynchronous dispatch */
+   int handle = DispatchAsync(prot_id);
+   if (handle == -1)
+   {
+      return -1;
+   }
+   return Wait(handle, status, prot);
+}
+
 
+/**
+ * Wrapper for Dispatch(string, Protocol *&) that does not return the protocol by reference.
+ * @param prot_id The protocol identifier.
+ * @param status  Set to the return code of the protocol that is run.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontEnd::Dispatch(string prot_id, int &status)
+{
+   Protocol *prot = NULL;
+   return Dispatch(prot_id, status, prot);
+}
+
+
+/**
+ * Tells the back-ends the next protocol to execute and returns without waiting for them. 
+ * The back-ends start running the protocol right away, while the front-end side of the 
+ * protocol is run when the request is completed with Wait(). Several requests can be 
+ * outstanding at once, and they are completed in the same order they were dispatched.
+ * @param prot_id The protocol identifier.
+ * @return a handle to pass to Wait(); -1 if the protocol is not loaded or the request can not be sent.
+ */
+int FrontEnd::DispatchAsync(string prot_id)
+{
    /* Get the protocol object */
-   prot = MRNetApp::FetchProtocol(prot_id);
+   Protocol *prot = MRNetApp::FetchProtocol(prot_id);
 
-   if (prot != NULL)
+   if (prot == NULL)
    {
-      int tag, countErr = 0;
-      PacketPtr(p);
+      /* Protocol prot_id is not loaded in the front-end! */
+      cerr << "[FE] Error: Protocol '" << prot_id << "' is not loaded!" << endl;
+      return -1;
+   }
+   TraceScope dispatch(TRACE_DISPATCH, prot->Index() + 1);
 
-      cout << "[FE] Dispatching " << prot_id << endl;
-      /* Announce the next protocol to execute to the back-ends */
-      MRN_STREAM_SEND(stControl, TAG_PROT_ID, "%s", prot_id.c_str());
+   /* Protocols loaded in lazy mode set up their streams upon the first dispatch */
+   if ((! prot->StreamsReady()) && (SetupStreams(prot) != 0))
+   {
+      return -1;
+   }
 
-      /* Run the front-end side of the protocol */
-      status = prot->Run();
+   PendingDispatch req;
+   req.reqID  = nextRequestID;
+   req.protID = prot_id;
+   req.prot   = prot;
 
-      /* Receive ACKs from the back-ends */
-#if defined(CONTROL_STREAM_BLOCKING)
-      MRN_STREAM_RECV(stControl, &tag, p, TAG_ACK);
-      p->unpack("%d", &countErr);
-#else
-      for (int i=0; i<stControl->size(); i++)
+   /* Request ID's have to fit in the ACK word (see ACK_WORD) */
+   nextRequestID = (nextRequestID % 0xFFFFFF) + 1;
+
+   cout << "[FE] Dispatching " << prot_id << endl;
+   /* Announce the next protocol to execute to the back-ends */
+   struct timeval phase_start;
+   int            rc;
+   if (metricsEnabled) gettimeofday(&phase_start, NULL);
+   {
+      TraceScope trace(TRACE_PHASE, TRACE_REQUEST_SEND);
+      rc = Synapse::Send(stControl, TAG_PROT_ID, (uint32_t)req.reqID, (uint32_t)prot->Index());
+   }
+   prot->RecordPhase(PHASE_SEND, &phase_start);
+   if (rc != 0)
+   {
+      cerr << "[FE] ERROR: Cannot dispatch " << prot_id << endl;
+      return -1;
+   }
+
+   outstandingRequests.push_back(req);
+   return req.reqID;
+}
+
+
+/**
+ * Completes a request issued with DispatchAsync(), running the front-end side of the 
+ * protocol and collecting the ACKs from the back-ends. All requests dispatched before
+ * this one are completed first.
+ * @param handle The handle returned by DispatchAsync().
+ * @param status Set to the return code of the protocol that is run.
+ * @param prot   Protocol object is returned by reference to retrieve results.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontEnd::Wait(int handle, int &status, Protocol *& prot)
+{
+   map<int, CompletedDispatch>::iterator it;
+   bool outstanding = false;
+
+   status = -1;
+   prot   = NULL;
+
+   for (unsigned int i=0; i<outstandingRequests.size(); i++)
+   {
+      if (outstandingRequests[i].reqID == (unsigned int)handle) outstanding = true;
+   }
+   if ((! outstanding) && (completedRequests.find(handle) == completedRequests.end()))
+   {
+      cerr << "[FE] Error: Unknown dispatch request " << handle << endl;
+      return -1;
+   }
+
+   /* Requests are completed in order, up to the requested one */
+   while ((it = completedRequests.find(handle)) == completedRequests.end())
+   {
+      CompleteNextRequest();
+   }
+
+   int rc = it->second.rc;
+   status = it->second.status;
+   prot   = it->second.prot;
+   completedRequests.erase(it);
+   return rc;
+}
+
+
+/**
+ * Wrapper for Wait(int, int &, Protocol *&) that does not return the protocol by reference.
+ * @param handle The handle returned by DispatchAsync().
+ * @param status Set to the return code of the protocol that is run.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontEnd::Wait(int handle, int &status)
+{
+   Protocol *prot = NULL;
+   return Wait(handle, status, prot);
+}
+
+
+/**
+ * Completes all the outstanding requests. Their results are kept until retrieved with Wait().
+ */
+void FrontEnd::WaitAll(void)
+{
+   while (outstandingRequests.size() > 0)
+   {
+      CompleteNextRequest();
+   }
+}
+
+
+/**
+ * Dispatches a sequence of protocols in a single control message. The back-ends run them
+ * in order and send back one ACK for the whole batch, so the cost of the control round-trip
+ * is paid only once. The ACK carries the errors of every protocol, added up over the back-ends.
+ * @param protIDs    The protocol identifiers, in the order they have to run.
+ * @param status     Set to the return code of the front-end side of every protocol.
+ * @param countErr   Set to the number of protocol runs that failed in the back-ends.
+ * @param protErrors Set to the number of back-ends where every protocol failed, in the same order.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontEnd::DispatchBatch(vector<string> protIDs, vector<int> &status, unsigned int &countErr, vector<unsigned int> &protErrors)
+{
+   vector<Protocol *>   prots;
+   vector<uint32_t>     indexes;
+   int rc = 0;
+
+   status.assign(protIDs.size(), -1);
+   protErrors.assign(protIDs.size(), 0);
+   countErr = 0;
+
+   for (unsigned int i=0; i<protIDs.size(); i++)
+   {
+      Protocol *prot = MRNetApp::FetchProtocol(protIDs[i]);
+      if (prot == NULL)
       {
-        int x = 0;
-        MRN_STREAM_RECV(stControl, &tag, p, TAG_ACK);
-        p->unpack("%d", &x);
-        countErr += x;
+         /* Protocol is not loaded in the front-end! */
+         cerr << "[FE] Error: Protocol '" << protIDs[i] << "' is not loaded!" << endl;
+         return -1;
       }
-#endif
-      /* DEBUG 
-      std::cout << "FrontEnd::Dispatch: Received ACK's countErr=" << countErr << std::endl; */
-      if (countErr != 0)
+      if ((! prot->StreamsReady()) && (SetupStreams(prot) != 0))
       {
-         /* Some BEs had errors! */
-         cerr << "[FE] " << prot_id << ": ERROR: " << countErr << " back-ends failed!" << endl; 
          return -1;
-      } 
+      }
+      prots.push_back(prot);
+      indexes.push_back(prot->Index());
    }
-   else
+   if (prots.size() == 0) return 0;
+
+   unsigned int reqID = nextRequestID;
+   nextRequestID = (nextRequestID % 0xFFFFFF) + 1;
+
+   cout << "[FE] Dispatching batch of " << prots.size() << " protocols" << endl;
+   {
+      TraceScope trace(TRACE_PHASE, TRACE_REQUEST_SEND);
+      MRN_STREAM_SEND(stControl, TAG_PROT_BATCH, "%ud %aud", reqID, &indexes[0], indexes.size());
+   }
+
+   /* Earlier requests run first in the back-ends, so their front-end side goes first too */
+   WaitAll();
+
+   /* Run the front-end side of the protocols */
+   for (unsigned int i=0; i<prots.size(); i++)
+   {
+      struct timeval phase_start;
+      if (metricsEnabled) gettimeofday(&phase_start, NULL);
+      {
+         /* The request and the ACK are shared by the whole batch, so only the runs are told apart */
+         TraceScope dispatch(TRACE_DISPATCH, prots[i]->Index() + 1);
+         TraceScope trace(TRACE_PHASE, TRACE_FE_RUN);
+         status[i] = prots[i]->Run();
+         FlushPending();
+      }
+      prots[i]->RecordPhase(PHASE_RUN, &phase_start);
+   }
+
+   {
+      TraceScope trace(TRACE_PHASE, TRACE_ACK_REDUCTION);
+      rc = CollectACK(reqID, countErr, &protErrors);
+   }
+   for (unsigned int i=0; i<prots.size(); i++)
+   {
+      CountDispatch(prots[i]->GetMetrics(), (rc != 0) || (status[i] != 0) || (protErrors[i] != 0));
+   }
+   if (rc != 0)
    {
-      /* Protocol prot_id is not loaded in the front-end! */
-      cerr << "[FE] Error: Protocol '" << prot_id << "' is not loaded!" << endl;
       return -1;
    }
-   cout << "[FE] " << prot_id << ": SUCCESS" << endl; 
-   return 0;
+   if (countErr != 0)
+   {
+      cerr << "[FE] Batch: ERROR: " << countErr << " protocol runs failed in the back-ends!" << endl;
+      rc = -1;
+   }
+   else
+   {
+      cout << "[FE] Batch: SUCCESS" << endl;
+   }
+   return rc;
 }
 
 
 /**
- * Wrapper for Dispatch(string, Protocol *&) that does not return the protocol by reference.
- * @param prot_id The protocol identifier.
- * @param status  Set to the return code of the protocol that is run.
+ * Wrapper for DispatchBatch(vector<string>, vector<int> &, unsigned int &, vector<unsigned int> &) that does 
+ * not return the errors of every protocol.
+ * @param protIDs  The protocol identifiers, in the order they have to run.
+ * @param status   Set to the return code of the front-end side of every protocol.
+ * @param countErr Set to the number of protocol runs that failed in the back-ends.
  * @return 0 on success; -1 otherwise.
  */
-int FrontEnd::Dispatch(string prot_id, int &status)
+int FrontEnd::DispatchBatch(vector<string> protIDs, vector<int> &status, unsigned int &countErr)
 {
-   Protocol *prot = NULL;
-   return Dispatch(prot_id, status, prot);
+   vector<unsigned int> protErrors;
+   return DispatchBatch(protIDs, status, countErr, protErrors);
+}
+
+
+/**
+ * Wrapper for DispatchBatch(vector<string>, vector<int> &, unsigned int &) that does not return the error count.
+ * @param protIDs The protocol identifiers, in the order they have to run.
+ * @param status  Set to the return code of the front-end side of every protocol.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontEnd::DispatchBatch(vector<string> protIDs, vector<int> &status)
+{
+   unsigned int countErr = 0;
+   return DispatchBatch(protIDs, status, countErr);
+}
+
+
+/**
+ * Runs the front-end side of the oldest outstanding request and collects its ACKs.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontEnd::CompleteNextRequest(void)
+{
+   PendingDispatch   req = outstandingRequests.front();
+   CompletedDispatch done;
+   unsigned int      countErr = 0;
+
+   outstandingRequests.pop_front();
+   TraceScope dispatch(TRACE_DISPATCH, req.prot->Index() + 1);
+
+   /* Run the front-end side of the protocol */
+   struct timeval phase_start;
+   if (metricsEnabled) gettimeofday(&phase_start, NULL);
+   done.prot   = req.prot;
+   {
+      TraceScope trace(TRACE_PHASE, TRACE_FE_RUN);
+      done.status = req.prot->Run();
+      FlushPending();
+   }
+   req.prot->RecordPhase(PHASE_RUN, &phase_start);
+
+   if (metricsEnabled) gettimeofday(&phase_start, NULL);
+   {
+      TraceScope trace(TRACE_PHASE, TRACE_ACK_REDUCTION);
+      done.rc = CollectACK(req.reqID, countErr);
+   }
+   req.prot->RecordPhase(PHASE_ACK, &phase_start);
+
+   /* DEBUG 
+   std::cout << "FrontEnd::CompleteNextRequest: Received ACK's countErr=" << countErr << std::endl; */
+   if ((done.rc == 0) && (countErr != 0))
+   {
+      /* Some BEs had errors! */
+      cerr << "[FE] " << req.protID << ": ERROR: " << countErr << " back-ends failed!" << endl; 
+      done.rc = -1;
+   } 
+   else if (done.rc == 0)
+   {
+      cout << "[FE] " << req.protID << ": SUCCESS" << endl; 
+   }
+
+   CountDispatch(req.prot->GetMetrics(), (done.rc != 0) || (done.status != 0));
+   completedRequests[req.reqID] = done;
+   return done.rc;
+}
+
+
+/**
+ * Receives the ACKs for the given request from the back-ends.
+ * @param reqID      The request identifier the ACKs have to match.
+ * @param countErr   Set to the number of back-ends that reported errors.
+ * @param protErrors For batches, sized to the protocols of the batch, and set to the number of back-ends 
+ *                   where every protocol failed. The ACKs of the batches are a "%auld" array with the ACK 
+ *                   word first and then the errors of every protocol, so that TFILTER_SUM adds them all up.
+ * @return 0 on success; -1 if the ACKs do not belong to the request or some are missing (unless in degraded mode).
+ */
+int FrontEnd::CollectACK(unsigned int reqID, unsigned int &countErr, vector<unsigned int> *protErrors)
+{
+   int       tag;
+   uint64_t  word = 0;
+   PacketPtr p;
+   bool      malformed = false;
+
+#if defined(CONTROL_STREAM_BLOCKING)
+   unsigned int countPackets = 1;
+#else
+   unsigned int countPackets = ExpectedACKs();
+#endif
+   for (unsigned int i=0; i<countPackets; i++)
+   {
+      MRN_STREAM_RECV(stControl, &tag, p, TAG_ACK);
+      if (protErrors == NULL)
+      {
+         uint64_t x = 0;
+         p->unpack("%uld", &x);
+         word += x;
+      }
+      else
+      {
+         vector<uint64_t> words;
+         if ((Unpack(p, words) != 0) || (words.size() != protErrors->size() + 1))
+         {
+            malformed = true;
+            continue;
+         }
+         word += words[0];
+         for (unsigned int j=0; j<protErrors->size(); j++) (*protErrors)[j] += words[j+1];
+      }
+   }
+   countErr = ACK_GET_ERRORS(word);
+
+   if (malformed)
+   {
+      cerr << "[FE] ERROR: Malformed ACKs for request " << reqID << endl;
+      return -1;
+   }
+
+   if (! ACK_MATCHES(word, reqID))
+   {
+      cerr << "[FE] ERROR: ACKs for request " << reqID << " do not match (" 
+           << ACK_GET_COUNT(word) << " ACKs received, expected " << ExpectedACKs() << ")" << endl;
+      return -1;
+   }
+
+   /* In degraded mode, the reduction completes with the surviving back-ends */
+   stringstream what;
+   what << "Request " << reqID;
+   lastReport.reqID = reqID;
+   return CheckACKs(ACK_GET_COUNT(word), what.str());
 }
 
 
@@ -469,10 +1240,70 @@ int split(const std::string &s, char delim, std::vector<std::string> &tokens)
 }
 
 
+/**
+ * Splits SYNAPSE_FILTER_PATH into the list of directories where the filters are looked for, 
+ * starting with the current directory. This is done only once.
+ */
+void FrontEnd::ResolveFilterPaths()
+{
+   if (! filterPaths.empty()) return;
+
+   string paths(".");
+   char  *env_filter_path = getenv("SYNAPSE_FILTER_PATH");
+
+   if (env_filter_path != NULL) paths += ":" + string(env_filter_path);
+
+   split(paths, ':', filterPaths);
+}
+
+
+/**
+ * Returns the path of the shared object of a filter in the given directory.
+ * @param dir         Directory of the filter.
+ * @param filter_name Name of the filter.
+ * @return the path to libfilter<filter_name>.so.
+ */
+static string FilterObject(const string &dir, const string &filter_name)
+{
+   string filter_so("");
+
+   if (dir.size() > 0)
+   {
+      filter_so += dir;
+      if (dir[dir.size()-1] != '/') filter_so += "/";
+   }
+   return filter_so + "libfilter" + filter_name + ".so";
+}
+
+
+/**
+ * Loads the filter in the given shared object into the network, and caches its ID so that 
+ * later requests for the same filter do not touch the filesystem nor MRNet.
+ * @param filter_name Name of the filter.
+ * @param filter_so   Path to the shared object.
+ * @return the filter id; or -1 if can not be loaded.
+ */
+int FrontEnd::LoadFilterObject(string filter_name, string filter_so)
+{
+   string filter_func = "filter" + filter_name;
+
+   int filter_id = net->load_FilterFunc( filter_so.c_str(), filter_func.c_str() );
+   if (filter_id == -1)
+   {
+      cerr << "[FE] Error loading filter " << filter_so << ": Function '" << filter_func.c_str() << "' is present in the filter object?" << endl;
+      return -1;
+   }
+   cout << "[FE] Filter " << filter_so << " (routine=" << filter_func << ", ID=" << filter_id << ") loaded successfully!" << endl;
+   filterCache[filter_name] = filter_id;
+   return filter_id;
+}
+
+
 /**
  * Looks for the filter shared object specified by filter_name (appending .so) 
  * in the paths specified with the environment variable SYNAPSE_FILTER_PATH. If the
- * filter is found, it is loaded into the network.
+ * filter is found, it is loaded into the network. Filters that were already loaded
+ * are taken from the cache.
  * @param filter_name Name of the filter shared object.
  * @return the filter id; or -1 if can not be found or loaded. 
  */
@@ -480,61 +1311,172 @@ int FrontEnd::LoadFilter(string filter_name)
 {
    if (filter_name != "")
    {
-      string paths(".");
-      char  *env_filter_path = getenv("SYNAPSE_FILTER_PATH");
-
-      if (env_filter_path != NULL) paths += ":" + string(env_filter_path);
-
-      vector<string> paths_array;
-      split(paths, ':', paths_array);
+      map<string, int>::iterator it = filterCache.find(filter_name);
+      if (it != filterCache.end())
+      {
+         return it->second;
+      }
 
-      for (unsigned int i=0; i<paths_array.size(); i++)
+      ResolveFilterPaths();
+      for (unsigned int i=0; i<filterPaths.size(); i++)
       {
-         string filter_so(""), filter_func("filter");
+         string filter_so = FilterObject(filterPaths[i], filter_name);
 
-         if (paths_array[i].size() > 0)
+         if (access(filter_so.c_str(), R_OK) == 0)
          {
-            filter_so += paths_array[i];
-            if (paths_array[i][paths_array[i].size()-1] != '/') filter_so += "/";
+            return LoadFilterObject(filter_name, filter_so);
          }
-         filter_so += "libfilter";
-         filter_so += filter_name;
-         filter_so += ".so";
+      }
+      cerr << "[FE] Filter '" << filter_name << "' not found!" << endl;
+      return -1;
+   }
+   return -1;
+}
 
-         filter_func += filter_name;
 
-         ifstream fd(filter_so.c_str());
-         if (fd.good())
+/**
+ * Resolves and loads a list of filters in a single pass, before the protocols are loaded. 
+ * Every directory in SYNAPSE_FILTER_PATH is listed once, instead of probing it for every 
+ * filter, and the filters are cached for LoadFilter and Register_Stream.
+ * @param filter_names Names of the filters.
+ * @return 0 if all the filters are loaded; -1 otherwise.
+ */
+int FrontEnd::PreloadFilters(vector<string> &filter_names)
+{
+   int         rc = 0;
+   set<string> pending;
+
+   for (unsigned int i=0; i<filter_names.size(); i++)
+   {
+      if ((filter_names[i] != "") && (filterCache.find(filter_names[i]) == filterCache.end()))
+      {
+         pending.insert(filter_names[i]);
+      }
+   }
+
+   ResolveFilterPaths();
+   for (unsigned int i=0; (i<filterPaths.size()) && (! pending.empty()); i++)
+   {
+      DIR *dir = opendir(filterPaths[i].size() > 0 ? filterPaths[i].c_str() : ".");
+      if (dir == NULL) continue;
+
+      struct dirent *entry;
+      while ((entry = readdir(dir)) != NULL)
+      {
+         /* libfilter<name>.so */
+         string object(entry->d_name);
+         if ((object.size() <= 12) || (object.compare(0, 9, "libfilter") != 0) || (object.compare(object.size() - 3, 3, ".so") != 0))
          {
-            int filter_id = net->load_FilterFunc( filter_so.c_str(), filter_func.c_str() );
-            if (filter_id == -1)
-            {
-               cerr << "[FE] Error loading filter " << filter_so << ": Function '" << filter_func.c_str() << "' is present in the filter object?" << endl;
-               return -1;
-            }
-            else
-            {
-               cout << "[FE] Filter " << filter_so << " (routine=" << filter_func << ", ID=" << filter_id << ") loaded successfully!" << endl;
-               return filter_id;
-            }
+            continue;
+         }
+         string filter_name = object.substr(9, object.size() - 12);
+         if (pending.erase(filter_name) > 0)
+         {
+            if (LoadFilterObject(filter_name, FilterObject(filterPaths[i], filter_name)) == -1) rc = -1;
          }
       }
-      cerr << "[FE] Filter '" << filter_name << "' not found!" << endl;
-      return -1;
+      closedir(dir);
    }
-   return -1;
+
+   for (set<string>::iterator it = pending.begin(); it != pending.end(); ++it)
+   {
+      cerr << "[FE] Filter '" << *it << "' not found!" << endl;
+      rc = -1;
+   }
+   return rc;
+}
+
+
+/**
+ * Returns a stream from the shared pool with the given filters, creating it on first use. 
+ * Protocols that are not dispatched concurrently can share these streams to reduce the 
+ * number of streams (and filter instances) held in every process of the network.
+ * @param up_transfilter_id Transformation filter to apply to data flowing upstream.
+ * @param up_syncfilter_id  Synchronization filter to apply to upstream packets.
+ * @return the shared stream.
+ */
+STREAM * FrontEnd::GetPooledStream(int up_transfilter_id, int up_syncfilter_id)
+{
+   StreamPoolKey key;
+   key.comm           = net->get_BroadcastCommunicator();
+   key.transfilter_id = up_transfilter_id;
+   key.syncfilter_id  = up_syncfilter_id;
+   key.filter_name    = "";
+
+   map<StreamPoolKey, STREAM *>::iterator it = streamPool.find(key);
+   if (it != streamPool.end())
+   {
+      return it->second;
+   }
+   STREAM *new_stream = net->new_Stream(key.comm, up_transfilter_id, up_syncfilter_id);
+   streamPool[key] = new_stream;
+   return new_stream;
+}
+
+
+/**
+ * Returns a stream from the shared pool that uses the filter identified by filter_name,
+ * loading the filter and creating the stream on first use.
+ * @param filter_name      Transformation filter to apply to data flowing upstream.
+ * @param up_syncfilter_id Synchronization filter to apply to upstream packets.
+ * @return the shared stream; NULL if the filter can not be loaded.
+ */
+STREAM * FrontEnd::GetPooledStream(string filter_name, int up_syncfilter_id)
+{
+   StreamPoolKey key;
+   key.comm           = net->get_BroadcastCommunicator();
+   key.transfilter_id = -1;
+   key.syncfilter_id  = up_syncfilter_id;
+   key.filter_name    = filter_name;
+
+   map<StreamPoolKey, STREAM *>::iterator it = streamPool.find(key);
+   if (it != streamPool.end())
+   {
+      return it->second;
+   }
+   int filter_id = LoadFilter( filter_name );
+   if (filter_id == -1)
+   {
+      return NULL;
+   }
+   STREAM *new_stream = net->new_Stream(key.comm, filter_id, up_syncfilter_id);
+   streamPool[key] = new_stream;
+   return new_stream;
 }
 
 
 /**
  * Loads an user-protocol for the front-end side of the MRNet.
- * @param prot Protocol to load in the front-end.
+ * @param prot       Protocol to load in the front-end.
+ * @param lazy_setup Optional argument set to false by default. When true, the streams of the
+ *                   protocol are not created until it is dispatched for the first time. The 
+ *                   back-ends have to load the protocol with the same setting.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontEnd::LoadProtocol(Protocol *prot, bool lazy_setup)
+{
+   /* The numeric ID is assigned first, it is announced to the back-ends along with the streams */
+   MRNetApp::LoadProtocol(prot);
+   ((FrontProtocol *)prot)->Init(this);
+
+   if (! lazy_setup)
+   {
+      return SetupStreams(prot);
+   }
+   return 0;
+}
+
+
+/**
+ * Creates and announces the streams of a protocol. 
+ * @param prot The protocol.
  * @return 0 on success; -1 otherwise.
  */
-int FrontEnd::LoadProtocol(Protocol *prot)
+int FrontEnd::SetupStreams(Protocol *prot)
 {
-	((FrontProtocol *)prot)->Init(this);
-    return MRNetApp::LoadProtocol(prot);
+   /* Streams are announced through the control stream, so the pending ACKs have to be collected first */
+   WaitAll();
+   return ((FrontProtocol *)prot)->SetupStreams();
 }
 
 
@@ -551,6 +1493,8 @@ void FrontEnd::Shutdown()
 
    if (InitCompleted) 
    {
+     WaitAll();
+
      /* Tell back-ends to exit */
      MRN_STREAM_SEND(stControl, TAG_EXIT, "");
 
@@ -558,7 +1502,7 @@ void FrontEnd::Shutdown()
 #if defined(CONTROL_STREAM_BLOCKING)
      MRN_STREAM_RECV(stControl, &tag, p, TAG_EXIT);
 #else
-     for (int i=0; i<stControl->size(); i++)
+     for (unsigned int i=0; i<ExpectedACKs(); i++)
      {
        MRN_STREAM_RECV(stControl, &tag, p, TAG_EXIT);
      }
@@ -567,6 +1511,10 @@ void FrontEnd::Shutdown()
      delete stControl;
    }
 
+   /* Last dump of the metrics, and the trace */
+   StopMetricsDump();
+   WriteTrace();
+
    cout << "[FE] Exiting!" << endl;
 
    /* The Network destructor will cause all internal and leaf tree nodes to exit */
@@ -25,15 +25,76 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <pthread.h>
+#include <sys/time.h>
 #include "MRNetApp.h"
+#include "Rendezvous.h"
+#include "TopologyGenerator.h"
 
-#define MAX_WAIT_RETRIES 300 /* Seconds to wait for the backends to connect before throwing a timeout */
+#define MAX_WAIT_RETRIES 300 /* Default seconds to wait for the backends to connect before throwing a timeout
+                                (can be overriden with SYNAPSE_CONNECT_TIMEOUT or SetConnectTimeout) */
 
 using std::string;
 using std::vector;
+using std::deque;
+using std::map;
+using std::set;
 
 namespace Synapse {
 
+/* Time it took a back-end to attach, counted from the moment the connections file was published */
+typedef struct
+{
+   unsigned int rank;
+   double       seconds;
+} BackendAttach;
+
+/* Filter configuration of the streams in the shared stream pool */
+struct StreamPoolKey
+{
+   Communicator *comm;
+   int           transfilter_id;
+   int           syncfilter_id;
+   string        filter_name;
+
+   bool operator<(const StreamPoolKey &k) const
+   {
+      if (comm           != k.comm)           return comm < k.comm;
+      if (transfilter_id != k.transfilter_id) return transfilter_id < k.transfilter_id;
+      if (syncfilter_id  != k.syncfilter_id)  return syncfilter_id < k.syncfilter_id;
+      return filter_name < k.filter_name;
+   }
+};
+
+/* A protocol dispatched with DispatchAsync() whose ACKs have not been collected yet */
+typedef struct
+{
+   unsigned int reqID;
+   string       protID;
+   Protocol    *prot;
+} PendingDispatch;
+
+/* Outcome of a dispatched protocol, kept until the user calls Wait() */
+typedef struct
+{
+   int       rc;
+   int       status;
+   Protocol *prot;
+} CompletedDispatch;
+
+/* ACKs collected for the last request completed. In degraded mode the reductions complete with 
+   the surviving back-ends, and the ranks that did not answer are listed in missingRanks */
+typedef struct
+{
+   unsigned int         reqID;
+   unsigned int         expected;
+   unsigned int         received;
+   vector<unsigned int> missingRanks;
+} DispatchReport;
+
 class FrontEnd : public MRNetApp
 {
    public:
@@ -45,24 +106,78 @@ class FrontEnd : public MRNetApp
       int  Init(const char *BackendExe,   const char **BackendArgs);
       int  Init(const char *TopologyFile, unsigned int numBackends, const char *ConnectionsFile, bool wait_for_BEs=true);
       int  Init(bool wait_for_BEs=true);
+      int  Init(TopologyGenerator &topology, const char *BackendExe, const char **BackendArgs, unsigned int numBackends);
+      int  Init(TopologyGenerator &topology, unsigned int numBackends, const char *ConnectionsFile, bool wait_for_BEs=true);
       int  Connect();
       int  ConnectedBackEnds(void);
-      int  LoadProtocol(Protocol *prot);
+      int  LoadProtocol(Protocol *prot, bool lazy_setup=false);
       int  LoadFilter  (string filter_name);
+      int  PreloadFilters(vector<string> &filter_names);
+      STREAM * GetPooledStream(int up_transfilter_id, int up_syncfilter_id);
+      STREAM * GetPooledStream(string filter_name,    int up_syncfilter_id);
       int  Dispatch    (string protID, int &status, Protocol *& prot);
       int  Dispatch    (string protID, int &status);
+      int  DispatchAsync(string protID);
+      int  Wait        (int handle, int &status, Protocol *& prot);
+      int  Wait        (int handle, int &status);
+      void WaitAll     (void);
+      int  DispatchBatch(vector<string> protIDs, vector<int> &status, unsigned int &countErr, vector<unsigned int> &protErrors);
+      int  DispatchBatch(vector<string> protIDs, vector<int> &status, unsigned int &countErr);
+      int  DispatchBatch(vector<string> protIDs, vector<int> &status);
       void Shutdown    (void);
       bool isConnectionsFileWritten();
       bool isUp();
+      void SetConnectTimeout(unsigned int seconds);
+      void BackendJoined   (unsigned int rank);
+      void BackendLeft     (unsigned int rank);
+      vector<BackendAttach> GetAttachTimes(void);
+      void EnableDegradedMode(bool enable=true);
+      void EnableRendezvous(int port=0);
+      int  GetRendezvousPort(void);
+      unsigned int ExpectedACKs(void);
+      bool IsBackendLost   (unsigned int rank);
+      unsigned int CountLostBackEnds(void);
+      bool IsDegraded      (void);
+      int  CheckACKs       (unsigned int countACKs, string what);
+      const DispatchReport & GetLastDispatchReport(void);
 
    private:
       bool ConnectionsFileWritten;
       bool InitCompleted;
       bool ShutdownCalled;
       unsigned int PendingBackends;
+      unsigned int ConnectTimeout;
+      bool DegradedMode;   /* Keep dispatching with the surviving back-ends when some of them are lost */
+      int  RendezvousPort; /* Port of the rendezvous server (0 for any free port), or -1 if disabled */
+      RendezvousServer      rendezvous;
+
+      set<unsigned int>     joinedBackEnds;  /* Ranks counted in numBackendsConnected by BackendJoined (protected by attachLock) */
+      set<unsigned int>     initialBackEnds; /* Ranks of the back-ends when the initialization completed */
+      set<unsigned int>     lostBackEnds;    /* Ranks of the back-ends lost since then (protected by attachLock) */
+      DispatchReport        lastReport;
+
+      pthread_mutex_t       attachLock;  /* Protects numBackendsConnected, joinedBackEnds, attachTimes and lostBackEnds from the MRNet event thread */
+      pthread_cond_t        attachCond;  /* Signaled by BE_Join_Callback every time a back-end attaches */
+      struct timeval        attachEpoch; /* When the connections file was published */
+      vector<BackendAttach> attachTimes;
+
+      unsigned int                 nextRequestID;
+      deque<PendingDispatch>       outstandingRequests; /* In the same order they were dispatched */
+      map<int, CompletedDispatch>  completedRequests;
+
+      map<StreamPoolKey, STREAM *> streamPool; /* Streams shared by the protocols, by filter configuration */
+
+      map<string, int>             filterCache; /* ID of the filters already loaded, by name */
+      vector<string>               filterPaths; /* Directories in SYNAPSE_FILTER_PATH */
 
-      int CommonInit();
-      int WaitForBackends(unsigned int numBackends); //DEAD_CODE , const char *ConnectionsFile);
+      int  CommonInit();
+      int  WaitForBackends(unsigned int numBackends); //DEAD_CODE , const char *ConnectionsFile);
+      void ReportAttachTimes(void);
+      int  SetupStreams(Protocol *prot);
+      int  CompleteNextRequest(void);
+      int  CollectACK(unsigned int reqID, unsigned int &countErr, vector<unsigned int> *protErrors=NULL);
+      void ResolveFilterPaths(void);
+      int  LoadFilterObject(string filter_name, string filter_so);
 };
 
 } /* namespace Synapse */
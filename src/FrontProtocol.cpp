@@ -21,24 +21,53 @@
 \*****************************************************************************/
 
 #include <iostream>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
 #include "FrontProtocol.h"
 #include "FrontEnd.h"
 
 using std::cerr;
 using std::endl;
+using std::vector;
 using namespace Synapse;
 
 
 /**
- * Calls the user-defined FE intialization routine for this protocol and 
- * then publishes all the streams that are registered by the user.
+ * Binds the protocol to the front-end. The streams are created later in SetupStreams().
  * @param fe The FrontEnd object
  */
 void FrontProtocol::Init(MRNetApp *FE)
 {
    mrnApp = FE;
+   streamsFailed = false;
+   memset(&barrierStats, 0, sizeof(barrierStats));
+}
+
+
+/**
+ * Calls the user-defined FE intialization routine for this protocol and 
+ * then publishes all the streams that are registered by the user. If any 
+ * stream can not be created, no streams are announced, so that the back-ends 
+ * fail their set up too instead of waiting for the announcement.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontProtocol::SetupStreams(void)
+{
+   streamsFailed = false;
    Setup(); /* User-defined in the specific protocol object implementation */
-   AnnounceStreams();
+
+   if (streamsFailed)
+   {
+      cerr << "[FE] ERROR: FrontProtocol::SetupStreams: Protocol '" << ID() << "' could not register all its streams" << endl;
+      while (! registeredStreams.empty()) registeredStreams.pop();
+      AnnounceStreams();
+      return -1;
+   }
+   /* Not ready until every back-end confirms its set up, otherwise it is set up again on the next dispatch */
+   int rc = AnnounceStreams();
+   streamsReady = (rc == 0);
+   return rc;
 }
 
 
@@ -53,6 +82,7 @@ STREAM * FrontProtocol::Register_Stream(int up_transfilter_id = TFILTER_NULL, in
    Communicator *comm_BC = mrnApp->net->get_BroadcastCommunicator();
    STREAM *new_stream = mrnApp->net->new_Stream(comm_BC, up_transfilter_id, up_syncfilter_id);
    registeredStreams.push(new_stream);
+   if (metricsEnabled) LabelStreamMetrics(new_stream, ID());
    return new_stream;
 }
 
@@ -62,18 +92,101 @@ STREAM * FrontProtocol::Register_Stream(int up_transfilter_id = TFILTER_NULL, in
  * The filter identified by filter_name is loaded into the network and linked to the new stream.
  * @param filter_name Transformation filter to apply to data flowing upstream 
  * @param up_syncfilter_id Synchronization filter to apply to upstream packets (default is SFILTER_WAITFORALL)
- * @return the new stream.
+ * @return the new stream; NULL if the filter can not be loaded, and SetupStreams fails.
  */
 STREAM * FrontProtocol::Register_Stream(string filter_name, int up_syncfilter_id = SFILTER_WAITFORALL)
 {
    Communicator *comm_BC = mrnApp->net->get_BroadcastCommunicator();
    int filter_id = ((FrontEnd *)mrnApp)->LoadFilter( filter_name ) ;
+   if (filter_id == -1)
+   {
+      cerr << "[FE] ERROR: FrontProtocol::Register_Stream: Protocol '" << ID() << "' can not load filter '" << filter_name << "'" << endl;
+      streamsFailed = true;
+      return NULL;
+   }
    STREAM *new_stream = mrnApp->net->new_Stream(comm_BC, filter_id, up_syncfilter_id);
    registeredStreams.push(new_stream);
+   if (metricsEnabled) LabelStreamMetrics(new_stream, ID());
+   return new_stream;
+}
+
+
+/**
+ * Same as Register_Stream, but the payloads sent through the stream with SendPayload are 
+ * compressed when they are larger than the protocol's compression threshold (see 
+ * SetCompressionThreshold). The back-ends have to retrieve it with Register_CompressedStream.
+ * @param up_transfilter_id Transformation filter to apply to data flowing upstream
+ * @param up_syncfilter_id Synchronization filter to apply to upstream packets
+ * @return the new stream.
+ */
+STREAM * FrontProtocol::Register_CompressedStream(int up_transfilter_id, int up_syncfilter_id)
+{
+   STREAM *new_stream = Register_Stream(up_transfilter_id, up_syncfilter_id);
+   SetCompression(new_stream, compressionThreshold);
    return new_stream;
 }
 
 
+/**
+ * Same as Register_Stream, but the payloads are compressed (see above). A filter that looks 
+ * into the payloads has to handle them with DecompressPayload and CompressPayload (Compression.h).
+ * @param filter_name Transformation filter to apply to data flowing upstream 
+ * @param up_syncfilter_id Synchronization filter to apply to upstream packets
+ * @return the new stream.
+ */
+STREAM * FrontProtocol::Register_CompressedStream(string filter_name, int up_syncfilter_id)
+{
+   STREAM *new_stream = Register_Stream(filter_name, up_syncfilter_id);
+   if (new_stream != NULL) SetCompression(new_stream, compressionThreshold);
+   return new_stream;
+}
+
+
+/**
+ * Same as Register_Stream, but the stream is taken from a pool shared with the other protocols
+ * that register streams with the same filters. Use it only for protocols that are never 
+ * dispatched concurrently, because their messages would mix in the shared stream.
+ * @param up_transfilter_id Transformation filter to apply to data flowing upstream
+ * @param up_syncfilter_id Synchronization filter to apply to upstream packets
+ * @return the shared stream; NULL on errors, and SetupStreams fails.
+ */
+STREAM * FrontProtocol::Register_SharedStream(int up_transfilter_id, int up_syncfilter_id)
+{
+   STREAM *shared_stream = ((FrontEnd *)mrnApp)->GetPooledStream(up_transfilter_id, up_syncfilter_id);
+   if (shared_stream == NULL)
+   {
+      cerr << "[FE] ERROR: FrontProtocol::Register_SharedStream: Protocol '" << ID() << "' can not get a shared stream" << endl;
+      streamsFailed = true;
+      return NULL;
+   }
+   registeredStreams.push(shared_stream);
+   if (metricsEnabled) LabelStreamMetrics(shared_stream, ID());
+   return shared_stream;
+}
+
+
+/**
+ * Same as Register_Stream, but the stream is taken from a pool shared with the other protocols
+ * that register streams with the same filters (see above).
+ * @param filter_name Transformation filter to apply to data flowing upstream 
+ * @param up_syncfilter_id Synchronization filter to apply to upstream packets
+ * @return the shared stream; NULL if the filter can not be loaded, and SetupStreams fails.
+ */
+STREAM * FrontProtocol::Register_SharedStream(string filter_name, int up_syncfilter_id)
+{
+   STREAM *shared_stream = ((FrontEnd *)mrnApp)->GetPooledStream(filter_name, up_syncfilter_id);
+   if (shared_stream == NULL)
+   {
+      cerr << "[FE] ERROR: FrontProtocol::Register_SharedStream: Protocol '" << ID() << "' can not get a shared stream" << endl;
+      streamsFailed = true;
+      return NULL;
+   }
+   registeredStreams.push(shared_stream);
+   if (metricsEnabled) LabelStreamMetrics(shared_stream, ID());
+   return shared_stream;
+}
+
+
 /**
  * Automatically publishes all the streams that are queued in 'registeredStreams' to the back-ends.
  * return 0 on success; -1 otherwise.
@@ -82,6 +195,7 @@ int FrontProtocol::AnnounceStreams()
 {
    int tag, NumberOfStreams=0;
    PacketPtr p;
+   TraceScope trace(TRACE_PHASE, TRACE_ANNOUNCE);
 
    /* Announce streams to the back-ends */
    unsigned int countACKs = 0;
@@ -89,9 +203,21 @@ int FrontProtocol::AnnounceStreams()
    /* DEBUG 
    std::cout << "[FE] FrontProtocol::AnnounceStreams: Sending " << registeredStreams.size() << " streams" << std::endl; */
 
-   /* Send the number of streams */
    NumberOfStreams = registeredStreams.size();
-   MRN_STREAM_SEND(mrnApp->stControl, TAG_STREAM, "%d", registeredStreams.size());
+
+#if defined(ANNOUNCE_STREAMS_SINGLE_PACKET)
+   /* Send the protocol numeric ID and name (checked by the back-ends) and the ID's of all the streams at once */
+   vector<uint32_t> streamIDs;
+   while (! registeredStreams.empty())
+   {
+      streamIDs.push_back( registeredStreams.front()->get_Id() );
+      registeredStreams.pop();
+   }
+   MRN_STREAM_SEND(mrnApp->stControl, TAG_STREAM, "%ud %s %aud", Index(), ID().c_str(), 
+                   (NumberOfStreams > 0 ? &streamIDs[0] : NULL), NumberOfStreams);
+#else
+   /* Send the protocol numeric ID and name (checked by the back-ends) and the number of streams */
+   MRN_STREAM_SEND(mrnApp->stControl, TAG_STREAM, "%ud %s %ud", Index(), ID().c_str(), NumberOfStreams);
 
    for (int i=0; i<NumberOfStreams; i++)
    {
@@ -103,12 +229,13 @@ int FrontProtocol::AnnounceStreams()
       /* Remove the stream from the queue */
       registeredStreams.pop();
    }
+#endif
    /* Read ACKs */
 #if defined(CONTROL_STREAM_BLOCKING)
    MRN_STREAM_RECV(mrnApp->stControl, &tag, p, TAG_ACK);
    p->unpack("%d", &countACKs);
 #else
-   for (int i=0; i<mrnApp->stControl->size(); i++)
+   for (unsigned int i=0; i<mrnApp->ExpectedACKs(); i++)
    {
      int x = 0;
      MRN_STREAM_RECV(mrnApp->stControl, &tag, p, TAG_ACK);
@@ -117,27 +244,58 @@ int FrontProtocol::AnnounceStreams()
    }
 #endif
 
-   if (countACKs != mrnApp->stControl->size())
+   /* A back-end that does not match the protocol also sends 0, so this does not tolerate missing back-ends */
+   if (countACKs != mrnApp->ExpectedACKs())
    {
-      cerr << "[FE] Error announcing streams! (" << countACKs << " ACKs received, expected " << mrnApp->stControl->size() << ")" << endl;
+      cerr << "[FE] Error announcing streams! (" << countACKs << " ACKs received, expected " << mrnApp->ExpectedACKs() << ")" << endl;
       return -1;
    }
    return 0;
 }
 
+/**
+ * Blocks the front-end until all the back-ends enter the barrier, and releases them.
+ * @return 0 on success; -1 otherwise.
+ */
 int FrontProtocol::Barrier()
+{
+   BarrierBegin();
+   return BarrierEnd();
+}
+
+
+/**
+ * First half of a split-phase barrier. The front-end does not take part in the propagation
+ * towards the root, so this only marks when the front-end arrived, and the work done until 
+ * BarrierEnd() overlaps with the back-ends reaching the barrier.
+ * @return 0.
+ */
+int FrontProtocol::BarrierBegin()
+{
+   gettimeofday(&barrierStart, NULL);
+   if (! quietBarrier) cerr << "[FE] Entering barrier..." << endl;
+   return 0;
+}
+
+
+/**
+ * Second half of a split-phase barrier. Waits for the ACKs of all the back-ends and releases them.
+ * If the protocol enabled the timed barrier, it also collects how long the back-ends waited (see GetBarrierStats).
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontProtocol::BarrierEnd()
 {
    int tag;
    PacketPtr p;
    unsigned int countACKs = 0;
+   TraceScope trace(TRACE_BARRIER, Index() + 1);
 
 #if defined(CONTROL_STREAM_BLOCKING)
-   cerr << "[FE] Entering barrier..." << endl;
    MRN_STREAM_RECV(mrnApp->stControl, &tag, p, TAG_ACK);
    p->unpack("%d", &countACKs);
-   cerr << "[FE] Barrier received " << countACKs << " ACK's..." << endl;
+   if (! quietBarrier) cerr << "[FE] Barrier received " << countACKs << " ACK's..." << endl;
 #else
-   for (int i=0; i<mrnApp->stControl->size(); i++)
+   for (unsigned int i=0; i<mrnApp->ExpectedACKs(); i++)
    {
      int x = 0;
      MRN_STREAM_RECV(mrnApp->stControl, &tag, p, TAG_ACK);
@@ -146,15 +304,264 @@ int FrontProtocol::Barrier()
    }
 #endif
 
-   cerr << "[FE] Barrier broadcasting " << countACKs << " ACK's..." << endl;
-   MRN_STREAM_SEND(mrnApp->stControl, TAG_ACK, "%d", countACKs);
+   /* Tell the back-ends whether everyone made it, since they can't know how many survive in degraded mode */
+   int rc = mrnApp->CheckACKs(countACKs, "FrontProtocol::Barrier");
+
+   if (! quietBarrier) cerr << "[FE] Barrier broadcasting " << countACKs << " ACK's..." << endl;
+   MRN_STREAM_SEND(mrnApp->stControl, TAG_ACK, "%d %d", countACKs, rc);
+   RecordPhase(PHASE_BARRIER, &barrierStart);
 
-   if (countACKs != mrnApp->stControl->size())
+   /* The back-ends report how long they waited once released, so this does not delay them */
+   if ((rc == 0) && (stBarrierMin != NULL))
+   {
+      double min_wait = 0, max_wait = 0, sum_wait = 0;
+      struct timeval now;
+
+      MRN_STREAM_RECV(stBarrierMin, &tag, p, TAG_BARRIER_STATS);
+      p->unpack("%lf", &min_wait);
+      MRN_STREAM_RECV(stBarrierMax, &tag, p, TAG_BARRIER_STATS);
+      p->unpack("%lf", &max_wait);
+      MRN_STREAM_RECV(stBarrierSum, &tag, p, TAG_BARRIER_STATS);
+      p->unpack("%lf", &sum_wait);
+
+      gettimeofday(&now, NULL);
+      barrierStats.count   = countACKs;
+      barrierStats.minWait = min_wait;
+      barrierStats.maxWait = max_wait;
+      barrierStats.avgWait = (countACKs > 0 ? sum_wait / countACKs : 0);
+      barrierStats.skew    = max_wait - min_wait;
+      barrierStats.elapsed = (now.tv_sec - barrierStart.tv_sec) + (now.tv_usec - barrierStart.tv_usec) / 1000000.0;
+
+      if (! quietBarrier)
+      {
+         cerr << "[FE] Barrier wait of the back-ends: min=" << min_wait << "s max=" << max_wait << "s avg=" << barrierStats.avgWait << "s" << endl;
+      }
+   }
+
+   if (rc != 0)
    {
-      cerr << "[FE] ERROR: FrontProtocol::Barrier: " << countACKs << " ACKs received, expected " << mrnApp->stControl->size() << endl;
       return -1;
    }
-   cerr << "[FE] Exiting barrier" << endl;
+   if (! quietBarrier) cerr << "[FE] Exiting barrier" << endl;
+   return 0;
+}
+
+
+/**
+ * Makes every barrier of this protocol report how long the back-ends waited in it, reduced in the tree 
+ * (min, max and sum). Call it from Setup(), and BackProtocol::EnableTimedBarrier() from the back-end Setup() 
+ * at the same position with respect to the other registered streams.
+ */
+void FrontProtocol::EnableTimedBarrier()
+{
+   stBarrierMin = Register_SharedStream(TFILTER_MIN, SFILTER_WAITFORALL);
+   stBarrierMax = Register_SharedStream(TFILTER_MAX, SFILTER_WAITFORALL);
+   stBarrierSum = Register_SharedStream(TFILTER_SUM, SFILTER_WAITFORALL);
+}
+
+
+/**
+ * Returns how long the back-ends waited in the last barrier, if the timed barrier is enabled.
+ * @return the statistics of the last barrier.
+ */
+const BarrierStats & FrontProtocol::GetBarrierStats()
+{
+   return barrierStats;
+}
+
+
+/* Progress of the chunked transfer of a back-end in ReceiveLarge */
+typedef struct
+{
+   unsigned int net_rank;
+   uint32_t     chunk_len;
+   unsigned int num_chunks;
+   unsigned int consumed;
+   unsigned int granted;
+   bool         failed; /* The chunks are drained but not stored */
+} Transfer;
+
+
+/**
+ * Returns the credits that every back-end still in the network has given in a chunked transfer, 
+ * which is 0 until all of them have answered. The back-ends lost in degraded mode are not waited 
+ * for, and without back-ends left all the chunks can be sent.
+ */
+static unsigned int MinGranted(FrontEnd *FE, map<unsigned int, unsigned int> &granted, unsigned int num_chunks)
+{
+   unsigned int expected    = FE->ExpectedACKs();
+   unsigned int answered    = 0;
+   unsigned int min_granted = num_chunks;
+
+   for (map<unsigned int, unsigned int>::iterator it = granted.begin(); it != granted.end(); ++it)
+   {
+      if (FE->IsBackendLost(it->first)) continue;
+      answered ++;
+      if (it->second < min_granted) min_granted = it->second;
+   }
+   return (answered < expected ? 0 : min_granted);
+}
+
+
+/**
+ * Returns how many back-ends still in the network have sent all their chunks to ReceiveLarge.
+ */
+static unsigned int CountCompleted(FrontEnd *FE, map<unsigned int, Transfer> &transfers)
+{
+   unsigned int completed = 0;
+
+   for (map<unsigned int, Transfer>::iterator it = transfers.begin(); it != transfers.end(); ++it)
+   {
+      Transfer &transfer = it->second;
+      if ((transfer.consumed == transfer.num_chunks) && (! FE->IsBackendLost(transfer.net_rank))) completed ++;
+   }
+   return completed;
+}
+
+
+/**
+ * Checks whether a chunked transfer would wait for lost back-ends, which happens out of degraded 
+ * mode, where the lost back-ends are still expected to answer.
+ */
+static bool LostAndExpected(FrontEnd *FE, const char *where)
+{
+   if ((! FE->IsDegraded()) && (FE->CountLostBackEnds() > 0))
+   {
+      cerr << "[FE] ERROR: FrontProtocol::" << where << ": Back-ends lost during the transfer" << endl;
+      return true;
+   }
+   return false;
+}
+
+
+/**
+ * Broadcasts a large buffer to all the back-ends, split in chunks of SetChunking() size that are 
+ * pipelined through the tree. At most a window of chunks is in flight towards the slowest back-end, 
+ * so the memory taken in every process of the tree is bounded by the window and not by the buffer. 
+ * The back-ends receive it with BackProtocol::ReceiveLarge. The stream has to be registered with 
+ * TFILTER_NULL and SFILTER_DONTWAIT, and can not be used for anything else during the transfer.
+ * In degraded mode, the back-ends lost during the transfer are no longer waited for.
+ * @param stream The stream.
+ * @param buffer The data to send.
+ * @param size   Size of the data.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontProtocol::StreamLarge(STREAM *stream, const void *buffer, size_t size)
+{
+   int tag;
+   PacketPtr p;
+   FrontEnd *FE = (FrontEnd *)mrnApp;
+   unsigned int num_chunks = ChunkCount(size, chunkSize);
+   map<unsigned int, unsigned int> granted; /* Credits given by every back-end, besides the initial window */
+
+   for (unsigned int seq=0; seq<num_chunks; seq++)
+   {
+      /* Wait until the slowest back-end has room for another chunk */
+      while (seq >= chunkWindow + MinGranted(FE, granted, num_chunks))
+      {
+         unsigned int rank = 0, credits = 0;
+         int received = 0;
+
+         /* Wait a while at a time to notice the back-ends that are lost */
+         MRN_STREAM_RECV_TIMEOUT(stream, &tag, p, TAG_CHUNK_CREDIT, CHUNK_POLL, received);
+         if (received == 0)
+         {
+            if (LostAndExpected(FE, "StreamLarge")) return -1;
+            continue;
+         }
+         if (p->unpack("%ud %ud", &rank, &credits) == -1) return -1;
+         granted[rank] = (credits == CHUNK_CREDITS_ALL ? num_chunks : granted[rank] + credits);
+      }
+
+      size_t   offset = (size_t)seq * chunkSize;
+      uint32_t length = (size - offset < chunkSize ? size - offset : chunkSize);
+      MRN_STREAM_SEND(stream, TAG_CHUNK, "%ud %ud %ud %ud %uld %auc", 0, 0, seq, chunkWindow, (uint64_t)size, 
+                      (unsigned char *)buffer + offset, length);
+   }
    return 0;
 }
 
+
+/**
+ * Receives the large buffers that every back-end sends with BackProtocol::StreamLarge. The chunks 
+ * of all the back-ends are received as they arrive, and every back-end is given credits to send 
+ * more chunks point-to-point, so a slow back-end does not hold the others back. The stream has to 
+ * be registered with TFILTER_NULL and SFILTER_DONTWAIT. When the chunks of a back-end come out of 
+ * order, its buffer is dropped but the rest of its chunks are still drained, so that neither side 
+ * is left waiting.
+ * @param stream  The stream.
+ * @param buffers Set to the data sent by every back-end, by rank.
+ * @return 0 on success; -1 otherwise.
+ */
+int FrontProtocol::ReceiveLarge(STREAM *stream, map< unsigned int, vector<unsigned char> > &buffers)
+{
+   int tag, rc = 0;
+   PacketPtr p;
+   FrontEnd *FE = (FrontEnd *)mrnApp;
+   map<unsigned int, Transfer> transfers;
+
+   while (CountCompleted(FE, transfers) < FE->ExpectedACKs())
+   {
+      unsigned int   rank = 0, net_rank = 0, seq = 0, window = 0;
+      uint64_t       total = 0;
+      unsigned char *data = NULL;
+      uint32_t       length = 0;
+      int            received = 0;
+
+      /* Wait a while at a time to notice the back-ends that are lost */
+      MRN_STREAM_RECV_TIMEOUT(stream, &tag, p, TAG_CHUNK, CHUNK_POLL, received);
+      if (received == 0)
+      {
+         if (LostAndExpected(FE, "ReceiveLarge")) return -1;
+         continue;
+      }
+      if (p->unpack("%ud %ud %ud %ud %uld %auc", &rank, &net_rank, &seq, &window, &total, &data, &length) == -1) return -1;
+
+      vector<unsigned char> &buffer   = buffers[rank];
+      Transfer              &transfer = transfers[rank];
+      transfer.net_rank = net_rank;
+      if ((seq == 0) && (transfer.consumed == 0))
+      {
+         buffer.resize(total);
+         transfer.chunk_len  = length;
+         transfer.num_chunks = ChunkCount(total, length);
+      }
+
+      /* The chunks of a back-end arrive in order */
+      if ((! transfer.failed) && ((seq != transfer.consumed) || ((uint64_t)seq * transfer.chunk_len + length > buffer.size())))
+      {
+         cerr << "[FE] ERROR: FrontProtocol::ReceiveLarge: Unexpected chunk #" << seq << " from back-end " << rank << endl;
+         rc = -1;
+         transfer.failed = true;
+         /* Without the first chunk the length of the transfer is unknown, stop at this one */
+         if (transfer.num_chunks == 0) transfer.num_chunks = transfer.consumed + 1;
+         if (window + transfer.granted < transfer.num_chunks)
+         {
+            vector<Rank> destination(1, net_rank);
+            transfer.granted = transfer.num_chunks;
+            MRN_STREAM_SEND_P2P(stream, destination, TAG_CHUNK_CREDIT, "%ud %ud", 0, CHUNK_CREDITS_ALL);
+         }
+      }
+      else if (! transfer.failed)
+      {
+         if (length > 0) memcpy(&buffer[(size_t)seq * transfer.chunk_len], data, length);
+
+         unsigned int credits = CreditsToGrant(transfer.consumed + 1, transfer.granted, window, transfer.num_chunks);
+         if (credits > 0)
+         {
+            vector<Rank> destination(1, net_rank);
+            transfer.granted += credits;
+            MRN_STREAM_SEND_P2P(stream, destination, TAG_CHUNK_CREDIT, "%ud %ud", 0, credits);
+         }
+      }
+      free(data);
+      transfer.consumed ++;
+   }
+
+   for (map<unsigned int, Transfer>::iterator it = transfers.begin(); it != transfers.end(); ++it)
+   {
+      if (it->second.failed) buffers.erase(it->first);
+   }
+   return rc;
+}
+
@@ -23,20 +23,54 @@
 #ifndef __FE_PROTOCOL_H__
 #define __FE_PROTOCOL_H__
 
+#include <map>
+#include <vector>
+#include <sys/time.h>
 #include "Protocol.h"
 
+using std::map;
+using std::vector;
+
 namespace Synapse {
 
+/* Time the back-ends waited in the last timed barrier (see EnableTimedBarrier). The back-end that 
+   arrives last waits the least, so the spread between them measures the arrival skew */
+typedef struct
+{
+   unsigned int count;   /* Back-ends that reported                        */
+   double       minWait; /* Seconds waited by the last back-end to arrive  */
+   double       maxWait; /* Seconds waited by the first back-end to arrive */
+   double       avgWait;
+   double       skew;    /* maxWait - minWait                              */
+   double       elapsed; /* Seconds the front-end spent in the barrier     */
+} BarrierStats;
+
 class FrontProtocol : public Protocol
 {
    public:
       void Init(MRNetApp *FE);
+      int  SetupStreams(void);
       STREAM * Register_Stream(int up_transfilter_id, int up_syncfilter_id);
       STREAM * Register_Stream(string filter_name,    int up_syncfilter_id);
+      STREAM * Register_CompressedStream(int up_transfilter_id=TFILTER_NULL, int up_syncfilter_id=SFILTER_WAITFORALL);
+      STREAM * Register_CompressedStream(string filter_name,                 int up_syncfilter_id=SFILTER_WAITFORALL);
+      STREAM * Register_SharedStream(int up_transfilter_id, int up_syncfilter_id);
+      STREAM * Register_SharedStream(string filter_name,    int up_syncfilter_id);
       int Barrier();
+      int BarrierBegin();
+      int BarrierEnd();
+      void EnableTimedBarrier();
+      const BarrierStats & GetBarrierStats();
+      int StreamLarge (STREAM *stream, const void *buffer, size_t size);
+      int ReceiveLarge(STREAM *stream, map< unsigned int, vector<unsigned char> > &buffers);
 
    protected:
       int AnnounceStreams();
+
+   private:
+      struct timeval barrierStart;
+      BarrierStats   barrierStats;
+      bool           streamsFailed; /* Set when a stream can not be registered during Setup() */
 };
 
 } /* namespace Synapse */
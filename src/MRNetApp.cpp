@@ -21,13 +21,16 @@
 \*****************************************************************************/
 
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
+#include <stdlib.h>
 #include "MRNetApp.h"
 #include "Protocol.h"
 
 using std::cerr;
 using std::endl;
+using std::stringstream;
 using namespace Synapse;
 
 /**
@@ -38,6 +41,19 @@ MRNetApp::MRNetApp()
    net       = NULL;
    stControl = NULL;
    Remote_Instantiation = false;
+   topologyStale        = 1;
+   topology.numBackEnds = 0;
+   pthread_mutex_init(&topologyLock, NULL);
+
+   /* Counting starts right away so that the back-ends attaching during the initialization are accounted */
+   if (getenv("SYNAPSE_METRICS_FILE") != NULL)
+   {
+      EnableMetrics();
+   }
+   if (getenv("SYNAPSE_TRACE") != NULL)
+   {
+      EnableTrace();
+   }
 }
 
 
@@ -87,23 +103,165 @@ unsigned int MRNetApp::WhoAmI(bool return_network_id)
 
 
 /**
- * Checks the Network Topology for the number of back-ends.
+ * Returns the number of back-ends from the topology snapshot.
  * @return number of back-ends in the MRNet.
  */
 unsigned int MRNetApp::NumBackEnds(void)
 {
-   unsigned int num_be;
-   NETWORK_get_NumBackEnds(net, num_be);
-   return num_be;
+   unsigned int numBackEnds;
+
+   CheckTopology();
+   pthread_mutex_lock(&topologyLock);
+   numBackEnds = topology.numBackEnds;
+   pthread_mutex_unlock(&topologyLock);
+   return numBackEnds;
+}
+
+
+/**
+ * Returns a copy of the topology snapshot, rebuilding it first if the topology changed since it was taken.
+ * @return the topology snapshot.
+ */
+TopologySnapshot MRNetApp::GetTopology(void)
+{
+   TopologySnapshot snapshot;
+
+   CheckTopology();
+   pthread_mutex_lock(&topologyLock);
+   snapshot = topology;
+   pthread_mutex_unlock(&topologyLock);
+   return snapshot;
+}
+
+
+/**
+ * Marks the topology snapshot as outdated, so it is rebuilt on the next query.
+ * Called from the MRNet topology event callbacks.
+ */
+void MRNetApp::TopologyChanged(void)
+{
+   __sync_fetch_and_or(&topologyStale, 1);
+}
+
+
+/**
+ * Rebuilds the topology snapshot if it is outdated. Only the thread that clears the flag rebuilds it.
+ */
+void MRNetApp::CheckTopology(void)
+{
+   if ((topologyStale) && (__sync_bool_compare_and_swap(&topologyStale, 1, 0)))
+   {
+      RefreshTopology();
+   }
+}
+
+
+/**
+ * Rebuilds the topology snapshot querying the network. The new snapshot is built aside
+ * and swapped in under the lock, so the network is not queried with the lock held.
+ */
+void MRNetApp::RefreshTopology(void)
+{
+   TopologySnapshot fresh;
+
+   if (net == NULL) 
+   {
+      /* Retry on the next query */
+      TopologyChanged();
+      return;
+   }
+
+   NETWORK_get_TopologySnapshot(net, fresh.beRanks, fresh.beParents, fresh.leaves);
+   fresh.numBackEnds = fresh.beRanks.size();
+
+   pthread_mutex_lock(&topologyLock);
+   topology.beRanks.swap(fresh.beRanks);
+   topology.beParents.swap(fresh.beParents);
+   topology.leaves.swap(fresh.leaves);
+   topology.numBackEnds = fresh.numBackEnds;
+   pthread_mutex_unlock(&topologyLock);
+}
+
+
+/**
+ * Returns how many back-ends contribute to the reductions of the control stream.
+ * @return the number of back-ends in the control stream.
+ */
+unsigned int MRNetApp::ExpectedACKs(void)
+{
+   return stControl->size();
+}
+
+
+/**
+ * Checks the number of ACKs received through the control stream.
+ * @param countACKs Number of ACKs received.
+ * @param what      Name of the operation that is being acknowledged, for the error messages.
+ * @return 0 if all the back-ends answered; -1 otherwise.
+ */
+int MRNetApp::CheckACKs(unsigned int countACKs, string what)
+{
+   if (countACKs != ExpectedACKs())
+   {
+      cerr << "ERROR: " << what << ": " << countACKs << " ACKs received, expected " << ExpectedACKs() << endl;
+      return -1;
+   }
+   return 0;
+}
+
+
+#if !defined(LIGHTWEIGHT)
+/**
+ * MRNet callback that is invoked when back-ends join or processes leave the network.
+ * @param app_ptr The application whose snapshot is invalidated.
+ */
+static void Topology_Change_Callback(Event *, void *app_ptr)
+{
+   ((MRNetApp *)app_ptr)->TopologyChanged();
 }
+#endif
+
 
 /**
- * Keeps a mapping of the loaded protocols, indexed by the protocol ID.
+ * Builds the topology snapshot and registers the callbacks that invalidate it. 
+ * The lightweight back-ends can not register callbacks, so their snapshot is only taken once.
+ * @return 0 on success; -1 otherwise.
+ */
+int MRNetApp::WatchTopology(void)
+{
+#if !defined(LIGHTWEIGHT)
+   bool cbrett;
+
+   cbrett = net->register_EventCallback( Event::TOPOLOGY_EVENT,
+                                         TopologyEvent::TOPOL_ADD_BE,
+                                         Topology_Change_Callback, (void *)this );
+   cbrett = cbrett && net->register_EventCallback( Event::TOPOLOGY_EVENT,
+                                                   TopologyEvent::TOPOL_REMOVE_NODE,
+                                                   Topology_Change_Callback, (void *)this );
+   if (! cbrett)
+   {
+      cerr << "ERROR: MRNetApp::WatchTopology: Failed to register topology callbacks" << endl;
+      return -1;
+   }
+#endif
+   __sync_bool_compare_and_swap(&topologyStale, 1, 0);
+   RefreshTopology();
+   return 0;
+}
+
+/**
+ * Keeps a mapping of the loaded protocols, indexed by the protocol ID. Every protocol is
+ * also assigned a dense numeric ID in load order, which is what travels in the control 
+ * messages. The FE and the BEs load the protocols in the same order, so the numeric IDs
+ * match on both sides (this is checked when the streams are announced).
  * @param prot The protocol that is being loaded.
  * @return 0 on success; -1 otherwise.
  */
 int MRNetApp::LoadProtocol(Protocol *prot)
 {
+   prot->SetIndex( protocolTable.size() );
+   protocolTable.push_back(prot);
+
    if (prot->ID() != "")
    {
       loadedProtocols[prot->ID()] = prot;
@@ -132,3 +290,101 @@ Protocol * MRNetApp::FetchProtocol(string ID)
    }
 }
 
+
+/**
+ * Returns the loaded protocol object identified by its numeric ID.
+ * @param idx Numeric protocol identifier.
+ * @return the protocol object.
+ */
+Protocol * MRNetApp::FetchProtocol(unsigned int idx)
+{
+   return (idx < protocolTable.size() ? protocolTable[idx] : NULL);
+}
+
+
+/**
+ * Returns the name of this process in the metrics dumps and the traces.
+ * @return "fe" for the front-end, "be<rank>" for the back-ends.
+ */
+string MRNetApp::ProcessName(void)
+{
+   stringstream ss;
+   if (isFE()) ss << "fe";
+   else        ss << "be" << WhoAmI();
+   return ss.str();
+}
+
+
+/**
+ * Starts dumping the metrics to the file in SYNAPSE_METRICS_FILE every SYNAPSE_METRICS_PERIOD 
+ * seconds, until Shutdown. "%r" in the path is replaced by the process name ("fe", "be<rank>"); 
+ * otherwise, the back-ends append it to the path, so that every process writes its own file. 
+ * The format is SYNAPSE_METRICS_FORMAT ("json" or "prometheus"), or Prometheus if the file 
+ * ends in ".prom". Called at the end of the initialization.
+ * @return 0 on success or if the metrics are disabled; -1 otherwise.
+ */
+int MRNetApp::StartMetrics(void)
+{
+   char *env_SYNAPSE_METRICS_FILE = getenv("SYNAPSE_METRICS_FILE");
+   if ((env_SYNAPSE_METRICS_FILE == NULL) || (! metricsEnabled))
+   {
+      return 0;
+   }
+   LabelStreamMetrics(stControl, "control");
+
+   string process = ProcessName();
+   string file    = env_SYNAPSE_METRICS_FILE;
+   size_t pos     = file.find("%r");
+   if (pos != string::npos) file.replace(pos, 2, process);
+   else if (isBE())         file += "." + process;
+
+   MetricsFormat format = METRICS_JSON;
+   char *env_SYNAPSE_METRICS_FORMAT = getenv("SYNAPSE_METRICS_FORMAT");
+   if (env_SYNAPSE_METRICS_FORMAT != NULL)
+   {
+      if (string(env_SYNAPSE_METRICS_FORMAT) == "prometheus") format = METRICS_PROMETHEUS;
+   }
+   else if ((file.size() > 5) && (file.compare(file.size() - 5, 5, ".prom") == 0))
+   {
+      format = METRICS_PROMETHEUS;
+   }
+
+   unsigned int period = METRICS_DUMP_PERIOD;
+   char *env_SYNAPSE_METRICS_PERIOD = getenv("SYNAPSE_METRICS_PERIOD");
+   if ((env_SYNAPSE_METRICS_PERIOD != NULL) && (atoi(env_SYNAPSE_METRICS_PERIOD) >= 0))
+   {
+      period = atoi(env_SYNAPSE_METRICS_PERIOD);
+   }
+   return StartMetricsDump(file, format, period, process);
+}
+
+
+/**
+ * Writes the metrics of this process to a file on demand (see Metrics.h). They are collected 
+ * only when enabled with SYNAPSE_METRICS_FILE or Synapse::EnableMetrics().
+ * @param file   Path of the file.
+ * @param format METRICS_JSON or METRICS_PROMETHEUS.
+ * @return 0 on success; -1 otherwise.
+ */
+int MRNetApp::DumpMetrics(string file, MetricsFormat format)
+{
+   return Synapse::DumpMetrics(file, format, ProcessName());
+}
+
+
+/**
+ * Writes the events traced by this process to SYNAPSE_TRACE.<process>.prv/.pcf/.json (see Trace.h).
+ * The front-end is task 1 of the timeline, and back-end rank N is task N+2. Called at Shutdown.
+ * @return 0 on success or if the tracing is disabled; -1 otherwise.
+ */
+int MRNetApp::WriteTrace(void)
+{
+   char *env_SYNAPSE_TRACE = getenv("SYNAPSE_TRACE");
+   if ((env_SYNAPSE_TRACE == NULL) || (! traceEnabled))
+   {
+      return 0;
+   }
+   string process = ProcessName();
+   return FlushTrace(string(env_SYNAPSE_TRACE) + "." + process, process, (isFE() ? 1 : WhoAmI() + 2));
+}
+
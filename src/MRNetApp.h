@@ -25,21 +25,49 @@
 
 #include <map>
 #include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
 #include "MRNet_wrappers.h"
 
 #define MRNET_RANK(r) (r+1000000)
 #define MPI_RANK(r)   (r-1000000)
 
+/* The control stream reduces the ACKs with TFILTER_SUM, which only adds up the first element of the packets.
+ * To match every ACK with its dispatch request, the back-ends pack the request ID (24 bits), a contribution 
+ * counter (20 bits) and their errors (20 bits) in a single 64-bit word ("%uld") that adds up field by field. */
+#define ACK_WORD(req, err)   ((((uint64_t)(req) & 0xFFFFFF) << 40) | ((uint64_t)1 << 20) | ((uint64_t)(err) & 0xFFFFF))
+#define ACK_GET_REQ(w)       ((unsigned int)(((w) >> 40) & 0xFFFFFF))
+#define ACK_GET_COUNT(w)     ((unsigned int)(((w) >> 20) & 0xFFFFF))
+#define ACK_GET_ERRORS(w)    ((unsigned int)((w) & 0xFFFFF))
+#define ACK_MATCHES(w, req)  (ACK_GET_REQ(w) == (((req) * ACK_GET_COUNT(w)) & 0xFFFFFF))
+
 /* Undef this to make the control stream non-blocking (not scalable, for debugging purposes!) */
 #define CONTROL_STREAM_BLOCKING 
 
+/* Undef this to announce the protocol streams sending one message through every new stream, 
+   instead of sending all the stream ID's in a single message through the control stream */
+#define ANNOUNCE_STREAMS_SINGLE_PACKET
+
 using std::map;
 using std::string;
+using std::vector;
 
 namespace Synapse {
 
 class Protocol;
 
+/* Snapshot of the network topology. It is built once at initialization and rebuilt only 
+   after MRNet notifies a topology change, so that queries do not walk the topology. 
+   GetTopology returns a copy, so readers never see it while it is being rebuilt */
+typedef struct
+{
+   unsigned int         numBackEnds;
+   vector<unsigned int> beRanks;   /* MRNet ranks of the back-ends                        */
+   vector<unsigned int> beParents; /* Parent rank of every back-end (same order than beRanks) */
+   vector<unsigned int> leaves;    /* Ranks of the internal processes at the leaves of the tree */
+} TopologySnapshot;
+
 class MRNetApp 
 {
    public:
@@ -53,18 +81,37 @@ class MRNetApp
       STREAM  * GetControlStream (void);
       int       LoadProtocol     (Protocol *prot);
       Protocol* FetchProtocol    (string prot_id);
+      Protocol* FetchProtocol    (unsigned int prot_idx);
       unsigned int NumBackEnds   (void);
+      TopologySnapshot GetTopology(void);
+      void      TopologyChanged  (void);
       unsigned int WhoAmI        (bool return_network_id=false);
+      virtual unsigned int ExpectedACKs(void);
+      virtual int  CheckACKs     (unsigned int countACKs, string what);
       virtual bool isFE (void) { return false; };
       virtual bool isBE (void) { return false; };
+      int       DumpMetrics      (string file, MetricsFormat format=METRICS_JSON);
 
    protected:
       bool Remote_Instantiation; /* Network instantiation mode; 
                                     true=no back-ends, false=normal */
 
+      int  WatchTopology(void);
+      int  StartMetrics (void);
+      int  WriteTrace   (void);
+      string ProcessName(void);
+
    private:
       map<string, Protocol*> loadedProtocols; /* Mapping of user-defined protocols that are loaded 
                                                  into the FE/BE, indexed by their ID */
+      vector<Protocol*>      protocolTable;   /* Same protocols indexed by their numeric ID, which is 
+                                                 the order they were loaded (same in the FE and BEs) */
+      TopologySnapshot       topology;
+      pthread_mutex_t        topologyLock;    /* Protects the snapshot while it is swapped and copied */
+      volatile int           topologyStale;   /* Set from the MRNet event thread when the topology changes */
+
+      void RefreshTopology(void);
+      void CheckTopology  (void);
 };
 
 } /* namespace Synapse */
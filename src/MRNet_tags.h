@@ -37,7 +37,11 @@ typedef enum
    TAG_EXIT=FirstApplicationTag,
    TAG_STREAM,
    TAG_PROT_ID,
+   TAG_PROT_BATCH,
    TAG_ACK,
+   TAG_BARRIER_STATS,
+   TAG_CHUNK,
+   TAG_CHUNK_CREDIT,
    TAG_ANY
 } Tag;
 
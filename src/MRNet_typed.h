@@ -0,0 +1,396 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#ifndef __MRNET_TYPED_H__
+#define __MRNET_TYPED_H__
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "MRNet_wrappers.h"
+
+namespace Synapse {
+
+/**
+ * Typed alternative to MRN_STREAM_SEND / PACKET_unpack. The MRNet format string is derived from 
+ * the C++ types of the arguments, once per combination of types, so a mismatch between the format 
+ * and the arguments is a compile error instead of a crash:
+ *
+ *    Send(stream, TAG_X, rank, samples);             // int, vector<double> -> "%d %alf"
+ *    Recv(stream, TAG_X, rank, samples);
+ *
+ * Supported types are the MRNet scalars (char, unsigned char, int16_t, uint16_t, int32_t, uint32_t, 
+ * int64_t, uint64_t, float, double), std::string, and std::vector of the scalars, which travel as a 
+ * single MRNet array. Trivially copyable structs declared with MRN_TYPED_AS_BYTES, and vectors of 
+ * them, travel as one contiguous "%auc" array (in the byte order of the sender). Up to 3 fields 
+ * per message; pack more fields in a struct.
+ */
+
+enum { FIELD_SCALAR = 1, FIELD_ARRAY = 2 }; /* Number of varargs slots a field takes in MRNet calls */
+
+/* Only the types with a specialization can be sent; anything else fails to compile */
+template <typename T> struct Field;
+
+#define SYNAPSE_NUMERIC_FIELD(T, fmt, array_fmt)                                            \
+template <> struct Field<T>                                                                 \
+{                                                                                           \
+   enum { kind = FIELD_SCALAR, scale = 1 };                                                 \
+   static const char *Format()      { return fmt; }                                         \
+   static const char *ArrayFormat() { return array_fmt; }                                   \
+   static T Slot0(const T &v)       { return v; }                                           \
+   struct Holder                                                                            \
+   {                                                                                        \
+      T &ref;                                                                               \
+      Holder(T &v) : ref(v) { }                                                             \
+      T  *Slot0()  { return &ref; }                                                         \
+      int Commit() { return 0; }                                                            \
+   };                                                                                       \
+};
+
+SYNAPSE_NUMERIC_FIELD(char,          "%c",   "%ac")
+SYNAPSE_NUMERIC_FIELD(unsigned char, "%uc",  "%auc")
+SYNAPSE_NUMERIC_FIELD(int16_t,       "%hd",  "%ahd")
+SYNAPSE_NUMERIC_FIELD(uint16_t,      "%uhd", "%auhd")
+SYNAPSE_NUMERIC_FIELD(int32_t,       "%d",   "%ad")
+SYNAPSE_NUMERIC_FIELD(uint32_t,      "%ud",  "%aud")
+SYNAPSE_NUMERIC_FIELD(int64_t,       "%ld",  "%ald")
+SYNAPSE_NUMERIC_FIELD(uint64_t,      "%uld", "%auld")
+SYNAPSE_NUMERIC_FIELD(float,         "%f",   "%af")
+SYNAPSE_NUMERIC_FIELD(double,        "%lf",  "%alf")
+
+/* Strings are received into a buffer allocated by MRNet, which is copied and freed */
+template <> struct Field<std::string>
+{
+   enum { kind = FIELD_SCALAR };
+   static const char *Format()                   { return "%s"; }
+   static const char *Slot0(const std::string &v) { return v.c_str(); }
+   struct Holder
+   {
+      std::string &ref;
+      char        *buf;
+      Holder(std::string &v) : ref(v), buf(NULL) { }
+      char **Slot0() { return &buf; }
+      int Commit()
+      {
+         if (buf == NULL) return -1;
+         ref = buf;
+         free(buf);
+         return 0;
+      }
+   };
+};
+
+/* C strings and literals can be sent, and are received into a std::string */
+template <> struct Field<const char *>
+{
+   enum { kind = FIELD_SCALAR };
+   static const char *Format()              { return "%s"; }
+   static const char *Slot0(const char *v)  { return v; }
+};
+template <> struct Field<char *> : public Field<const char *> { };
+template <size_t N> struct Field<char[N]> : public Field<const char *> { };
+
+/* Vectors travel as a single array, received into a buffer allocated by MRNet */
+template <typename T> struct Field< std::vector<T> >
+{
+   enum { kind = FIELD_ARRAY };
+   static const char *Format()                          { return Field<T>::ArrayFormat(); }
+   static const void *Slot0(const std::vector<T> &v)    { return (v.empty() ? NULL : &v[0]); }
+   static uint32_t    Slot1(const std::vector<T> &v)    { return v.size() * Field<T>::scale; }
+   struct Holder
+   {
+      std::vector<T> &ref;
+      void           *buf;
+      uint32_t        count;
+      Holder(std::vector<T> &v) : ref(v), buf(NULL), count(0) { }
+      void    **Slot0() { return &buf; }
+      uint32_t *Slot1() { return &count; }
+      int Commit()
+      {
+         int rc = 0;
+         if ((count % Field<T>::scale) != 0)
+         {
+            rc = -1;
+         }
+         else
+         {
+            ref.resize(count / Field<T>::scale);
+            if (count > 0) memcpy(&ref[0], buf, ref.size() * sizeof(T));
+         }
+         free(buf);
+         return rc;
+      }
+   };
+};
+
+/**
+ * Declares a trivially copyable struct that is sent as its raw bytes, alone or in vectors. 
+ * Use it at global scope, after the definition of the struct.
+ */
+#define MRN_TYPED_AS_BYTES(T)                                                               \
+namespace Synapse {                                                                         \
+template <> struct Field<T>                                                                 \
+{                                                                                           \
+   enum { kind = FIELD_ARRAY, scale = sizeof(T) };                                          \
+   static const char *Format()           { return "%auc"; }                                 \
+   static const char *ArrayFormat()      { return "%auc"; }                                 \
+   static const void *Slot0(const T &v)  { return &v; }                                     \
+   static uint32_t    Slot1(const T &)   { return sizeof(T); }                              \
+   struct Holder                                                                            \
+   {                                                                                        \
+      T        &ref;                                                                        \
+      void     *buf;                                                                        \
+      uint32_t  count;                                                                      \
+      Holder(T &v) : ref(v), buf(NULL), count(0) { }                                        \
+      void    **Slot0() { return &buf; }                                                    \
+      uint32_t *Slot1() { return &count; }                                                  \
+      int Commit()                                                                          \
+      {                                                                                     \
+         int rc = (count == sizeof(T) ? 0 : -1);                                            \
+         if (rc == 0) memcpy(&ref, buf, sizeof(T));                                         \
+         free(buf);                                                                         \
+         return rc;                                                                         \
+      }                                                                                     \
+   };                                                                                       \
+};                                                                                          \
+}
+
+/**
+ * Concatenates the formats of the fields of a message.
+ */
+inline std::string MessageFormat(const char *f1, const char *f2=NULL, const char *f3=NULL)
+{
+   std::string format(f1);
+   if (f2 != NULL) format = format + " " + f2;
+   if (f3 != NULL) format = format + " " + f3;
+   return format;
+}
+
+/* Scalars take one varargs slot (the value, or where to unpack it), arrays take two (data and count) */
+#define SYNAPSE_SEND_SLOTS_1(T, x) Field<T>::Slot0(x)
+#define SYNAPSE_SEND_SLOTS_2(T, x) Field<T>::Slot0(x), Field<T>::Slot1(x)
+#define SYNAPSE_RECV_SLOTS_1(h)    h.Slot0()
+#define SYNAPSE_RECV_SLOTS_2(h)    h.Slot0(), h.Slot1()
+
+template <int KA>                 struct Marshal1;
+template <int KA, int KB>         struct Marshal2;
+template <int KA, int KB, int KC> struct Marshal3;
+
+#define SYNAPSE_MARSHAL_1(KA)                                                               \
+template <> struct Marshal1<KA>                                                             \
+{                                                                                           \
+   template <class A> static int Send(STREAM *s, int tag, const char *f, const A &a)       \
+   { return STREAM_send(s, tag, f, SYNAPSE_SEND_SLOTS_##KA(A, a)); }                        \
+   template <class A> static size_t Size(const char *f, const A &a)                         \
+   { return PackedSize(f, SYNAPSE_SEND_SLOTS_##KA(A, a)); }                                 \
+   template <class HA> static int Unpack(PACKET_PTR &p, const char *f, HA &ha)             \
+   { return PACKET_unpack(p, f, SYNAPSE_RECV_SLOTS_##KA(ha)); }                             \
+};
+
+#define SYNAPSE_MARSHAL_2(KA, KB)                                                           \
+template <> struct Marshal2<KA, KB>                                                         \
+{                                                                                           \
+   template <class A, class B>                                                              \
+   static int Send(STREAM *s, int tag, const char *f, const A &a, const B &b)              \
+   { return STREAM_send(s, tag, f, SYNAPSE_SEND_SLOTS_##KA(A, a), SYNAPSE_SEND_SLOTS_##KB(B, b)); } \
+   template <class A, class B>                                                              \
+   static size_t Size(const char *f, const A &a, const B &b)                               \
+   { return PackedSize(f, SYNAPSE_SEND_SLOTS_##KA(A, a), SYNAPSE_SEND_SLOTS_##KB(B, b)); } \
+   template <class HA, class HB>                                                            \
+   static int Unpack(PACKET_PTR &p, const char *f, HA &ha, HB &hb)                         \
+   { return PACKET_unpack(p, f, SYNAPSE_RECV_SLOTS_##KA(ha), SYNAPSE_RECV_SLOTS_##KB(hb)); } \
+};
+
+#define SYNAPSE_MARSHAL_3(KA, KB, KC)                                                       \
+template <> struct Marshal3<KA, KB, KC>                                                     \
+{                                                                                           \
+   template <class A, class B, class C>                                                     \
+   static int Send(STREAM *s, int tag, const char *f, const A &a, const B &b, const C &c)  \
+   { return STREAM_send(s, tag, f, SYNAPSE_SEND_SLOTS_##KA(A, a), SYNAPSE_SEND_SLOTS_##KB(B, b), SYNAPSE_SEND_SLOTS_##KC(C, c)); } \
+   template <class A, class B, class C>                                                     \
+   static size_t Size(const char *f, const A &a, const B &b, const C &c)                   \
+   { return PackedSize(f, SYNAPSE_SEND_SLOTS_##KA(A, a), SYNAPSE_SEND_SLOTS_##KB(B, b), SYNAPSE_SEND_SLOTS_##KC(C, c)); } \
+   template <class HA, class HB, class HC>                                                  \
+   static int Unpack(PACKET_PTR &p, const char *f, HA &ha, HB &hb, HC &hc)                 \
+   { return PACKET_unpack(p, f, SYNAPSE_RECV_SLOTS_##KA(ha), SYNAPSE_RECV_SLOTS_##KB(hb), SYNAPSE_RECV_SLOTS_##KC(hc)); } \
+};
+
+SYNAPSE_MARSHAL_1(1)
+SYNAPSE_MARSHAL_1(2)
+SYNAPSE_MARSHAL_2(1, 1) SYNAPSE_MARSHAL_2(1, 2) SYNAPSE_MARSHAL_2(2, 1) SYNAPSE_MARSHAL_2(2, 2)
+SYNAPSE_MARSHAL_3(1, 1, 1) SYNAPSE_MARSHAL_3(1, 1, 2) SYNAPSE_MARSHAL_3(1, 2, 1) SYNAPSE_MARSHAL_3(1, 2, 2)
+SYNAPSE_MARSHAL_3(2, 1, 1) SYNAPSE_MARSHAL_3(2, 1, 2) SYNAPSE_MARSHAL_3(2, 2, 1) SYNAPSE_MARSHAL_3(2, 2, 2)
+
+/**
+ * Flushes the stream after a typed send, reporting the errors like MRN_STREAM_SEND.
+ * The size of the data is counted in the metrics of the stream.
+ */
+inline int FlushTyped(STREAM *stream, int tag, const char *format, int rc, size_t bytes)
+{
+   if (rc == -1)
+   {
+      fprintf(stderr, "Synapse::Send(\"%s\") failed (stream_id=%d, tag=%d).\n", format, STREAM_get_Id(stream), tag);
+      return -1;
+   }
+   if (STREAM_flush(stream) == -1)
+   {
+      fprintf(stderr, "Synapse::Send: stream::flush() failed (stream_id=%d).\n", STREAM_get_Id(stream));
+      return -1;
+   }
+   METRICS_COUNT_SENT(stream, bytes);
+   return 0;
+}
+
+/**
+ * Sends a typed message and flushes the stream.
+ * @return 0 on success; -1 otherwise.
+ */
+template <class A>
+int Send(STREAM *stream, int tag, const A &a)
+{
+   TraceScope trace(TRACE_SEND, tag, stream);
+   static const std::string format = MessageFormat(Field<A>::Format());
+   typedef Marshal1<Field<A>::kind> M;
+   int rc = M::Send(stream, tag, format.c_str(), a);
+   return FlushTyped(stream, tag, format.c_str(), rc, (metricsEnabled ? M::Size(format.c_str(), a) : 0));
+}
+
+template <class A, class B>
+int Send(STREAM *stream, int tag, const A &a, const B &b)
+{
+   TraceScope trace(TRACE_SEND, tag, stream);
+   static const std::string format = MessageFormat(Field<A>::Format(), Field<B>::Format());
+   typedef Marshal2<Field<A>::kind, Field<B>::kind> M;
+   int rc = M::Send(stream, tag, format.c_str(), a, b);
+   return FlushTyped(stream, tag, format.c_str(), rc, (metricsEnabled ? M::Size(format.c_str(), a, b) : 0));
+}
+
+template <class A, class B, class C>
+int Send(STREAM *stream, int tag, const A &a, const B &b, const C &c)
+{
+   TraceScope trace(TRACE_SEND, tag, stream);
+   static const std::string format = MessageFormat(Field<A>::Format(), Field<B>::Format(), Field<C>::Format());
+   typedef Marshal3<Field<A>::kind, Field<B>::kind, Field<C>::kind> M;
+   int rc = M::Send(stream, tag, format.c_str(), a, b, c);
+   return FlushTyped(stream, tag, format.c_str(), rc, (metricsEnabled ? M::Size(format.c_str(), a, b, c) : 0));
+}
+
+/**
+ * Unpacks a typed message from a packet received with the MRN_STREAM_RECV family of wrappers.
+ * @return 0 on success; -1 if the packet does not match the types.
+ */
+template <class A>
+int Unpack(PACKET_PTR &p, A &a)
+{
+   static const std::string format = MessageFormat(Field<A>::Format());
+   typename Field<A>::Holder ha(a);
+   int rc = Marshal1<Field<A>::kind>::Unpack(p, format.c_str(), ha);
+   /* Every field is committed, even after an error, so that all the buffers allocated by MRNet are freed */
+   return ((rc == -1) | (ha.Commit() == -1) ? -1 : 0);
+}
+
+template <class A, class B>
+int Unpack(PACKET_PTR &p, A &a, B &b)
+{
+   static const std::string format = MessageFormat(Field<A>::Format(), Field<B>::Format());
+   typename Field<A>::Holder ha(a);
+   typename Field<B>::Holder hb(b);
+   int rc = Marshal2<Field<A>::kind, Field<B>::kind>::Unpack(p, format.c_str(), ha, hb);
+   return ((rc == -1) | (ha.Commit() == -1) | (hb.Commit() == -1) ? -1 : 0);
+}
+
+template <class A, class B, class C>
+int Unpack(PACKET_PTR &p, A &a, B &b, C &c)
+{
+   static const std::string format = MessageFormat(Field<A>::Format(), Field<B>::Format(), Field<C>::Format());
+   typename Field<A>::Holder ha(a);
+   typename Field<B>::Holder hb(b);
+   typename Field<C>::Holder hc(c);
+   int rc = Marshal3<Field<A>::kind, Field<B>::kind, Field<C>::kind>::Unpack(p, format.c_str(), ha, hb, hc);
+   return ((rc == -1) | (ha.Commit() == -1) | (hb.Commit() == -1) | (hc.Commit() == -1) ? -1 : 0);
+}
+
+/**
+ * Receives a packet with the expected tag (or any tag with TAG_ANY), reporting the errors like MRN_STREAM_RECV.
+ */
+inline int RecvTyped(STREAM *stream, int expected, PACKET_PTR &p)
+{
+   int tag = TAG_ANY;
+   TraceScope trace(TRACE_RECV, expected, stream);
+
+   FlushPending();
+   int rc = STREAM_recv(stream, &tag, p, true);
+   trace.SetValue(tag);
+   if (rc == -1)
+   {
+      fprintf(stderr, "Synapse::Recv: stream::recv() failed (stream_id=%d).\n", STREAM_get_Id(stream));
+      return -1;
+   }
+   METRICS_COUNT_RECEIVED(stream, PACKET_get_BufferLen(p));
+   if ((expected != TAG_ANY) && (tag != expected))
+   {
+      fprintf(stderr, "Synapse::Recv: tag received %d, but expected %d (stream_id=%d).\n", tag, expected, STREAM_get_Id(stream));
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Receives a typed message from the stream (blocking).
+ * @return 0 on success; -1 if the receive fails, the tag is not the expected or the packet does not match the types.
+ */
+template <class A>
+int Recv(STREAM *stream, int expected, A &a)
+{
+   PACKET_new(p);
+   int rc = RecvTyped(stream, expected, p);
+   if (rc == 0) rc = Unpack(p, a);
+   PACKET_delete(p);
+   return rc;
+}
+
+template <class A, class B>
+int Recv(STREAM *stream, int expected, A &a, B &b)
+{
+   PACKET_new(p);
+   int rc = RecvTyped(stream, expected, p);
+   if (rc == 0) rc = Unpack(p, a, b);
+   PACKET_delete(p);
+   return rc;
+}
+
+template <class A, class B, class C>
+int Recv(STREAM *stream, int expected, A &a, B &b, C &c)
+{
+   PACKET_new(p);
+   int rc = RecvTyped(stream, expected, p);
+   if (rc == 0) rc = Unpack(p, a, b, c);
+   PACKET_delete(p);
+   return rc;
+}
+
+} /* namespace Synapse */
+
+#endif /* __MRNET_TYPED_H__ */
@@ -51,11 +51,13 @@ extern "C" {
 # define PACKET_new(p)                               PACKET_PTR p = (PACKET_PTR)malloc(sizeof(PACKET))
 # define PACKET_unpack(p, fmt, args...)               Packet_unpack(p, fmt, ## args)
 # define PACKET_delete(p)                            if (p != NULL) free(p)
+# define PACKET_get_BufferLen(p)                     ((p)->buf_len)
 # define NETWORK                                     Network_t
 # define NETWORK_PTR                                 Network_t*
 # define NETWORK_recv(net, tag, data, stream, block) ( block ? Network_recv(net, tag, data, stream) : Network_recv_nonblock(net, tag, data, stream) )
 # define NETWORK_CreateNetworkBE(argc, argv)         Network_CreateNetworkBE(argc, argv)
 # define NETWORK_get_LocalRank(net)                  Network_get_LocalRank(net)
+# define NETWORK_get_Stream(net, id)                 Network_get_Stream(net, id)
 # define NETWORK_waitfor_ShutDown(net)               Network_waitfor_ShutDown(net)
 # define NETWORK_delete(net)                         if (net != NULL) delete_Network_t(net)
 # define NETWORK_get_NumBackEnds(net, num_be)                                  \
@@ -65,6 +67,27 @@ extern "C" {
    num_be = nodes->size;                                                       \
    delete_vector_t(nodes);                                                     \
 }
+# define NETWORK_get_TopologySnapshot(net, be_ranks, be_parents, leaf_ranks)              \
+{                                                                                         \
+   unsigned int i;                                                                        \
+   vector_t *nodes  = new_empty_vector_t();                                               \
+   vector_t *leaves = new_empty_vector_t();                                               \
+   NetworkTopology_get_BackEndNodes(Network_get_NetworkTopology(net), nodes);             \
+   NetworkTopology_get_Leaves(Network_get_NetworkTopology(net), leaves);                  \
+   for (i=0; i<nodes->size; i++)                                                          \
+   {                                                                                      \
+      Node_t *node   = (Node_t *)nodes->vec[i];                                           \
+      Node_t *parent = NetworkTopology_Node_get_Parent(node);                             \
+      be_ranks.push_back(NetworkTopology_Node_get_Rank(node));                            \
+      be_parents.push_back(parent != NULL ? NetworkTopology_Node_get_Rank(parent) : 0);   \
+   }                                                                                      \
+   for (i=0; i<leaves->size; i++)                                                         \
+   {                                                                                      \
+      leaf_ranks.push_back(NetworkTopology_Node_get_Rank((Node_t *)leaves->vec[i]));      \
+   }                                                                                      \
+   delete_vector_t(nodes);                                                                \
+   delete_vector_t(leaves);                                                               \
+}
 #else
 # include <mrnet/MRNet.h>
 using namespace MRN;
@@ -81,11 +104,13 @@ using namespace MRN;
 # define PACKET_new(p)                               PACKET_PTR p
 # define PACKET_unpack(p, fmt, args...)              p->unpack(fmt, ## args)
 # define PACKET_delete(p)                              
+# define PACKET_get_BufferLen(p)                     (p)->get_BufferLen()
 # define NETWORK                                     Network
 # define NETWORK_PTR                                 Network*
 # define NETWORK_recv(net, tag, data, stream, block) net->recv(tag, data, stream, block)
 # define NETWORK_CreateNetworkBE(argc, argv)         Network::CreateNetworkBE(argc, argv)
 # define NETWORK_get_LocalRank(net)                  net->get_LocalRank()
+# define NETWORK_get_Stream(net, id)                 net->get_Stream(id)
 # define NETWORK_waitfor_ShutDown(net)               net->waitfor_ShutDown()
 # define NETWORK_delete(net)                         if (net != NULL) delete net
 # define NETWORK_get_NumBackEnds(net, num_be)           \
@@ -94,13 +119,32 @@ using namespace MRN;
    net->get_NetworkTopology()->get_BackEndNodes(nodes); \
    num_be = nodes.size();                               \
 }
+# define NETWORK_get_TopologySnapshot(net, be_ranks, be_parents, leaf_ranks)                 \
+{                                                                                            \
+   std::set< NetworkTopology::Node * > nodes;                                                \
+   std::vector< NetworkTopology::Node * > leaves;                                            \
+   net->get_NetworkTopology()->get_BackEndNodes(nodes);                                      \
+   net->get_NetworkTopology()->get_Leaves(leaves);                                           \
+   for (std::set< NetworkTopology::Node * >::iterator it = nodes.begin(); it != nodes.end(); ++it) \
+   {                                                                                         \
+      NetworkTopology::Node *parent = (*it)->get_Parent();                                   \
+      be_ranks.push_back((*it)->get_Rank());                                                 \
+      be_parents.push_back(parent != NULL ? parent->get_Rank() : 0);                         \
+   }                                                                                         \
+   for (unsigned int i=0; i<leaves.size(); i++)                                              \
+   {                                                                                         \
+      leaf_ranks.push_back(leaves[i]->get_Rank());                                           \
+   }                                                                                         \
+}
 /* Sends a message to the subset of BEs in the stream specified in be_list */
 # define MRN_STREAM_SEND_P2P(stream, be_list, tag, format, args...)        \
 {                                                                          \
+	TRACE_BLOCK(Synapse::TRACE_SEND, tag, stream);                     \
 	PacketPtr p( new Packet(stream->get_Id(), tag, format, ## args) ); \
 	p->set_Destinations (&be_list[0], be_list.size());                 \
 	stream->send( p );                                                 \
 	stream->flush();                                                   \
+	METRICS_COUNT_SENT(stream, Synapse::PackedSize(format, ## args));  \
 }
 #endif
 
@@ -109,12 +153,16 @@ using namespace MRN;
 
 
 /**
- * Receive from a specific stream (blocking) 
+ * Receive from a specific stream (blocking). The messages buffered with MRN_STREAM_SEND_BUFFERED 
+ * are flushed first, so that the answer we wait for is not stuck behind them (see SendBuffer.h)
  */
 #define MRN_STREAM_RECV(stream, tag, data, expected)                                         \
 {                                                                                            \
 	int rc;                                                                              \
+	TRACE_BLOCK(Synapse::TRACE_RECV, expected, stream);                                  \
+	Synapse::FlushPending();                                                             \
 	rc = STREAM_recv(stream, tag, data, true);                                           \
+	trace_scope.SetValue(*tag);                                                          \
 	if (rc == -1)                                                                        \
 	{                                                                                    \
 		PRINT_WHERE;                                                                 \
@@ -122,6 +170,7 @@ using namespace MRN;
 			STREAM_get_Id(stream));                                              \
 		exit(1);                                                                     \
 	}                                                                                    \
+	METRICS_COUNT_RECEIVED(stream, PACKET_get_BufferLen(data));                         \
 	if ((static_cast<Tag>(expected) != static_cast<Tag>(TAG_ANY)) &&                     \
             (static_cast<Tag>(*tag)     != static_cast<Tag>(expected)))                      \
 	{                                                                                    \
@@ -133,13 +182,15 @@ using namespace MRN;
 
 
 /**
- * Receive from a specific stream (non-blocking) 
+ * Receive from a specific stream (non-blocking). Sleeps on the stream's data notification 
+ * instead of polling, so it returns as soon as the packet arrives (see StreamWait.h)
  */
 #define MRN_STREAM_RECV_NONBLOCKING(stream, tag, data, expected)                             \
 {                                                                                            \
 	int rc;                                                                              \
-	while ((rc = STREAM_recv(stream, tag, data, false)) == 0)                            \
-		usleep(500000);                                                              \
+	TRACE_BLOCK(Synapse::TRACE_RECV, expected, stream);                                  \
+	rc = Synapse::RecvTimed(stream, tag, data, -1);                                      \
+	trace_scope.SetValue(*tag);                                                          \
 	if (rc == -1)                                                                        \
 	{                                                                                    \
 		PRINT_WHERE;                                                                 \
@@ -147,6 +198,7 @@ using namespace MRN;
 			STREAM_get_Id(stream));                                              \
 		exit(1);                                                                     \
 	}                                                                                    \
+	METRICS_COUNT_RECEIVED(stream, PACKET_get_BufferLen(data));                         \
 	if ((static_cast<Tag>(expected) != static_cast<Tag>(TAG_ANY)) &&                     \
             (static_cast<Tag>(*tag)     != static_cast<Tag>(expected)))                      \
 	{                                                                                    \
@@ -157,18 +209,50 @@ using namespace MRN;
 }
 
 
+/**
+ * Receive from a specific stream waiting at most timeout_ms milliseconds. 
+ * Sets received to 1 if a packet arrived, or to 0 on timeout
+ */
+#define MRN_STREAM_RECV_TIMEOUT(stream, tag, data, expected, timeout_ms, received)          \
+{                                                                                            \
+	TRACE_BLOCK(Synapse::TRACE_RECV, expected, stream);                                  \
+	received = Synapse::RecvTimed(stream, tag, data, timeout_ms);                        \
+	if (received == 1) trace_scope.SetValue(*tag);                                       \
+	if (received == -1)                                                                  \
+	{                                                                                    \
+		PRINT_WHERE;                                                                 \
+		fprintf(stderr, "stream::recv() failed (stream_id=%d).",                     \
+			STREAM_get_Id(stream));                                              \
+		exit(1);                                                                     \
+	}                                                                                    \
+	if (received == 1) METRICS_COUNT_RECEIVED(stream, PACKET_get_BufferLen(data));      \
+	if ((received == 1) &&                                                               \
+	    (static_cast<Tag>(expected) != static_cast<Tag>(TAG_ANY)) &&                     \
+            (static_cast<Tag>(*tag)     != static_cast<Tag>(expected)))                      \
+	{                                                                                    \
+		PRINT_WHERE;                                                                 \
+		fprintf(stderr, "stream::recv() tag received %d, but expected %d (%s)\n",    \
+			*tag, expected, #expected);                                          \
+	}                                                                                    \
+}
+
+
 /** 
  * Receives from any stream of the network 
  */
 #define MRN_NETWORK_RECV(net, tag, data, expected, stream, blocking)                         \
 {                                                                                            \
 	int rc;                                                                              \
+	TRACE_BLOCK(Synapse::TRACE_RECV, expected, NULL);                                    \
+	if (blocking) Synapse::FlushPending();                                               \
 	rc = NETWORK_recv(net, tag, data, stream, blocking);                                 \
+	if (rc == 1) { trace_scope.SetValue(*tag); trace_scope.SetStream(*(stream)); }       \
 	if (rc == -1) {                                                                      \
 		PRINT_WHERE;                                                                 \
 		fprintf(stderr, "network::recv() failed.\n");                                \
 		exit(1);                                                                     \
 	}                                                                                    \
+	if (rc == 1) METRICS_COUNT_RECEIVED(*(stream), PACKET_get_BufferLen(data));         \
 	if ((static_cast<Tag>(expected) != static_cast<Tag>(TAG_ANY)) &&                     \
             (static_cast<Tag>(*tag)     != static_cast<Tag>(expected))) {                    \
 		PRINT_WHERE;                                                                 \
@@ -184,6 +268,7 @@ using namespace MRN;
 #define MRN_STREAM_SEND(stream, tag, format, args...)                                        \
 {                                                                                            \
 	int rc;                                                                              \
+	TRACE_BLOCK(Synapse::TRACE_SEND, tag, stream);                                       \
 	rc = STREAM_send(stream, tag, format, ## args);                                      \
 	if (rc == -1) {                                                                      \
 		PRINT_WHERE;                                                                 \
@@ -199,8 +284,41 @@ using namespace MRN;
 				STREAM_get_Id(stream));                                      \
 			exit(1);                                                             \
 		}                                                                            \
+		METRICS_COUNT_SENT(stream, Synapse::PackedSize(format, ## args));            \
+	}                                                                                    \
+}
+
+
+/** 
+ * Sends message and flushes the stream only when its flush policy says so (see SendBuffer.h),
+ * so that many small messages travel coalesced in fewer packets
+ */
+#define MRN_STREAM_SEND_BUFFERED(stream, tag, format, args...)                               \
+{                                                                                            \
+	int rc;                                                                              \
+	TRACE_BLOCK(Synapse::TRACE_SEND, tag, stream);                                       \
+	rc = STREAM_send(stream, tag, format, ## args);                                      \
+	if (rc == -1) {                                                                      \
+		PRINT_WHERE;                                                                 \
+		fprintf(stderr, "stream::send(%s, \"%s\") failed (stream_id=%d, tag=%d).\n", \
+			#tag, format, STREAM_get_Id(stream), tag);                           \
+		exit(1);                                                                     \
 	}                                                                                    \
+	else if (Synapse::NotifySend(stream, Synapse::PackedSize(format, ## args)) == -1) {  \
+		PRINT_WHERE;                                                                 \
+		fprintf(stderr, "stream::flush() failed (stream_id=%d).\n",                  \
+			STREAM_get_Id(stream));                                              \
+		exit(1);                                                                     \
+	}                                                                                    \
+	METRICS_COUNT_SENT(stream, Synapse::PackedSize(format, ## args));                    \
 }
 
+#include "SendBuffer.h"
+#include "StreamWait.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "MRNet_typed.h"
+#include "Compression.h"
+
 #endif /* __MRNET_WRAPPERS_H__ */
 
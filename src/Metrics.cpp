@@ -0,0 +1,550 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#include <sstream>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "Metrics.h"
+#include "Trace.h"
+
+using std::stringstream;
+using std::vector;
+using namespace Synapse;
+
+#define METRICS_PROBES 4 /* Slots probed for a stream before accounting it in the overflow slot */
+
+/* Counters of a stream. The key is the stream ID + 1, 0 for free slots */
+typedef struct
+{
+   uint32_t key;
+   uint64_t packetsSent;
+   uint64_t bytesSent;
+   uint64_t packetsReceived;
+   uint64_t bytesReceived;
+   char     label[64];
+} StreamMetrics;
+
+bool Synapse::metricsEnabled = false;
+
+static vector<ProtocolMetrics *> protocolMetrics;   /* Indexed by protocol index                       */
+static StreamMetrics  streamMetrics[METRICS_MAX_STREAMS + 1]; /* The last slot takes the streams that do not fit */
+static Histogram      attachLatency;                /* Time for the back-ends to attach                 */
+static uint64_t       backendsAttached = 0;
+static uint64_t       backendsLost     = 0;
+static pthread_mutex_t metricsLock = PTHREAD_MUTEX_INITIALIZER; /* Protects the registration of protocols and labels */
+
+/* Periodic dump */
+static pthread_t       dumpThread;
+static bool            dumpRunning = false;
+static pthread_mutex_t dumpLock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  dumpCond    = PTHREAD_COND_INITIALIZER;
+static string          dumpFile;
+static string          dumpProcess;
+static MetricsFormat   dumpFormat;
+static unsigned int    dumpPeriod;
+
+
+/**
+ * Reads a counter that other threads may be updating.
+ */
+static inline uint64_t Load(uint64_t &counter)
+{
+   return METRICS_ADD(counter, 0);
+}
+
+
+/**
+ * Enables or disables the accounting. It is enabled at start-up when SYNAPSE_METRICS_FILE is set.
+ * @param enable True to enable.
+ */
+void Synapse::EnableMetrics(bool enable)
+{
+   metricsEnabled = enable;
+}
+
+
+/**
+ * Allocates the counters of a protocol. Called when the protocol is loaded.
+ * @param prot_idx Numeric ID of the protocol.
+ * @param prot_id  Protocol identifier.
+ * @return the counters of the protocol.
+ */
+ProtocolMetrics * Synapse::RegisterProtocolMetrics(unsigned int prot_idx, string prot_id)
+{
+   ProtocolMetrics *metrics = new ProtocolMetrics;
+   metrics->protID     = prot_id;
+   metrics->dispatches = 0;
+   metrics->errors     = 0;
+   memset(metrics->latency, 0, sizeof(metrics->latency));
+
+   pthread_mutex_lock(&metricsLock);
+   if (protocolMetrics.size() <= prot_idx) protocolMetrics.resize(prot_idx + 1, NULL);
+   protocolMetrics[prot_idx] = metrics;
+   pthread_mutex_unlock(&metricsLock);
+
+   return metrics;
+}
+
+
+/**
+ * Returns the counters of the given stream, claiming a slot the first time the stream is seen.
+ */
+static StreamMetrics & FindStream(STREAM *stream)
+{
+   uint32_t key   = STREAM_get_Id(stream) + 1;
+   uint32_t first = key % METRICS_MAX_STREAMS;
+
+   for (unsigned int i=0; i<METRICS_PROBES; i++)
+   {
+      StreamMetrics &slot = streamMetrics[(first + i) % METRICS_MAX_STREAMS];
+      if ((slot.key == key) ||
+          ((slot.key == 0) && (__sync_bool_compare_and_swap(&slot.key, 0, key) || (slot.key == key))))
+      {
+         return slot;
+      }
+   }
+   return streamMetrics[METRICS_MAX_STREAMS];
+}
+
+
+/**
+ * Names a stream in the dumps, usually after the protocol that registered it.
+ * @param stream The stream.
+ * @param label  The name.
+ */
+void Synapse::LabelStreamMetrics(STREAM *stream, string label)
+{
+   if (stream == NULL) return;
+
+   StreamMetrics &slot = FindStream(stream);
+   pthread_mutex_lock(&metricsLock);
+   if (slot.label[0] == '\0')
+   {
+      strncpy(slot.label, label.c_str(), sizeof(slot.label) - 1);
+   }
+   pthread_mutex_unlock(&metricsLock);
+}
+
+
+/**
+ * Accounts a packet sent through a stream (see METRICS_COUNT_SENT).
+ * @param stream  The stream.
+ * @param bytes   Size of the data sent.
+ * @param packets Packets sent (0 to account the size of a packet already counted).
+ */
+void Synapse::CountSent(STREAM *stream, size_t bytes, unsigned int packets)
+{
+   StreamMetrics &slot = FindStream(stream);
+   if (packets > 0) METRICS_ADD(slot.packetsSent, packets);
+   if (bytes > 0) METRICS_ADD(slot.bytesSent, bytes);
+}
+
+
+/**
+ * Accounts a packet received from a stream (see METRICS_COUNT_RECEIVED).
+ * @param stream  The stream.
+ * @param bytes   Size of the packet received, as packed by MRNet.
+ * @param packets Packets received (0 to account the size of a packet already counted).
+ */
+void Synapse::CountReceived(STREAM *stream, size_t bytes, unsigned int packets)
+{
+   StreamMetrics &slot = FindStream(stream);
+   if (packets > 0) METRICS_ADD(slot.packetsReceived, packets);
+   if (bytes > 0) METRICS_ADD(slot.bytesReceived, bytes);
+}
+
+
+/**
+ * Accounts a run of a protocol.
+ * @param metrics Counters of the protocol.
+ * @param failed  True if the protocol failed.
+ */
+void Synapse::CountDispatch(ProtocolMetrics *metrics, bool failed)
+{
+   if ((! metricsEnabled) || (metrics == NULL)) return;
+
+   METRICS_ADD(metrics->dispatches, 1);
+   if (failed) METRICS_ADD(metrics->errors, 1);
+}
+
+
+/**
+ * Adds a latency to a histogram.
+ * @param histogram The histogram.
+ * @param usecs     The latency in microseconds.
+ */
+void Synapse::RecordLatencyUs(Histogram &histogram, uint64_t usecs)
+{
+   unsigned int bucket = (usecs == 0 ? 0 : 64 - __builtin_clzll(usecs));
+   if (bucket > METRICS_HISTOGRAM_BUCKETS) bucket = METRICS_HISTOGRAM_BUCKETS;
+
+   METRICS_ADD(histogram.buckets[bucket], 1);
+   METRICS_ADD(histogram.count, 1);
+   METRICS_ADD(histogram.sumUs, usecs);
+}
+
+
+/**
+ * Adds the time elapsed since the given moment to a histogram.
+ * @param histogram The histogram.
+ * @param since     When the measured operation started.
+ */
+void Synapse::RecordLatency(Histogram &histogram, struct timeval *since)
+{
+   struct timeval now;
+
+   if (! metricsEnabled) return;
+
+   gettimeofday(&now, NULL);
+   int64_t usecs = (int64_t)(now.tv_sec - since->tv_sec) * 1000000 + (now.tv_usec - since->tv_usec);
+   RecordLatencyUs(histogram, (usecs > 0 ? usecs : 0));
+}
+
+
+/**
+ * Accounts a back-end that attached to the network.
+ * @param seconds Time it took to attach since the network was started.
+ */
+void Synapse::RecordAttach(double seconds)
+{
+   if (! metricsEnabled) return;
+
+   METRICS_ADD(backendsAttached, 1);
+   RecordLatencyUs(attachLatency, (uint64_t)(seconds * 1000000));
+}
+
+
+/**
+ * Accounts a back-end lost after the initialization.
+ */
+void Synapse::CountBackendLost(void)
+{
+   if (metricsEnabled) METRICS_ADD(backendsLost, 1);
+}
+
+
+/**
+ * Returns the upper bound of a histogram bucket, as used in the dumps.
+ */
+static string BucketBound(unsigned int bucket, bool seconds)
+{
+   stringstream ss;
+   if (bucket >= METRICS_HISTOGRAM_BUCKETS) ss << "+Inf";
+   else if (seconds)                         ss << (double)((uint64_t)1 << bucket) / 1000000;
+   else                                      ss << ((uint64_t)1 << bucket);
+   return ss.str();
+}
+
+
+/**
+ * Writes a histogram as a JSON object with cumulative buckets, keyed by their upper bound in microseconds.
+ */
+static void HistogramJSON(stringstream &out, Histogram &histogram)
+{
+   uint64_t cumulative = 0;
+
+   out << "{\"count\": " << Load(histogram.count) << ", \"sum_us\": " << Load(histogram.sumUs) << ", \"buckets\": {";
+   for (unsigned int b=0; b<=METRICS_HISTOGRAM_BUCKETS; b++)
+   {
+      cumulative += Load(histogram.buckets[b]);
+      out << (b > 0 ? ", " : "") << "\"" << BucketBound(b, false) << "\": " << cumulative;
+   }
+   out << "}}";
+}
+
+
+/**
+ * Writes a histogram in Prometheus text format, in seconds.
+ */
+static void HistogramPrometheus(stringstream &out, string name, string labels, Histogram &histogram)
+{
+   uint64_t cumulative = 0;
+
+   for (unsigned int b=0; b<=METRICS_HISTOGRAM_BUCKETS; b++)
+   {
+      cumulative += Load(histogram.buckets[b]);
+      out << name << "_bucket{" << labels << ",le=\"" << BucketBound(b, true) << "\"} " << cumulative << "\n";
+   }
+   out << name << "_sum{"   << labels << "} " << (double)Load(histogram.sumUs) / 1000000 << "\n";
+   out << name << "_count{" << labels << "} " << Load(histogram.count) << "\n";
+}
+
+
+static const char *PhaseNames[NUM_PHASES] = { "send", "run", "ack", "barrier" };
+
+
+/**
+ * Escapes a Prometheus label value: backslashes, quotes and new lines.
+ */
+static string PrometheusEscape(const string &str)
+{
+   string escaped;
+
+   for (unsigned int i=0; i<str.size(); i++)
+   {
+      if      (str[i] == '\\') escaped += "\\\\";
+      else if (str[i] == '"')  escaped += "\\\"";
+      else if (str[i] == '\n') escaped += "\\n";
+      else                     escaped += str[i];
+   }
+   return escaped;
+}
+
+
+/**
+ * Formats all the counters. Has to be called with metricsLock held.
+ */
+static string FormatMetrics(MetricsFormat format, string process)
+{
+   stringstream out;
+   struct timeval now;
+
+   gettimeofday(&now, NULL);
+   if (format == METRICS_JSON)
+   {
+      out << "{\n  \"process\": \"" << JSONEscape(process) << "\",\n  \"timestamp\": " << now.tv_sec << ",\n  \"protocols\": [";
+      bool first = true;
+      for (unsigned int i=0; i<protocolMetrics.size(); i++)
+      {
+         ProtocolMetrics *metrics = protocolMetrics[i];
+         if (metrics == NULL) continue;
+
+         out << (first ? "\n" : ",\n") << "    {\"id\": \"" << JSONEscape(metrics->protID) << "\", \"index\": " << i
+             << ", \"dispatches\": " << Load(metrics->dispatches) << ", \"errors\": " << Load(metrics->errors) << ", \"latency\": {";
+         for (unsigned int ph=0; ph<NUM_PHASES; ph++)
+         {
+            out << (ph > 0 ? ", " : "") << "\"" << PhaseNames[ph] << "\": ";
+            HistogramJSON(out, metrics->latency[ph]);
+         }
+         out << "}}";
+         first = false;
+      }
+      out << "\n  ],\n  \"streams\": [";
+      first = true;
+      for (unsigned int i=0; i<=METRICS_MAX_STREAMS; i++)
+      {
+         StreamMetrics &slot = streamMetrics[i];
+         if ((slot.key == 0) && (i < METRICS_MAX_STREAMS)) continue;
+         if ((i == METRICS_MAX_STREAMS) && (Load(slot.packetsSent) + Load(slot.packetsReceived) == 0)) continue;
+
+         out << (first ? "\n" : ",\n") << "    {\"id\": ";
+         if (i < METRICS_MAX_STREAMS) out << slot.key - 1;
+         else                         out << "\"other\"";
+         out << ", \"label\": \"" << JSONEscape(slot.label) << "\""
+             << ", \"packets_sent\": " << Load(slot.packetsSent)     << ", \"bytes_sent\": "     << Load(slot.bytesSent)
+             << ", \"packets_received\": " << Load(slot.packetsReceived) << ", \"bytes_received\": " << Load(slot.bytesReceived) << "}";
+         first = false;
+      }
+      out << "\n  ],\n  \"backends\": {\"attached\": " << Load(backendsAttached) << ", \"lost\": " << Load(backendsLost) 
+          << ", \"attach\": ";
+      HistogramJSON(out, attachLatency);
+      out << "}\n}\n";
+   }
+   else
+   {
+      string proc = "process=\"" + PrometheusEscape(process) + "\"";
+
+      out << "# TYPE synapse_dispatches_total counter\n";
+      for (unsigned int i=0; i<protocolMetrics.size(); i++)
+      {
+         if (protocolMetrics[i] == NULL) continue;
+         out << "synapse_dispatches_total{" << proc << ",protocol=\"" << PrometheusEscape(protocolMetrics[i]->protID) << "\"} " 
+             << Load(protocolMetrics[i]->dispatches) << "\n";
+      }
+      out << "# TYPE synapse_dispatch_errors_total counter\n";
+      for (unsigned int i=0; i<protocolMetrics.size(); i++)
+      {
+         if (protocolMetrics[i] == NULL) continue;
+         out << "synapse_dispatch_errors_total{" << proc << ",protocol=\"" << PrometheusEscape(protocolMetrics[i]->protID) << "\"} " 
+             << Load(protocolMetrics[i]->errors) << "\n";
+      }
+      out << "# TYPE synapse_phase_seconds histogram\n";
+      for (unsigned int i=0; i<protocolMetrics.size(); i++)
+      {
+         if (protocolMetrics[i] == NULL) continue;
+         for (unsigned int ph=0; ph<NUM_PHASES; ph++)
+         {
+            if (Load(protocolMetrics[i]->latency[ph].count) == 0) continue;
+            HistogramPrometheus(out, "synapse_phase_seconds", 
+               proc + ",protocol=\"" + PrometheusEscape(protocolMetrics[i]->protID) + "\",phase=\"" + PhaseNames[ph] + "\"", protocolMetrics[i]->latency[ph]);
+         }
+      }
+      vector<StreamMetrics *> slots;
+      vector<string>          labels;
+      for (unsigned int i=0; i<=METRICS_MAX_STREAMS; i++)
+      {
+         StreamMetrics &slot = streamMetrics[i];
+         if ((slot.key == 0) && (i < METRICS_MAX_STREAMS)) continue;
+         if ((i == METRICS_MAX_STREAMS) && (Load(slot.packetsSent) + Load(slot.packetsReceived) == 0)) continue;
+
+         stringstream ss;
+         ss << proc << ",stream=\"";
+         if (i < METRICS_MAX_STREAMS) ss << slot.key - 1;
+         else                         ss << "other";
+         ss << "\",label=\"" << PrometheusEscape(slot.label) << "\"";
+         slots.push_back(&slot);
+         labels.push_back(ss.str());
+      }
+      out << "# TYPE synapse_stream_packets_total counter\n";
+      for (unsigned int i=0; i<slots.size(); i++)
+      {
+         out << "synapse_stream_packets_total{" << labels[i] << ",direction=\"sent\"} "     << Load(slots[i]->packetsSent)     << "\n";
+         out << "synapse_stream_packets_total{" << labels[i] << ",direction=\"received\"} " << Load(slots[i]->packetsReceived) << "\n";
+      }
+      out << "# TYPE synapse_stream_bytes_total counter\n";
+      for (unsigned int i=0; i<slots.size(); i++)
+      {
+         out << "synapse_stream_bytes_total{" << labels[i] << ",direction=\"sent\"} "     << Load(slots[i]->bytesSent)     << "\n";
+         out << "synapse_stream_bytes_total{" << labels[i] << ",direction=\"received\"} " << Load(slots[i]->bytesReceived) << "\n";
+      }
+      out << "# TYPE synapse_backends_attached_total counter\n";
+      out << "synapse_backends_attached_total{" << proc << "} " << Load(backendsAttached) << "\n";
+      out << "# TYPE synapse_backends_lost_total counter\n";
+      out << "synapse_backends_lost_total{" << proc << "} " << Load(backendsLost) << "\n";
+      out << "# TYPE synapse_backend_attach_seconds histogram\n";
+      HistogramPrometheus(out, "synapse_backend_attach_seconds", proc, attachLatency);
+   }
+   return out.str();
+}
+
+
+/**
+ * Writes all the counters to a file. The file is written aside and renamed when complete,
+ * so that collectors never read a partial dump.
+ * @param file    Path of the file.
+ * @param format  METRICS_JSON or METRICS_PROMETHEUS (text exposition format).
+ * @param process Name of this process in the dump ("fe", "be<rank>").
+ * @return 0 on success; -1 otherwise.
+ */
+int Synapse::DumpMetrics(string file, MetricsFormat format, string process)
+{
+   pthread_mutex_lock(&metricsLock);
+   string contents = FormatMetrics(format, process);
+   pthread_mutex_unlock(&metricsLock);
+
+   stringstream ss;
+   ss << file << ".tmp." << getpid();
+   string tmpFile = ss.str();
+
+   FILE *f;
+   if ((f = fopen(tmpFile.c_str(), "w")) == NULL)
+   {
+      perror("fopen");
+      return -1;
+   }
+   if ((fwrite(contents.c_str(), 1, contents.size(), f) != contents.size()) || (fclose(f) != 0))
+   {
+      perror("fwrite");
+      unlink(tmpFile.c_str());
+      return -1;
+   }
+   if (rename(tmpFile.c_str(), file.c_str()) != 0)
+   {
+      perror("rename");
+      unlink(tmpFile.c_str());
+      return -1;
+   }
+   return 0;
+}
+
+
+/**
+ * Body of the thread that dumps the counters every dumpPeriod seconds.
+ */
+static void * DumpThreadMain(void *arg)
+{
+   pthread_mutex_lock(&dumpLock);
+   while (dumpRunning)
+   {
+      struct timespec deadline;
+      struct timeval  now;
+
+      gettimeofday(&now, NULL);
+      deadline.tv_sec  = now.tv_sec + dumpPeriod;
+      deadline.tv_nsec = now.tv_usec * 1000;
+      pthread_cond_timedwait(&dumpCond, &dumpLock, &deadline);
+      if (! dumpRunning) break;
+
+      pthread_mutex_unlock(&dumpLock);
+      DumpMetrics(dumpFile, dumpFormat, dumpProcess);
+      pthread_mutex_lock(&dumpLock);
+   }
+   pthread_mutex_unlock(&dumpLock);
+   return NULL;
+}
+
+
+/**
+ * Starts dumping the counters periodically.
+ * @param file    Path of the file, overwritten on every dump.
+ * @param format  METRICS_JSON or METRICS_PROMETHEUS.
+ * @param period  Seconds between dumps; 0 only dumps when StopMetricsDump is called.
+ * @param process Name of this process in the dump.
+ * @return 0 on success; -1 otherwise.
+ */
+int Synapse::StartMetricsDump(string file, MetricsFormat format, unsigned int period, string process)
+{
+   pthread_mutex_lock(&dumpLock);
+   if (dumpRunning)
+   {
+      pthread_mutex_unlock(&dumpLock);
+      return 0;
+   }
+   dumpFile    = file;
+   dumpFormat  = format;
+   dumpPeriod  = period;
+   dumpProcess = process;
+   dumpRunning = true;
+   pthread_mutex_unlock(&dumpLock);
+
+   if ((period > 0) && (pthread_create(&dumpThread, NULL, DumpThreadMain, NULL) != 0))
+   {
+      perror("pthread_create");
+      dumpPeriod = 0;
+      return -1;
+   }
+   return 0;
+}
+
+
+/**
+ * Stops the periodic dump, writing the counters one last time.
+ */
+void Synapse::StopMetricsDump(void)
+{
+   pthread_mutex_lock(&dumpLock);
+   if (! dumpRunning)
+   {
+      pthread_mutex_unlock(&dumpLock);
+      return;
+   }
+   dumpRunning = false;
+   pthread_cond_signal(&dumpCond);
+   pthread_mutex_unlock(&dumpLock);
+
+   if (dumpPeriod > 0) pthread_join(dumpThread, NULL);
+   DumpMetrics(dumpFile, dumpFormat, dumpProcess);
+}
+
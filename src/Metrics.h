@@ -0,0 +1,105 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+/* Outside the guard, so that including this header first still defines it after the MRNet types and before 
+   MRNet_typed.h, whose inline wrappers use the counters (MRNet_wrappers.h includes this header back) */
+#include "MRNet_wrappers.h"
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#define METRICS_MAX_STREAMS       1024 /* Slots of the per-stream table, streams are hashed by ID           */
+#define METRICS_HISTOGRAM_BUCKETS 25   /* Bucket i counts latencies under 2^i us (~16 s), plus an overflow */
+#define METRICS_DUMP_PERIOD       10   /* Default seconds between dumps (can be overriden with SYNAPSE_METRICS_PERIOD) */
+
+/* Counters are only updated when enabled, with relaxed atomic adds that do not order other memory accesses */
+#if defined(__ATOMIC_RELAXED)
+# define METRICS_ADD(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#else
+# define METRICS_ADD(counter, n) __sync_fetch_and_add(&(counter), (n))
+#endif
+
+/* Accounts a packet sent/received through a stream. The size is only evaluated when the metrics are enabled */
+#define METRICS_COUNT_SENT(stream, bytes)     { if (Synapse::metricsEnabled) Synapse::CountSent((stream), (bytes)); }
+#define METRICS_COUNT_RECEIVED(stream, bytes) { if (Synapse::metricsEnabled) Synapse::CountReceived((stream), (bytes)); }
+
+using std::string;
+
+namespace Synapse {
+
+/* Phases of a protocol run whose latencies are measured */
+typedef enum
+{
+   PHASE_SEND,    /* FE: broadcast of the dispatch request                  */
+   PHASE_RUN,     /* FE and BE: Run() of the protocol                       */
+   PHASE_ACK,     /* FE: reduction of the ACKs of the back-ends             */
+   PHASE_BARRIER, /* FE and BE: time blocked in the barriers of the protocol */
+   NUM_PHASES
+} MetricsPhase;
+
+typedef enum
+{
+   METRICS_JSON,
+   METRICS_PROMETHEUS
+} MetricsFormat;
+
+/* Latency histogram with power-of-2 buckets in microseconds */
+typedef struct
+{
+   uint64_t buckets[METRICS_HISTOGRAM_BUCKETS + 1];
+   uint64_t count;
+   uint64_t sumUs;
+} Histogram;
+
+/* Counters of a loaded protocol, allocated once when it is loaded and never freed */
+typedef struct
+{
+   string    protID;
+   uint64_t  dispatches;
+   uint64_t  errors;
+   Histogram latency[NUM_PHASES];
+} ProtocolMetrics;
+
+extern bool metricsEnabled;
+
+void              EnableMetrics   (bool enable=true);
+ProtocolMetrics * RegisterProtocolMetrics(unsigned int prot_idx, string prot_id);
+void              LabelStreamMetrics(STREAM *stream, string label);
+void              CountSent       (STREAM *stream, size_t bytes, unsigned int packets=1);
+void              CountReceived   (STREAM *stream, size_t bytes, unsigned int packets=1);
+void              CountDispatch   (ProtocolMetrics *metrics, bool failed);
+void              RecordLatency   (Histogram &histogram, struct timeval *since);
+void              RecordLatencyUs (Histogram &histogram, uint64_t usecs);
+void              RecordAttach    (double seconds);
+void              CountBackendLost(void);
+int               DumpMetrics     (string file, MetricsFormat format, string process);
+int               StartMetricsDump(string file, MetricsFormat format, unsigned int period, string process);
+void              StopMetricsDump (void);
+
+} /* namespace Synapse */
+
+#endif /* __METRICS_H__ */
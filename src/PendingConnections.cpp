@@ -21,26 +21,334 @@
 \*****************************************************************************/
 
 #include <vector>
+#include <map>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <sstream>
 #include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#if defined(__linux__)
+# include <sys/inotify.h>
+#endif
 #include "PendingConnections.h"
 
 using std::cerr;
 using std::cout;
 using std::endl;
 using std::vector;
+using std::map;
 using std::ifstream;
+using std::stringstream;
 using namespace Synapse;
 
+/**
+ * Constructor. The front-end writes the connections in text format, unless 
+ * the environment variable SYNAPSE_CONNECTIONS_FORMAT is set to "binary". 
+ * The back-ends detect the format when they read the file.
+ * @param ConnectionsFile The connections file.
+ */
 PendingConnections::PendingConnections(string ConnectionsFile)
 {
+  char *env_SYNAPSE_CONNECTIONS_FORMAT = getenv("SYNAPSE_CONNECTIONS_FORMAT");
+
   this->ConnectionsFile = ConnectionsFile;
+  this->Format          = CONNECTIONS_TEXT;
+  if ((env_SYNAPSE_CONNECTIONS_FORMAT != NULL) && (strcmp(env_SYNAPSE_CONNECTIONS_FORMAT, "binary") == 0))
+  {
+    this->Format = CONNECTIONS_BINARY;
+  }
+}
+
+/**
+ * Constructor that selects the format of the connections file written by the front-end.
+ * @param ConnectionsFile The connections file.
+ * @param format          CONNECTIONS_TEXT or CONNECTIONS_BINARY.
+ */
+PendingConnections::PendingConnections(string ConnectionsFile, ConnectionsFormat format)
+{
+  this->ConnectionsFile = ConnectionsFile;
+  this->Format          = format;
+}
+
+/**
+ * Waits for the front-end to publish the connections file. The wait sleeps on inotify events of the
+ * directory, so that a back-end in the same node as the front-end proceeds right when the file is 
+ * renamed into place. inotify does not see changes made from other nodes in shared filesystems, so 
+ * the wait also wakes up with a jittered exponential backoff, to recheck without all the back-ends 
+ * hitting the filesystem at once.
+ */
+class PublicationWaiter
+{
+  public:
+    PublicationWaiter(string file)
+    {
+      struct timeval now;
+      gettimeofday(&now, NULL);
+
+      Deadline  = now.tv_sec + PUBLICATION_TIMEOUT;
+      DelayMs   = PUBLICATION_MIN_DELAY_MS;
+      Seed      = (unsigned int)(getpid() ^ now.tv_usec);
+      WatchFd   = -1;
+      Announced = false;
+
+#if defined(__linux__)
+      char *path = strdup(file.c_str());
+      WatchFd = inotify_init();
+      if ((WatchFd != -1) && (inotify_add_watch(WatchFd, dirname(path), IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) == -1))
+      {
+        close(WatchFd);
+        WatchFd = -1;
+      }
+      free(path);
+#endif
+    }
+
+    ~PublicationWaiter()
+    {
+      if (WatchFd != -1) close(WatchFd);
+    }
+
+    /**
+     * Sleeps until the directory of the file changes or the next backoff step expires.
+     * @return true if the caller has to check the file again; false when the timeout expires.
+     */
+    bool Wait()
+    {
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      if (now.tv_sec >= Deadline) return false;
+
+      if (! Announced)
+      {
+        cerr << "Waiting for the front-end to publish the connections file..." << endl;
+        Announced = true;
+      }
+
+      /* Sleep between half and the full delay, so that the back-ends spread their retries */
+      int sleep_ms = DelayMs / 2 + rand_r(&Seed) % (DelayMs / 2 + 1);
+      if (WatchFd != -1)
+      {
+        struct pollfd pfd;
+        pfd.fd      = WatchFd;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+        if ((poll(&pfd, 1, sleep_ms) > 0) && (pfd.revents & POLLIN))
+        {
+          /* Drain the events, the caller checks the file anyway */
+          char events[4096];
+          if (read(WatchFd, events, sizeof(events)) == -1) perror("read");
+        }
+      }
+      else
+      {
+        usleep(sleep_ms * 1000);
+      }
+      DelayMs = (DelayMs * 2 > PUBLICATION_MAX_DELAY_MS ? PUBLICATION_MAX_DELAY_MS : DelayMs * 2);
+      return true;
+    }
+
+  private:
+    time_t       Deadline;
+    int          DelayMs;
+    unsigned int Seed;
+    int          WatchFd;
+    bool         Announced;
+};
+
+/**
+ * Writes the binary connections file: a header and one fixed-size record per back-end, so that 
+ * every back-end reads its own record at a known offset. The header goes last, so the back-ends 
+ * don't take a file that is still being written as valid.
+ * @param f       The connections file, opened for writing.
+ * @param records The record of every back-end, indexed by rank.
+ * @return 0 on success; -1 otherwise.
+ */
+static int WriteBinary(FILE *f, vector<ConnectionsRecord> &records)
+{
+  ConnectionsHeader header;
+
+  memset(&header, 0, sizeof(header));
+  if ((fseek(f, sizeof(header), SEEK_SET) != 0) ||
+      (fwrite(&records[0], sizeof(ConnectionsRecord), records.size(), f) != records.size()) ||
+      (fflush(f) != 0))
+  {
+    perror("fwrite");
+    return -1;
+  }
+
+  strncpy(header.magic, CONNECTIONS_MAGIC, sizeof(header.magic));
+  header.byteOrder  = CONNECTIONS_BYTE_ORDER;
+  header.numRecords = records.size();
+  header.recordSize = sizeof(ConnectionsRecord);
+  if ((fseek(f, 0, SEEK_SET) != 0) || (fwrite(&header, sizeof(header), 1, f) != 1))
+  {
+    perror("fwrite");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Reads and validates the header of a binary connections file.
+ * @param fd     The connections file.
+ * @param header Set to the header.
+ * @return 1 if the header is valid; 2 if the file is still being written; 0 if the file is not in binary format; -1 on error.
+ */
+static int ReadBinaryHeader(int fd, ConnectionsHeader &header)
+{
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+  {
+    return 0;
+  }
+  if (header.magic[0] == '\0')
+  {
+    /* The front-end is still writing the records */
+    return 2;
+  }
+  if (strncmp(header.magic, CONNECTIONS_MAGIC, sizeof(header.magic)) != 0)
+  {
+    return 0;
+  }
+  if ((header.byteOrder != CONNECTIONS_BYTE_ORDER) || (header.recordSize != sizeof(ConnectionsRecord)))
+  {
+    cerr << "PendingConnections: ERROR: binary connections file written by an incompatible front-end" << endl;
+    return -1;
+  }
+  return 1;
 }
 
 /**
- * Writes the pending connections to the specified file.
+ * Reads the record of the given back-end from a binary connections file.
+ * @param fd     The connections file.
+ * @param rank   Back-end rank.
+ * @param record Set to the record of the back-end.
+ * @return 1 if the record is read; 2 if the file is still being written; 0 if the file is not in binary format; -1 on error.
+ */
+static int ReadBinary(int fd, int rank, ConnectionsRecord &record)
+{
+  ConnectionsHeader header;
+  int rc = ReadBinaryHeader(fd, header);
+
+  if (rc != 1) return rc;
+
+  if ((rank < 0) || ((uint32_t)rank >= header.numRecords))
+  {
+    cerr << "PendingConnections: ERROR: back-end " << rank << " is not in the connections file (" 
+         << header.numRecords << " back-ends)" << endl;
+    return -1;
+  }
+  if (pread(fd, &record, sizeof(record), sizeof(header) + (off_t)rank * sizeof(record)) != sizeof(record))
+  {
+    return -1;
+  }
+  record.host[CONNECTIONS_HOST_LEN - 1] = '\0';
+  return 1;
+}
+
+/**
+ * Strips the domain from a host name, so that "node1.cluster" and "node1" match.
+ */
+static string ShortHostName(const string &host)
+{
+  return host.substr(0, host.find('.'));
+}
+
+/**
+ * Reads the host of every back-end from a file with one host name per line, in rank order.
+ * @param file    The back-ends hosts file.
+ * @param beHosts Set to the host of every back-end.
+ * @return 0 on success; -1 otherwise.
+ */
+static int ReadBackendHosts(const char *file, vector<string> &beHosts)
+{
+  ifstream ifs(file);
+  string   host;
+
+  if (! ifs.is_open())
+  {
+    cerr << "PendingConnections: ERROR: cannot open back-ends hosts file '" << file << "'" << endl;
+    return -1;
+  }
+  while (ifs >> host)
+  {
+    beHosts.push_back(host);
+  }
+  return 0;
+}
+
+/**
+ * Assigns the back-ends to the leaves of the tree. Every leaf gets numBackends / num_leaves back-ends, 
+ * and the remainder is spread one per leaf, so the fan-in of the leaves differs by one at most. 
+ * When the hosts of the back-ends are known, each back-end attaches to a leaf in its own host if that 
+ * one has room left, and the rest fill the remaining room in rank order.
+ * @param numBackends Number of back-ends.
+ * @param leafHosts   Host of every leaf.
+ * @param beHosts     Host of every back-end, in rank order (optional, empty if unknown).
+ * @param assignment  Set to the leaf index of every back-end.
+ */
+static void AssignBackends(unsigned int numBackends, vector<string> &leafHosts, vector<string> &beHosts, vector<unsigned int> &assignment)
+{
+  unsigned int num_leaves  = leafHosts.size();
+  unsigned int be_per_leaf = numBackends / num_leaves;
+  unsigned int remainder   = numBackends % num_leaves;
+  vector<unsigned int> room(num_leaves);
+
+  for (unsigned int l=0; l<num_leaves; l++)
+  {
+    room[l] = be_per_leaf + (l < remainder ? 1 : 0);
+  }
+  assignment.assign(numBackends, num_leaves);
+
+  if (beHosts.size() >= numBackends)
+  {
+    /* Leaves in every host */
+    map< string, vector<unsigned int> > leavesInHost;
+    for (unsigned int l=0; l<num_leaves; l++)
+    {
+      leavesInHost[ShortHostName(leafHosts[l])].push_back(l);
+    }
+
+    for (unsigned int i=0; i<numBackends; i++)
+    {
+      map< string, vector<unsigned int> >::iterator it = leavesInHost.find(ShortHostName(beHosts[i]));
+      if (it == leavesInHost.end()) continue;
+
+      for (unsigned int j=0; j<it->second.size(); j++)
+      {
+        unsigned int l = it->second[j];
+        if (room[l] > 0)
+        {
+          assignment[i] = l;
+          room[l] --;
+          break;
+        }
+      }
+    }
+  }
+
+  /* The rest of back-ends go to the first leaf with room, keeping consecutive ranks together */
+  unsigned int curr_leaf = 0;
+  for (unsigned int i=0; i<numBackends; i++)
+  {
+    if (assignment[i] != num_leaves) continue;
+
+    while (room[curr_leaf] == 0) curr_leaf ++;
+    assignment[i] = curr_leaf;
+    room[curr_leaf] --;
+  }
+}
+
+/**
+ * Writes the pending connections to the specified file. If the environment variable 
+ * SYNAPSE_BE_HOSTFILE points to a file with the host of every back-end (one per line, 
+ * in rank order), the back-ends attach to a leaf in their own host when possible.
  * @param net             The MRNet network object.
  * @param numBackends     Number of backends that have to connect.
  * @return 0 on success; -1 otherwise.
@@ -48,6 +356,29 @@ PendingConnections::PendingConnections(string ConnectionsFile)
 int PendingConnections::Write(
   NETWORK     *net,
   unsigned int numBackends)
+{
+  vector<ConnectionsRecord> records;
+
+  if (Assign(net, numBackends, records) != 0)
+  {
+    return -1;
+  }
+  return Write(records);
+}
+
+/**
+ * Computes where every back-end connects, attaching the back-ends to a leaf in their own host when possible.
+ * @param net             The MRNet network object.
+ * @param numBackends     Number of backends that have to connect.
+ * @param beHosts         Host of every back-end, in rank order (empty if unknown).
+ * @param records         Set to the parent of every back-end, indexed by rank.
+ * @return 0 on success; -1 otherwise.
+ */
+int PendingConnections::Assign(
+  NETWORK                   *net,
+  unsigned int               numBackends,
+  vector<string>            &beHosts,
+  vector<ConnectionsRecord> &records)
 {
   /* Query Network for topology object */
   NetworkTopology *netTopology = net->get_NetworkTopology();
@@ -55,56 +386,180 @@ int PendingConnections::Write(
   netTopology->get_Leaves(internalLeaves);
   netTopology->print(stdout);
 
+  if (internalLeaves.size() == 0)
+  {
+    cerr << "PendingConnections::Assign: ERROR: the topology has no leaves to attach the back-ends" << endl;
+    return -1;
+  }
+  if ((beHosts.size() > 0) && (beHosts.size() < numBackends))
+  {
+    cerr << "PendingConnections::Assign: WARNING: the hosts of " << numBackends - beHosts.size() 
+         << " back-ends are unknown, ignoring the host affinity" << endl;
+  }
+
+  vector<string>       leafHosts;
+  vector<unsigned int> assignment;
+  for (unsigned int l=0; l<internalLeaves.size(); l++)
+  {
+    leafHosts.push_back(internalLeaves[l]->get_HostName());
+  }
+  AssignBackends(numBackends, leafHosts, beHosts, assignment);
+
+  records.clear();
+  for(unsigned i=0; i < numBackends; i++)
+  {
+    NetworkTopology::Node *leaf = internalLeaves[assignment[i]];
+    ConnectionsRecord      rec;
+
+    cout << "BE " << i << " will connect to "
+         << leaf->get_HostName().c_str() << ":"
+         << leaf->get_Port()             << ":"
+         << leaf->get_Rank()             << endl;
+
+    memset(&rec, 0, sizeof(rec));
+    strncpy(rec.host, leaf->get_HostName().c_str(), CONNECTIONS_HOST_LEN - 1);
+    rec.port       = leaf->get_Port();
+    rec.parentRank = leaf->get_Rank();
+    records.push_back(rec);
+  }
+  return 0;
+}
+
+/**
+ * Wrapper for Assign(NETWORK *, unsigned int, vector<string> &, vector<ConnectionsRecord> &) that reads
+ * the hosts of the back-ends from the file in SYNAPSE_BE_HOSTFILE, if defined.
+ * @param net             The MRNet network object.
+ * @param numBackends     Number of backends that have to connect.
+ * @param records         Set to the parent of every back-end, indexed by rank.
+ * @return 0 on success; -1 otherwise.
+ */
+int PendingConnections::Assign(
+  NETWORK                   *net,
+  unsigned int               numBackends,
+  vector<ConnectionsRecord> &records)
+{
+  vector<string> beHosts;
+
+  char *env_SYNAPSE_BE_HOSTFILE = getenv("SYNAPSE_BE_HOSTFILE");
+  if ((env_SYNAPSE_BE_HOSTFILE != NULL) && (ReadBackendHosts(env_SYNAPSE_BE_HOSTFILE, beHosts) != 0))
+  {
+    return -1;
+  }
+  return Assign(net, numBackends, beHosts, records);
+}
+
+/**
+ * Writes the pending connections to the specified file, attaching the back-ends to a leaf 
+ * in their own host when possible.
+ * @param net             The MRNet network object.
+ * @param numBackends     Number of backends that have to connect.
+ * @param beHosts         Host of every back-end, in rank order (empty if unknown).
+ * @return 0 on success; -1 otherwise.
+ */
+int PendingConnections::Write(
+  NETWORK        *net,
+  unsigned int    numBackends,
+  vector<string> &beHosts)
+{
+  vector<ConnectionsRecord> records;
+
+  if (Assign(net, numBackends, beHosts, records) != 0)
+  {
+    return -1;
+  }
+  return Write(records);
+}
+
+/**
+ * Writes the given connections to the specified file.
+ * @param records The parent of every back-end, indexed by rank.
+ * @return 0 on success; -1 otherwise.
+ */
+int PendingConnections::Write(vector<ConnectionsRecord> &records)
+{
+  /* Write to a temporary file in the same directory and rename it when complete, 
+     so the back-ends never read a partial file */
+  stringstream ss;
+  ss << ConnectionsFile << ".tmp." << getpid();
+  string tmpFile = ss.str();
+
   FILE *f;
-  if ( (f = fopen(ConnectionsFile.c_str(), (const char *)"w+")) == NULL )
+  if ( (f = fopen(tmpFile.c_str(), (const char *)"w+")) == NULL )
   {
     perror("fopen");
     return -1;
   }
 
-  unsigned num_leaves  = internalLeaves.size();
-  unsigned be_per_leaf = numBackends / num_leaves;
-  unsigned curr_leaf   = 0;
-  for(unsigned i=0; (i < numBackends) && (curr_leaf < num_leaves); i++)
+  if (Format == CONNECTIONS_BINARY)
   {
-    if( i && (i % be_per_leaf == 0) )
+    if ((records.size() > 0) && (WriteBinary(f, records) != 0))
     {
-      // select next parent
-      curr_leaf++;
-      if( curr_leaf == num_leaves )
-      {
-        // except when there is no "next"
-        curr_leaf--;
-      }
+      fclose(f);
+      unlink(tmpFile.c_str());
+      return -1;
     }
-    cout << "BE " << i << " will connect to "
-         << internalLeaves[curr_leaf]->get_HostName().c_str() << ":"
-         << internalLeaves[curr_leaf]->get_Port()             << ":"
-         << internalLeaves[curr_leaf]->get_Rank()             << endl;
-       
-    fprintf(f, "%s %d %d %d\n",
-            internalLeaves[curr_leaf]->get_HostName().c_str(),
-            internalLeaves[curr_leaf]->get_Port(),
-            internalLeaves[curr_leaf]->get_Rank(),
-            i);
-  }
-  fclose(f);
+  }
+  else
+  {
+    for(unsigned i=0; i < records.size(); i++)
+    {
+      fprintf(f, "%s %d %d %d\n",
+              records[i].host,
+              records[i].port,
+              records[i].parentRank,
+              i);
+    }
+  }
+  if ((fflush(f) != 0) || (fsync(fileno(f)) != 0) || (fclose(f) != 0))
+  {
+    perror("fclose");
+    unlink(tmpFile.c_str());
+    return -1;
+  }
+  if (rename(tmpFile.c_str(), ConnectionsFile.c_str()) != 0)
+  {
+    perror("rename");
+    unlink(tmpFile.c_str());
+    return -1;
+  }
   return 0;
 }
            
 /**
  * Retrieves host, port and rank where a given backend connects from the connections file.
+ * Binary files are detected by their header, and only the record of this back-end is read.
  * @param rank Backend rank.
  * @return Host, port and rank where this backend will connect and 0 on success; -1 otherwise.
  */
 int PendingConnections::GetParentInfo( int rank, char *phost, char *pport, char *prank )
 {
-  int keep_retrying = MAX_PARSE_RETRIES;
+  PublicationWaiter waiter(ConnectionsFile);
 
-  while (keep_retrying > 0)
+  do
   {
+    int rc = 0;
+    int fd = open(ConnectionsFile.c_str(), O_RDONLY);
+    if (fd != -1)
+    {
+      ConnectionsRecord record;
+      rc = ReadBinary(fd, rank, record);
+      close(fd);
+
+      if (rc == 1)
+      {
+        sprintf(phost, "%s", record.host);
+        sprintf(pport, "%d", record.port);
+        sprintf(prank, "%d", record.parentRank);
+        return 0;
+      }
+      else if (rc == -1)
+      {
+        return -1;
+      }
+    }
+
     ifstream ifs(ConnectionsFile.c_str());
-    if( ifs.is_open() )
+    if( (rc == 0) && (ifs.is_open()) )
     {
       while( ifs.good() )
       {
@@ -130,12 +585,10 @@ int PendingConnections::GetParentInfo( int rank, char *phost, char *pport, char
       }
       ifs.close();
     }
-    cerr << "PendingConnections::GetParentInfo: ERROR: retrieving parent information for back-end " << rank << "." << endl;
-    cerr << "Did the front-end finish writing the connections file? Retrying in " << IDLE_BETWEEN_TRIES << " second(s)..." << endl;
-    sleep(IDLE_BETWEEN_TRIES);
-    keep_retrying --;
-  }
+  } while (waiter.Wait());
+
   // my rank not found :(
+  cerr << "PendingConnections::GetParentInfo: ERROR: retrieving parent information for back-end " << rank << "." << endl;
   return -1;
 }
 
@@ -152,74 +605,178 @@ int PendingConnections::GetParentInfo( int rank, char *phost, char *pport, char
  */
 int PendingConnections::ParseForMPIDistribution(int world_size, char *&sendbuf, int *&sendcnts, int *&displs)
 {
-  int keep_retrying = MAX_PARSE_RETRIES;
+  PublicationWaiter waiter(ConnectionsFile);
 
-  while(keep_retrying > 0)
+  do
   {
     int rbytes = 0;
     int offset = 0, ntasks = 0;
-    string line;
-    ifstream fd;
 
-    fd.open(ConnectionsFile.c_str());
-
-    if (fd == NULL)
+    /* Binary connections file, convert the records into the same lines as the text format */
+    int bfd = open(ConnectionsFile.c_str(), O_RDONLY);
+    if (bfd != -1)
     {
-      cerr << "PendingConnections::ParseForMPIDistribution: ERROR: opening connections file '" << ConnectionsFile << " '" << endl;
+      ConnectionsHeader header;
+      int rc = ReadBinaryHeader(bfd, header);
+      if ((rc == 1) && (header.numRecords != (uint32_t)world_size))
+      {
+        cerr << "PendingConnections::ParseForMPIDistribution: ERROR: unexpected number of tasks in connections file '"
+             << ConnectionsFile << "' (found " << header.numRecords << " task(s), " << world_size << " expected)" << endl;
+        rc = 2;
+      }
+      if (rc == 1)
+      {
+        vector<ConnectionsRecord> records(world_size);
+        size_t bytes = world_size * sizeof(ConnectionsRecord);
+        if (pread(bfd, &records[0], bytes, sizeof(header)) != (ssize_t)bytes)
+        {
+          rc = -1;
+        }
+        else
+        {
+          char line[CONNECTIONS_HOST_LEN + 40];
+          sendbuf  = (char *)malloc(world_size * sizeof(line));
+          sendcnts = (int *)malloc(world_size * sizeof(int));
+          displs   = (int *)malloc(world_size * sizeof(int));
+          for (int i=0; i<world_size; i++)
+          {
+            records[i].host[CONNECTIONS_HOST_LEN - 1] = '\0';
+            rbytes = snprintf(line, sizeof(line), "%s %d %d %d", records[i].host, records[i].port, records[i].parentRank, i);
+            strcpy(&(sendbuf[offset]), line);
+            sendcnts[i] = rbytes + 1;
+            displs[i]   = offset;
+            offset     += rbytes + 1;
+          }
+        }
+      }
+      close(bfd);
+
+      if (rc == 1) return 0;
+      if (rc == -1) return -1;
+      if (rc == 2) continue;
     }
     else
     {
-      sendcnts = (int *)malloc(world_size * sizeof(int));
-      bzero(sendcnts, world_size * sizeof(int));
-      displs   = (int *)malloc(world_size * sizeof(int));
-      bzero(displs, world_size * sizeof(int));
-
-      /* Read connections file line by line */
-      while (getline(fd, line))
-      {
-        rbytes = line.size();
+      /* Not published yet */
+      continue;
+    }
 
-        /* Store the lines in a memory-consecutive buffer */
-        sendbuf = (char *)realloc(sendbuf, offset+rbytes+1);
-        strcpy(&(sendbuf[offset]), line.c_str());
+    /* Text connections file, read it whole in a single allocation. The lines are split in place, 
+       so sendbuf is the file contents with the line breaks replaced by '\0' */
+    int tfd = open(ConnectionsFile.c_str(), O_RDONLY);
+    struct stat st;
+    if ((tfd == -1) || (fstat(tfd, &st) == -1))
+    {
+      cerr << "PendingConnections::ParseForMPIDistribution: ERROR: opening connections file '" << ConnectionsFile << " '" << endl;
+      if (tfd != -1) close(tfd);
+      continue;
+    }
 
-        /* Store the length and offset of every line */
-        sendcnts[ntasks] = rbytes + 1; /* strlen(line) + '\0' */
-        displs[ntasks]   = offset;
+    sendbuf = (char *)malloc(st.st_size + 1);
+    ssize_t size = 0, n = 0;
+    while ((size < st.st_size) && ((n = read(tfd, sendbuf + size, st.st_size - size)) > 0)) size += n;
+    close(tfd);
+    sendbuf[size] = '\0';
 
-        /* DEBUG
-        fprintf(stderr, "sendcnts=%d displs=%d data=%s", 
-          sendcnts[ntasks], 
-          displs[ntasks], 
-          &sendbuf[offset]); */
+    sendcnts = (int *)malloc(world_size * sizeof(int));
+    displs   = (int *)malloc(world_size * sizeof(int));
 
-        offset += rbytes+1;
-        ntasks ++;
-      }
-      fd.close();
+    /* Single pass to store the length and offset of every line */
+    for (ssize_t i=0; i<size; i++)
+    {
+      if (sendbuf[i] != '\n') continue;
 
-      /* Check there's the same number of MPI tasks than BE's */
-      if (ntasks == world_size) 
+      sendbuf[i] = '\0';
+      if (ntasks < world_size)
       {
-        /* All data was parsed ok, exit normally */
-        return 0;
+        sendcnts[ntasks] = i - offset + 1; /* strlen(line) + '\0' */
+        displs[ntasks]   = offset;
       }
-      else
+      offset = i + 1;
+      ntasks ++;
+    }
+    if (offset < size)
+    {
+      /* Last line without line break */
+      if (ntasks < world_size)
       {
-        cerr << "PendingConnections::ParseForMPIDistribution: ERROR: unexpected number of tasks in connections file '"
-             << ConnectionsFile << "' (found " << ntasks << " task(s), " << world_size << " expected)" << endl;
-        free(sendbuf);
-        free(sendcnts);
-        free(displs);
-        sendbuf  = NULL;
-        sendcnts = NULL;
-        displs   = NULL;
+        sendcnts[ntasks] = size - offset + 1;
+        displs[ntasks]   = offset;
       }
+      ntasks ++;
     }
-    cerr << "Did the front-end finish writing the connections file? Retrying in " << IDLE_BETWEEN_TRIES << " second(s)..." << endl;
-    sleep(IDLE_BETWEEN_TRIES);
-    keep_retrying --;
-  }
+
+    /* Check there's the same number of MPI tasks than BE's */
+    if (ntasks == world_size) 
+    {
+      /* All data was parsed ok, exit normally */
+      return 0;
+    }
+
+    cerr << "PendingConnections::ParseForMPIDistribution: ERROR: unexpected number of tasks in connections file '"
+         << ConnectionsFile << "' (found " << ntasks << " task(s), " << world_size << " expected)" << endl;
+    free(sendbuf);
+    free(sendcnts);
+    free(displs);
+    sendbuf  = NULL;
+    sendcnts = NULL;
+    displs   = NULL;
+  } while (waiter.Wait());
+
+  cerr << "PendingConnections::ParseForMPIDistribution: ERROR: the connections file '" << ConnectionsFile << "' was not published in time" << endl;
   return -1;
 }
 
+
+#if defined(SYNAPSE_MPI)
+/**
+ * Distributes the connections file among the back-ends of an MPI program: the task with rank 0 
+ * reads the file (see ParseForMPIDistribution) and scatters every line to its task, so only one 
+ * process touches the filesystem. Has to be called by all the tasks in the communicator.
+ * @param comm  The communicator of the back-ends, their rank in it is their back-end rank.
+ * @param phost Set to the host of the parent of this back-end.
+ * @param pport Set to the port of the parent.
+ * @param prank Set to the rank of the parent.
+ * @return 0 on success; -1 otherwise (in all the tasks).
+ */
+int PendingConnections::ScatterParentInfo(MPI_Comm comm, char *phost, char *pport, char *prank)
+{
+  int   rank, size, recvcnt = 0, parsed = 0;
+  char *sendbuf  = NULL;
+  int  *sendcnts = NULL;
+  int  *displs   = NULL;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  if (rank == 0)
+  {
+    parsed = (ParseForMPIDistribution(size, sendbuf, sendcnts, displs) == 0 ? 1 : 0);
+  }
+  MPI_Bcast(&parsed, 1, MPI_INT, 0, comm);
+  if (! parsed) return -1;
+
+  MPI_Scatter(sendcnts, 1, MPI_INT, &recvcnt, 1, MPI_INT, 0, comm);
+  vector<char> line(recvcnt);
+  MPI_Scatterv(sendbuf, sendcnts, displs, MPI_CHAR, &line[0], recvcnt, MPI_CHAR, 0, comm);
+
+  if (rank == 0)
+  {
+    free(sendbuf);
+    free(sendcnts);
+    free(displs);
+  }
+
+  char pname[CONNECTIONS_HOST_LEN];
+  int  tpport, tprank, trank;
+  if ((sscanf(&line[0], "%63s %d %d %d", pname, &tpport, &tprank, &trank) != 4) || (trank != rank))
+  {
+    cerr << "PendingConnections::ScatterParentInfo: ERROR: wrong connection information for back-end " << rank << ": '" << &line[0] << "'" << endl;
+    return -1;
+  }
+  sprintf(phost, "%s", pname);
+  sprintf(pport, "%d", tpport);
+  sprintf(prank, "%d", tprank);
+  return 0;
+}
+#endif
@@ -24,29 +24,77 @@
 #define __PENDING_CONNECTIONS_H__
 
 #include <string>
+#include <vector>
+#include <stdint.h>
 #include "MRNet_wrappers.h"
+#if defined(SYNAPSE_MPI)
+# include <mpi.h>
+#endif
 
 #define MAX_PARSE_RETRIES  100
 #define IDLE_BETWEEN_TRIES 10
 
+#define PUBLICATION_TIMEOUT      (MAX_PARSE_RETRIES * IDLE_BETWEEN_TRIES) /* Seconds the back-ends wait for the connections file */
+#define PUBLICATION_MIN_DELAY_MS 10   /* Backoff bounds between checks of the connections file */
+#define PUBLICATION_MAX_DELAY_MS 2000
+
+#define CONNECTIONS_MAGIC      "SYNCONX" /* First 8 bytes of the binary connections file */
+#define CONNECTIONS_BYTE_ORDER 0x01020304
+#define CONNECTIONS_HOST_LEN   64
+
 using std::string;
+using std::vector;
 
 namespace Synapse {
 
+typedef enum
+{
+  CONNECTIONS_TEXT,  /* One "host port parent_rank be_rank" line per back-end */
+  CONNECTIONS_BINARY /* Header followed by one fixed-size record per back-end, indexed by rank */
+} ConnectionsFormat;
+
+/* Header of the binary connections file. It is written last, so that a valid magic means the file is complete */
+typedef struct
+{
+  char     magic[8];
+  uint32_t byteOrder;
+  uint32_t numRecords;
+  uint32_t recordSize;
+  uint32_t reserved;
+} ConnectionsHeader;
+
+/* Record of back-end rank i, stored at offset sizeof(ConnectionsHeader) + i * sizeof(ConnectionsRecord) */
+typedef struct
+{
+  char     host[CONNECTIONS_HOST_LEN];
+  int32_t  port;
+  int32_t  parentRank;
+} ConnectionsRecord;
+
 class PendingConnections
 {
   public:
     PendingConnections(string ConnectionsFile);
+    PendingConnections(string ConnectionsFile, ConnectionsFormat format);
  
     /* Front-end API */
     int Write(NETWORK *net, unsigned int numBackends);
+    int Write(NETWORK *net, unsigned int numBackends, vector<string> &beHosts);
+    int Write(vector<ConnectionsRecord> &records);
+
+    static int Assign(NETWORK *net, unsigned int numBackends, vector<ConnectionsRecord> &records);
+    static int Assign(NETWORK *net, unsigned int numBackends, vector<string> &beHosts, vector<ConnectionsRecord> &records);
 
     /* Back-end API */
     int GetParentInfo( int rank, char *phost, char *pport, char *prank );
     int ParseForMPIDistribution(int world_size, char *&sendbuf, int *&sendcnts, int *&displs);
+#if defined(SYNAPSE_MPI)
+    int ScatterParentInfo(MPI_Comm comm, char *phost, char *pport, char *prank);
+#endif
 
   private:
-    string ConnectionsFile;
+    string            ConnectionsFile;
+    ConnectionsFormat Format;
 };
 
 } /* namespace Synapse */
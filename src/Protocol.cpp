@@ -20,14 +20,45 @@
  *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
 \*****************************************************************************/
 
+#include <stdlib.h>
 #include "Protocol.h"
 #include "MRNetApp.h"
+#include "Compression.h"
 
 using namespace Synapse;
 
 Protocol::Protocol()
 {
-   mrnApp = NULL;
+   mrnApp       = NULL;
+   protIndex    = 0;
+   streamsReady = false;
+   quietBarrier = false;
+   stBarrierMin = stBarrierMax = stBarrierSum = NULL;
+   chunkSize    = CHUNK_SIZE;
+   chunkWindow  = CHUNK_WINDOW;
+   compressionThreshold = COMPRESSION_THRESHOLD;
+   metrics      = NULL;
+
+   char *env_SYNAPSE_BARRIER_QUIET = getenv("SYNAPSE_BARRIER_QUIET");
+   if ((env_SYNAPSE_BARRIER_QUIET != NULL) && (atoi(env_SYNAPSE_BARRIER_QUIET) != 0))
+   {
+      quietBarrier = true;
+   }
+   char *env_SYNAPSE_CHUNK_SIZE = getenv("SYNAPSE_CHUNK_SIZE");
+   if ((env_SYNAPSE_CHUNK_SIZE != NULL) && (atoi(env_SYNAPSE_CHUNK_SIZE) > 0))
+   {
+      chunkSize = atoi(env_SYNAPSE_CHUNK_SIZE);
+   }
+   char *env_SYNAPSE_CHUNK_WINDOW = getenv("SYNAPSE_CHUNK_WINDOW");
+   if ((env_SYNAPSE_CHUNK_WINDOW != NULL) && (atoi(env_SYNAPSE_CHUNK_WINDOW) > 0))
+   {
+      chunkWindow = atoi(env_SYNAPSE_CHUNK_WINDOW);
+   }
+   char *env_SYNAPSE_COMPRESSION_THRESHOLD = getenv("SYNAPSE_COMPRESSION_THRESHOLD");
+   if ((env_SYNAPSE_COMPRESSION_THRESHOLD != NULL) && (atoi(env_SYNAPSE_COMPRESSION_THRESHOLD) >= 0))
+   {
+      compressionThreshold = atoi(env_SYNAPSE_COMPRESSION_THRESHOLD);
+   }
 }
 
 /**
@@ -59,3 +90,128 @@ NETWORK * Protocol::GetNetwork()
    return mrnApp->GetNetwork();
 }
 
+
+
+/**
+ * Returns the numeric identifier of the protocol, assigned in load order.
+ * @return the protocol index.
+ */
+unsigned int Protocol::Index()
+{
+   return protIndex;
+}
+
+
+/**
+ * Sets the numeric identifier of the protocol, allocates its counters and names it in the traces. 
+ * Called from MRNetApp::LoadProtocol.
+ * @param idx The protocol index.
+ */
+void Protocol::SetIndex(unsigned int idx)
+{
+   protIndex = idx;
+   metrics   = RegisterProtocolMetrics(idx, ID());
+   TraceProtocolName(idx, ID());
+}
+
+
+/**
+ * Returns the counters of the protocol (see Metrics.h).
+ * @return the counters; NULL if the protocol is not loaded.
+ */
+ProtocolMetrics * Protocol::GetMetrics(void)
+{
+   return metrics;
+}
+
+
+/**
+ * Adds the time elapsed since the given moment to the latency histogram of a phase of the 
+ * protocol. Does nothing unless the metrics are enabled.
+ * @param phase The phase that is measured.
+ * @param since When the phase started.
+ */
+void Protocol::RecordPhase(MetricsPhase phase, struct timeval *since)
+{
+   if ((metricsEnabled) && (metrics != NULL)) RecordLatency(metrics->latency[phase], since);
+}
+
+
+/**
+ * Tells whether the streams of the protocol are already set up. Protocols loaded in lazy
+ * mode set up their streams upon the first dispatch.
+ * @return true if the streams are set up; false otherwise.
+ */
+bool Protocol::StreamsReady()
+{
+   return streamsReady;
+}
+
+
+/**
+ * Silences the progress messages that the front-end prints on every barrier. Errors are still reported.
+ * @param quiet True to silence the barrier.
+ */
+void Protocol::SetQuietBarrier(bool quiet)
+{
+   quietBarrier = quiet;
+}
+
+
+/**
+ * Sets how StreamLarge splits the buffers. Only the sender's settings matter, the receivers 
+ * learn them from the chunks.
+ * @param chunk_size Bytes per chunk.
+ * @param window     Chunks that can be in flight towards every receiver, which bounds the 
+ *                   memory the transfer takes in every process of the tree.
+ */
+void Protocol::SetChunking(size_t chunk_size, unsigned int window)
+{
+   if (chunk_size > 0) chunkSize   = chunk_size;
+   if (window > 0)     chunkWindow = window;
+}
+
+
+/**
+ * Sets the size below which the payloads of the streams registered afterwards with 
+ * Register_CompressedStream are sent uncompressed. Only the sender's setting matters,
+ * every payload says whether it is compressed.
+ * @param threshold Bytes (0 compresses every payload).
+ */
+void Protocol::SetCompressionThreshold(size_t threshold)
+{
+   compressionThreshold = threshold;
+}
+
+
+/**
+ * Returns in how many chunks a buffer is split.
+ * @param total     Size of the buffer.
+ * @param chunk_len Size of the first chunk.
+ * @return the number of chunks (at least 1, empty buffers are sent as an empty chunk).
+ */
+unsigned int Protocol::ChunkCount(uint64_t total, uint32_t chunk_len)
+{
+   if ((total == 0) || (chunk_len == 0)) return 1;
+   return (total + chunk_len - 1) / chunk_len;
+}
+
+
+/**
+ * Decides whether the receiver of a chunked transfer gives more credits to the sender. The sender 
+ * starts with 'window' credits, and gets half a window more every time the receiver consumes that 
+ * many chunks, until it has credits for all of them.
+ * @param consumed   Chunks received so far.
+ * @param granted    Credits given so far, besides the initial window.
+ * @param window     The window of the transfer.
+ * @param num_chunks Total chunks of the transfer.
+ * @return the credits to give now, or 0.
+ */
+unsigned int Protocol::CreditsToGrant(unsigned int consumed, unsigned int granted, unsigned int window, unsigned int num_chunks)
+{
+   unsigned int batch = (window > 1 ? window / 2 : 1);
+
+   if ((window + granted >= num_chunks) || (consumed < granted + batch)) return 0;
+   return (num_chunks - window - granted < batch ? num_chunks - window - granted : batch);
+}
+
@@ -25,8 +25,16 @@
 
 #include <queue>
 #include <string>
+#include <stdint.h>
+#include <sys/time.h>
 #include "MRNet_wrappers.h"
 
+#define CHUNK_SIZE   65536 /* Default bytes per chunk in StreamLarge (can be overriden with SYNAPSE_CHUNK_SIZE) */
+#define CHUNK_WINDOW 8     /* Default chunks in flight per back-end (can be overriden with SYNAPSE_CHUNK_WINDOW) */
+#define CHUNK_POLL   1000  /* Milliseconds between the checks for lost back-ends while the front-end waits for chunks or credits */
+
+#define CHUNK_CREDITS_ALL 0xFFFFFFFF /* Credits given by a receiver that gives up a transfer, so that the sender does not wait for it */
+
 using std::queue;
 using std::string;
 
@@ -50,6 +58,18 @@ class Protocol
       unsigned int WhoAmI(bool return_network_id=false);
       unsigned int NumBackEnds();
       NETWORK * GetNetwork();
+      unsigned int Index(void);
+      void         SetIndex(unsigned int idx);
+      bool         StreamsReady(void);
+      void         SetQuietBarrier(bool quiet=true);
+      void         SetChunking(size_t chunk_size, unsigned int window);
+      void         SetCompressionThreshold(size_t threshold);
+      ProtocolMetrics * GetMetrics(void);
+      void         RecordPhase(MetricsPhase phase, struct timeval *since);
+
+      /* Flow control of StreamLarge/ReceiveLarge */
+      static unsigned int ChunkCount(uint64_t total, uint32_t chunk_len);
+      static unsigned int CreditsToGrant(unsigned int consumed, unsigned int granted, unsigned int window, unsigned int num_chunks);
 
    protected:
       /* Stores the streams that are created in Setup() using Register_Stream. All streams in this queue
@@ -58,6 +78,22 @@ class Protocol
       queue<STREAM *> registeredStreams;
 
       MRNetApp *mrnApp;
+
+      unsigned int protIndex;    /* Numeric ID assigned when the protocol is loaded */
+      bool         streamsReady; /* Set once the streams are registered and announced (see SetupStreams) */
+      bool         quietBarrier; /* Do not report the barrier progress (SetQuietBarrier or SYNAPSE_BARRIER_QUIET) */
+
+      /* Streams that reduce the time the back-ends wait in the barrier, NULL unless EnableTimedBarrier() is called in Setup() */
+      STREAM *stBarrierMin;
+      STREAM *stBarrierMax;
+      STREAM *stBarrierSum;
+
+      size_t       chunkSize;   /* Bytes per chunk sent by StreamLarge                    */
+      unsigned int chunkWindow; /* Chunks that can be in flight towards every receiver */
+
+      size_t compressionThreshold; /* Payloads below this size are not compressed in the streams from Register_CompressedStream */
+
+      ProtocolMetrics *metrics; /* Dispatch counters and phase latencies, allocated when the protocol is loaded */
 };
 
 } /* namespace Synapse */
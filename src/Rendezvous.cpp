@@ -0,0 +1,423 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#include <iostream>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "Rendezvous.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using namespace Synapse;
+
+/* Answer to a rendezvous request, integers in network byte order */
+struct Synapse::RendezvousReply
+{
+  uint32_t status;     /* 0 if found; 1 if the rank is unknown */
+  uint32_t port;
+  uint32_t parentRank;
+  char     host[CONNECTIONS_HOST_LEN];
+};
+
+/* A back-end connection that the server is answering */
+typedef struct
+{
+  int             fd;
+  bool            replying; /* false while reading the rank, true while writing the reply */
+  size_t          done;     /* Bytes of the rank read, or of the reply written            */
+  uint32_t        rank;
+  RendezvousReply reply;
+  struct timeval  deadline; /* The connection is dropped if the exchange is not done by then */
+} RendezvousClient;
+
+
+/**
+ * Returns the milliseconds left until the deadline, 0 if it already passed.
+ */
+static int MsUntil(struct timeval &deadline, struct timeval &now)
+{
+  long ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_usec - now.tv_usec) / 1000;
+  return (ms > 0 ? (int)ms : 0);
+}
+
+
+/**
+ * Reads the next chunk of the rank or writes the next chunk of the reply, without blocking.
+ * @return 1 when the exchange is completed or the connection failed, so it has to be closed; 0 otherwise.
+ */
+static int Progress(RendezvousClient &client)
+{
+  char   *buf = (client.replying ? (char *)&client.reply : (char *)&client.rank);
+  size_t  len = (client.replying ? sizeof(client.reply) : sizeof(client.rank));
+  ssize_t n   = (client.replying ? write(client.fd, buf + client.done, len - client.done)
+                                 : read (client.fd, buf + client.done, len - client.done));
+
+  if (n == -1) return (((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : 1);
+  if (n == 0)  return 1;
+
+  client.done += n;
+  return ((client.replying && (client.done == len)) ? 1 : 0);
+}
+
+
+/**
+ * Reads or writes exactly len bytes, waiting at most timeout_ms for each chunk.
+ * @return 0 on success; -1 otherwise.
+ */
+static int TransferAll(int fd, char *buf, size_t len, bool do_write, int timeout_ms)
+{
+  while (len > 0)
+  {
+    struct pollfd pfd;
+    pfd.fd      = fd;
+    pfd.events  = (do_write ? POLLOUT : POLLIN);
+    pfd.revents = 0;
+
+    int rc = poll(&pfd, 1, timeout_ms);
+    if ((rc == -1) && (errno == EINTR)) continue;
+    if (rc <= 0) return -1;
+
+    ssize_t n = (do_write ? write(fd, buf, len) : read(fd, buf, len));
+    if ((n == -1) && (errno == EINTR)) continue;
+    if (n <= 0) return -1;
+
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+RendezvousServer::RendezvousServer()
+{
+  ListenFd    = -1;
+  WakePipe[0] = -1;
+  WakePipe[1] = -1;
+  Port        = -1;
+  Running     = false;
+}
+
+RendezvousServer::~RendezvousServer()
+{
+  Stop();
+}
+
+
+/**
+ * Starts listening for the back-ends in a separate thread.
+ * @param port    TCP port to listen on, or 0 to pick any free port (see GetPort).
+ * @param records The parent of every back-end, indexed by rank (see PendingConnections::Assign).
+ * @return 0 on success; -1 otherwise.
+ */
+int RendezvousServer::Start(int port, vector<ConnectionsRecord> &records)
+{
+  struct sockaddr_in addr;
+  socklen_t          addr_len = sizeof(addr);
+  int                one = 1;
+
+  if (Running) return -1;
+
+  Records  = records;
+  ListenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (ListenFd == -1)
+  {
+    perror("socket");
+    return -1;
+  }
+  setsockopt(ListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port        = htons(port);
+
+  if ((bind(ListenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+      (listen(ListenFd, SOMAXCONN) == -1) ||
+      (getsockname(ListenFd, (struct sockaddr *)&addr, &addr_len) == -1) ||
+      (pipe(WakePipe) == -1))
+  {
+    cerr << "RendezvousServer::Start: ERROR: cannot listen on port " << port << ": " << strerror(errno) << endl;
+    close(ListenFd);
+    ListenFd = -1;
+    return -1;
+  }
+  Port = ntohs(addr.sin_port);
+
+  if (pthread_create(&ServerThread, NULL, ServerMain, this) != 0)
+  {
+    cerr << "RendezvousServer::Start: ERROR: cannot create the server thread" << endl;
+    close(ListenFd);
+    close(WakePipe[0]);
+    close(WakePipe[1]);
+    ListenFd = -1;
+    return -1;
+  }
+  Running = true;
+  return 0;
+}
+
+
+/**
+ * Returns the port the server listens on.
+ * @return the TCP port; -1 if the server is not running.
+ */
+int RendezvousServer::GetPort()
+{
+  return (Running ? Port : -1);
+}
+
+
+/**
+ * Stops the server thread and closes the listening socket.
+ */
+void RendezvousServer::Stop()
+{
+  if (! Running) return;
+
+  if (write(WakePipe[1], "x", 1) == -1) perror("write");
+  pthread_join(ServerThread, NULL);
+
+  close(ListenFd);
+  close(WakePipe[0]);
+  close(WakePipe[1]);
+  ListenFd = -1;
+  Running  = false;
+}
+
+
+void * RendezvousServer::ServerMain(void *arg)
+{
+  ((RendezvousServer *)arg)->Serve();
+  return NULL;
+}
+
+
+/**
+ * Serves the back-ends until Stop() is called. The connections are non-blocking and multiplexed 
+ * with poll, so a slow or stalled back-end only delays itself, and is dropped after 
+ * RENDEZVOUS_CLIENT_TIMEOUT seconds (it retries, see RendezvousQuery).
+ */
+void RendezvousServer::Serve()
+{
+  vector<RendezvousClient> clients;
+  vector<struct pollfd>    fds;
+  bool                     accepting = true; /* Paused while out of file descriptors */
+  struct timeval           now;
+
+  fcntl(ListenFd, F_SETFL, fcntl(ListenFd, F_GETFL) | O_NONBLOCK);
+
+  while (1)
+  {
+    int timeout_ms = -1;
+
+    gettimeofday(&now, NULL);
+    fds.resize(2 + clients.size());
+    fds[0].fd      = ListenFd;
+    fds[0].events  = (accepting ? POLLIN : 0);
+    fds[0].revents = 0;
+    fds[1].fd      = WakePipe[0];
+    fds[1].events  = POLLIN;
+    fds[1].revents = 0;
+    for (unsigned int i=0; i<clients.size(); i++)
+    {
+      int remaining = MsUntil(clients[i].deadline, now);
+      if ((timeout_ms == -1) || (remaining < timeout_ms)) timeout_ms = remaining;
+
+      fds[2+i].fd      = clients[i].fd;
+      fds[2+i].events  = (clients[i].replying ? POLLOUT : POLLIN);
+      fds[2+i].revents = 0;
+    }
+
+    if (poll(&fds[0], fds.size(), timeout_ms) == -1)
+    {
+      if (errno == EINTR) continue;
+      perror("poll");
+      break;
+    }
+    if (fds[1].revents != 0) break;
+
+    /* Progress the connections in place, dropping those that are done, failed or expired */
+    gettimeofday(&now, NULL);
+    unsigned int kept = 0;
+    for (unsigned int i=0; i<clients.size(); i++)
+    {
+      RendezvousClient &client = clients[i];
+      int finished = 0;
+
+      if (fds[2+i].revents != 0)
+      {
+        finished = Progress(client);
+        if ((! finished) && (! client.replying) && (client.done == sizeof(client.rank)))
+        {
+          /* The rank is complete, the reply usually fits in the socket buffer right away */
+          FillReply(ntohl(client.rank), client.reply);
+          client.replying = true;
+          client.done     = 0;
+          finished = Progress(client);
+        }
+      }
+      if ((! finished) && (MsUntil(client.deadline, now) == 0)) finished = 1;
+
+      if (finished)
+      {
+        close(client.fd);
+        accepting = true;
+      }
+      else
+      {
+        clients[kept ++] = client;
+      }
+    }
+    clients.resize(kept);
+
+    /* Take all the pending connections */
+    while ((accepting) && (fds[0].revents & POLLIN))
+    {
+      int fd = accept(ListenFd, NULL, NULL);
+      if (fd == -1)
+      {
+        if ((errno == EMFILE) || (errno == ENFILE)) accepting = false;
+        break;
+      }
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+      RendezvousClient client;
+      memset(&client, 0, sizeof(client));
+      client.fd       = fd;
+      client.deadline = now;
+      client.deadline.tv_sec += RENDEZVOUS_CLIENT_TIMEOUT;
+      clients.push_back(client);
+    }
+  }
+
+  for (unsigned int i=0; i<clients.size(); i++)
+  {
+    close(clients[i].fd);
+  }
+}
+
+
+/**
+ * Builds the reply with the parent record of a back-end.
+ * @param rank  The back-end rank.
+ * @param reply Set to the reply, in network byte order.
+ */
+void RendezvousServer::FillReply(uint32_t rank, RendezvousReply &reply)
+{
+  memset(&reply, 0, sizeof(reply));
+  if (rank < Records.size())
+  {
+    reply.status     = htonl(0);
+    reply.port       = htonl(Records[rank].port);
+    reply.parentRank = htonl(Records[rank].parentRank);
+    strncpy(reply.host, Records[rank].host, CONNECTIONS_HOST_LEN - 1);
+  }
+  else
+  {
+    reply.status = htonl(1);
+  }
+}
+
+
+/**
+ * Asks the rendezvous server of the front-end where this back-end connects. The server may not be 
+ * up yet when the back-ends start, so the connection is retried with exponential backoff.
+ * @param host    Host where the front-end runs.
+ * @param port    Port of the rendezvous server.
+ * @param rank    Back-end rank.
+ * @param record  Set to the parent of the back-end.
+ * @param timeout Seconds to keep retrying.
+ * @return 0 on success; -1 otherwise.
+ */
+int Synapse::RendezvousQuery(const char *host, int port, int rank, ConnectionsRecord &record, unsigned int timeout)
+{
+  struct addrinfo  hints, *res = NULL;
+  struct timeval   start, now;
+  char             service[16];
+  useconds_t       backoff_us = 10000;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%d", port);
+
+  int rc = getaddrinfo(host, service, &hints, &res);
+  if (rc != 0)
+  {
+    cerr << "RendezvousQuery: ERROR: cannot resolve '" << host << "': " << gai_strerror(rc) << endl;
+    return -1;
+  }
+
+  gettimeofday(&start, NULL);
+  do
+  {
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd == -1)
+    {
+      perror("socket");
+      break;
+    }
+    if (connect(fd, res->ai_addr, res->ai_addrlen) == 0)
+    {
+      uint32_t        req = htonl(rank);
+      RendezvousReply reply;
+
+      if ((TransferAll(fd, (char *)&req, sizeof(req), true, RENDEZVOUS_CLIENT_TIMEOUT * 1000) == 0) &&
+          (TransferAll(fd, (char *)&reply, sizeof(reply), false, RENDEZVOUS_CLIENT_TIMEOUT * 1000) == 0))
+      {
+        close(fd);
+        freeaddrinfo(res);
+
+        if (ntohl(reply.status) != 0)
+        {
+          cerr << "RendezvousQuery: ERROR: back-end " << rank << " is unknown to the front-end" << endl;
+          return -1;
+        }
+        memset(&record, 0, sizeof(record));
+        strncpy(record.host, reply.host, CONNECTIONS_HOST_LEN - 1);
+        record.port       = ntohl(reply.port);
+        record.parentRank = ntohl(reply.parentRank);
+        return 0;
+      }
+    }
+    close(fd);
+
+    /* The server is not up yet or is busy, retry */
+    usleep(backoff_us);
+    if (backoff_us < 1000000) backoff_us *= 2;
+    gettimeofday(&now, NULL);
+  } while ((unsigned int)(now.tv_sec - start.tv_sec) < timeout);
+
+  freeaddrinfo(res);
+  cerr << "RendezvousQuery: ERROR: cannot reach the rendezvous server at " << host << ":" << port << endl;
+  return -1;
+}
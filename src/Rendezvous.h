@@ -0,0 +1,73 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#ifndef __RENDEZVOUS_H__
+#define __RENDEZVOUS_H__
+
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include "PendingConnections.h"
+
+#define RENDEZVOUS_TIMEOUT        300 /* Seconds a back-end keeps trying to reach the rendezvous server */
+#define RENDEZVOUS_CLIENT_TIMEOUT 5   /* Seconds the server gives a connected back-end to send its rank and take the reply */
+
+using std::vector;
+
+namespace Synapse {
+
+struct RendezvousReply;
+
+/**
+ * Small TCP server that the front-end runs to tell the back-ends where to connect, as an alternative 
+ * to the connections file. A back-end sends its rank (4 bytes) and receives its parent record in the 
+ * same connection, so the start-up does not touch the filesystem at all.
+ */
+class RendezvousServer
+{
+  public:
+    RendezvousServer();
+    ~RendezvousServer();
+
+    int  Start(int port, vector<ConnectionsRecord> &records);
+    int  GetPort();
+    void Stop();
+
+  private:
+    vector<ConnectionsRecord> Records;
+    int       ListenFd;
+    int       WakePipe[2]; /* Written by Stop() to wake up the server thread */
+    int       Port;
+    bool      Running;
+    pthread_t ServerThread;
+
+    static void * ServerMain(void *arg);
+    void Serve();
+    void FillReply(uint32_t rank, RendezvousReply &reply);
+};
+
+/* Back-end API */
+int RendezvousQuery(const char *host, int port, int rank, ConnectionsRecord &record, unsigned int timeout=RENDEZVOUS_TIMEOUT);
+
+} /* namespace Synapse */
+
+#endif /* __RENDEZVOUS_H__ */
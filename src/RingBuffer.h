@@ -0,0 +1,212 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#ifndef __RING_BUFFER_H__
+#define __RING_BUFFER_H__
+
+#include <stddef.h>
+
+#define RING_CACHE_LINE 64 /* Head and tail live in different cache lines to avoid false sharing */
+
+namespace Synapse {
+
+/**
+ * Bounded lock-free ring buffers to hand records from the application threads to the protocols
+ * that run in the back-end loop thread (see BackEnd::StartLoopThread). Push() never blocks: it 
+ * returns false when the buffer is full, so the application decides whether to drop or retry. 
+ * The protocols drain the buffer with Pop() from their Run(). The capacity is rounded up to a 
+ * power of two, and T must be copyable.
+ */
+
+/**
+ * Single-producer single-consumer ring: one application thread pushes, the loop thread pops.
+ */
+template <class T> class SPSCRing
+{
+   public:
+      SPSCRing(size_t capacity)
+      {
+         size = RoundUp(capacity);
+         mask = size - 1;
+         head = 0;
+         tail = 0;
+         slots = new T[size];
+      }
+
+      ~SPSCRing()
+      {
+         delete [] slots;
+      }
+
+      bool Push(const T &value)
+      {
+         size_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+         if (t - __atomic_load_n(&head, __ATOMIC_ACQUIRE) == size) return false;
+
+         slots[t & mask] = value;
+         __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+         return true;
+      }
+
+      bool Pop(T &value)
+      {
+         size_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+         if (h == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) return false;
+
+         value = slots[h & mask];
+         __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+         return true;
+      }
+
+      size_t Count()
+      {
+         return __atomic_load_n(&tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+      }
+
+      size_t Capacity()
+      {
+         return size;
+      }
+
+   private:
+      size_t size;
+      size_t mask;
+      T     *slots;
+      char   pad1[RING_CACHE_LINE];
+      size_t head; /* Next slot to pop, written by the consumer only */
+      char   pad2[RING_CACHE_LINE];
+      size_t tail; /* Next slot to push, written by the producer only */
+      char   pad3[RING_CACHE_LINE];
+
+      static size_t RoundUp(size_t n)
+      {
+         size_t p = 1;
+         while (p < n) p <<= 1;
+         return p;
+      }
+
+      SPSCRing(const SPSCRing &);
+      SPSCRing & operator=(const SPSCRing &);
+};
+
+
+/**
+ * Multiple-producer single-consumer ring: any number of application threads push, the loop thread pops.
+ * Every slot carries a sequence number that tells whether it is free for the producer that claimed it 
+ * or ready for the consumer, so a producer never waits for the others to finish copying their records.
+ */
+template <class T> class MPSCRing
+{
+   public:
+      MPSCRing(size_t capacity)
+      {
+         size = RoundUp(capacity);
+         mask = size - 1;
+         head = 0;
+         tail = 0;
+         slots = new Slot[size];
+         for (size_t i=0; i<size; i++) slots[i].seq = i;
+      }
+
+      ~MPSCRing()
+      {
+         delete [] slots;
+      }
+
+      bool Push(const T &value)
+      {
+         size_t pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+         Slot  *slot;
+
+         while (1)
+         {
+            slot = &slots[pos & mask];
+            size_t seq  = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            long   diff = (long)seq - (long)pos;
+
+            if (diff == 0)
+            {
+               /* The slot is free, try to claim it */
+               if (__atomic_compare_exchange_n(&tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            }
+            else if (diff < 0)
+            {
+               /* The consumer didn't release this slot yet, the ring is full */
+               return false;
+            }
+            else
+            {
+               /* Another producer claimed it */
+               pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+            }
+         }
+         slot->value = value;
+         __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+         return true;
+      }
+
+      bool Pop(T &value)
+      {
+         Slot *slot = &slots[head & mask];
+         if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + 1) return false;
+
+         value = slot->value;
+         __atomic_store_n(&slot->seq, head + size, __ATOMIC_RELEASE);
+         head ++;
+         return true;
+      }
+
+      size_t Capacity()
+      {
+         return size;
+      }
+
+   private:
+      typedef struct
+      {
+         size_t seq;
+         T      value;
+      } Slot;
+
+      size_t size;
+      size_t mask;
+      Slot  *slots;
+      char   pad1[RING_CACHE_LINE];
+      size_t head; /* Only touched by the consumer */
+      char   pad2[RING_CACHE_LINE];
+      size_t tail; /* Claimed by the producers with compare-and-swap */
+      char   pad3[RING_CACHE_LINE];
+
+      static size_t RoundUp(size_t n)
+      {
+         size_t p = 1;
+         while (p < n) p <<= 1;
+         return p;
+      }
+
+      MPSCRing(const MPSCRing &);
+      MPSCRing & operator=(const MPSCRing &);
+};
+
+} /* namespace Synapse */
+
+#endif /* __RING_BUFFER_H__ */
@@ -0,0 +1,263 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#include <map>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "SendBuffer.h"
+
+using std::map;
+using namespace Synapse;
+
+/* Flush policy and pending messages of a stream */
+typedef struct
+{
+   FlushMode      mode;
+   unsigned long  threshold;
+   size_t         pendingBytes;
+   unsigned long  pendingCount;
+   struct timeval firstPending;
+} StreamBuffer;
+
+static map<STREAM *, StreamBuffer> streamBuffers;
+static pthread_mutex_t             streamBuffersLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile unsigned long      totalPending      = 0; /* Messages pending in all the streams */
+
+
+/**
+ * Returns the milliseconds elapsed since the given time.
+ */
+static unsigned long ElapsedMs(struct timeval *since)
+{
+   struct timeval now;
+   gettimeofday(&now, NULL);
+   return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_usec - since->tv_usec) / 1000;
+}
+
+
+/**
+ * Flushes the stream and resets its pending counters. Has to be called with the lock held.
+ */
+static int DoFlush(STREAM *stream, StreamBuffer &buffer)
+{
+   totalPending -= buffer.pendingCount;
+   buffer.pendingBytes = 0;
+   buffer.pendingCount = 0;
+   return STREAM_flush(stream);
+}
+
+
+/**
+ * Sets the flush policy of the messages sent through the given stream with MRN_STREAM_SEND_BUFFERED.
+ * @param stream    The stream.
+ * @param mode      The flush policy (see SendBuffer.h).
+ * @param threshold Bytes, messages or milliseconds for the FLUSH_BYTES, FLUSH_COUNT and FLUSH_DELAY modes.
+ */
+void Synapse::SetFlushPolicy(STREAM *stream, FlushMode mode, unsigned long threshold)
+{
+   pthread_mutex_lock(&streamBuffersLock);
+   StreamBuffer &buffer = streamBuffers[stream];
+   buffer.mode         = mode;
+   buffer.threshold    = threshold;
+   if (buffer.pendingCount > 0) DoFlush(stream, buffer);
+   buffer.pendingBytes = 0;
+   buffer.pendingCount = 0;
+   pthread_mutex_unlock(&streamBuffersLock);
+}
+
+
+/**
+ * Accounts a message that was sent through the stream without flushing, and flushes
+ * the stream if its policy says so.
+ * @param stream The stream.
+ * @param bytes  Size of the message that was sent.
+ * @return 0 on success; -1 if the flush fails.
+ */
+int Synapse::NotifySend(STREAM *stream, size_t bytes)
+{
+   int  rc    = 0;
+   bool flush = false;
+
+   pthread_mutex_lock(&streamBuffersLock);
+   map<STREAM *, StreamBuffer>::iterator it = streamBuffers.find(stream);
+   if (it == streamBuffers.end())
+   {
+      /* No policy, flush every message */
+      pthread_mutex_unlock(&streamBuffersLock);
+      return STREAM_flush(stream);
+   }
+
+   StreamBuffer &buffer = it->second;
+   if (buffer.pendingCount == 0) gettimeofday(&buffer.firstPending, NULL);
+   buffer.pendingBytes += bytes;
+   buffer.pendingCount ++;
+   totalPending ++;
+
+   switch (buffer.mode)
+   {
+      case FLUSH_ALWAYS:
+         flush = true;
+         break;
+      case FLUSH_EXPLICIT:
+         break;
+      case FLUSH_BYTES:
+         flush = (buffer.pendingBytes >= buffer.threshold);
+         break;
+      case FLUSH_COUNT:
+         flush = (buffer.pendingCount >= buffer.threshold);
+         break;
+      case FLUSH_DELAY:
+         flush = (ElapsedMs(&buffer.firstPending) >= buffer.threshold);
+         break;
+   }
+   if (flush) rc = DoFlush(stream, buffer);
+   pthread_mutex_unlock(&streamBuffersLock);
+
+   return rc;
+}
+
+
+/**
+ * Flushes the pending messages of the given stream, regardless of its policy.
+ * @param stream The stream.
+ * @return 0 on success; -1 otherwise.
+ */
+int Synapse::FlushStream(STREAM *stream)
+{
+   int rc;
+
+   pthread_mutex_lock(&streamBuffersLock);
+   map<STREAM *, StreamBuffer>::iterator it = streamBuffers.find(stream);
+   if (it != streamBuffers.end())
+   {
+      rc = DoFlush(stream, it->second);
+   }
+   else
+   {
+      rc = STREAM_flush(stream);
+   }
+   pthread_mutex_unlock(&streamBuffersLock);
+
+   return rc;
+}
+
+
+/**
+ * Flushes all the streams with pending messages. The back-ends call this after every protocol,
+ * and the blocking receive wrappers before they block, so that no buffered messages are left 
+ * behind while waiting for an answer to them. There is no timer behind the FLUSH_DELAY policy: 
+ * the delay is only checked on send and here, so call this periodically with expired_only to 
+ * enforce it on streams that stop sending.
+ * @param expired_only When true, only flushes the FLUSH_DELAY streams whose delay expired.
+ * @return 0 on success; -1 if any flush fails.
+ */
+int Synapse::FlushPending(bool expired_only)
+{
+   int rc = 0;
+
+   /* Cheap check for the receive wrappers, nothing is buffered most of the time */
+   if (totalPending == 0) return 0;
+
+   pthread_mutex_lock(&streamBuffersLock);
+   for (map<STREAM *, StreamBuffer>::iterator it = streamBuffers.begin(); it != streamBuffers.end(); ++it)
+   {
+      StreamBuffer &buffer = it->second;
+      if (buffer.pendingCount == 0) continue;
+
+      if ((! expired_only) ||
+          ((buffer.mode == FLUSH_DELAY) && (ElapsedMs(&buffer.firstPending) >= buffer.threshold)))
+      {
+         if (DoFlush(it->first, buffer) == -1) rc = -1;
+      }
+   }
+   pthread_mutex_unlock(&streamBuffersLock);
+
+   return rc;
+}
+
+
+/**
+ * Computes the size of the data of a message, walking the arguments with the same MRNet
+ * format string used to send it (e.g. "%d %s %alf").
+ * @param format MRNet format string.
+ * @return the size in bytes of the data.
+ */
+size_t Synapse::PackedSize(const char *format, ...)
+{
+   va_list args;
+   size_t  bytes = 0;
+   const char *fmt = format;
+
+   va_start(args, format);
+   while ((fmt = strchr(fmt, '%')) != NULL)
+   {
+      bool   is_array = false;
+      size_t elem_size = 0;
+
+      fmt ++;
+      if (*fmt == 'a') { is_array = true; fmt ++; }
+      if (*fmt == 'u') fmt ++; /* Unsigned types have the same size */
+
+      switch (*fmt)
+      {
+         case 'c': elem_size = 1; break;
+         case 'h': elem_size = 2; fmt ++; break; /* %hd */
+         case 'd': elem_size = 4; break;
+         case 'f': elem_size = 4; break;
+         case 'l': elem_size = 8; fmt ++; break; /* %ld, %lf */
+         case 's': elem_size = 0; break;
+         default: continue;
+      }
+
+      if ((is_array) && (*fmt == 's'))
+      {
+         char   **strs  = va_arg(args, char **);
+         uint32_t count = va_arg(args, uint32_t);
+         for (uint32_t i=0; i<count; i++) bytes += strlen(strs[i]) + 1;
+      }
+      else if (is_array)
+      {
+         (void)va_arg(args, void *);
+         bytes += elem_size * va_arg(args, uint32_t);
+      }
+      else if (*fmt == 's')
+      {
+         char *str = va_arg(args, char *);
+         bytes += (str != NULL ? strlen(str) + 1 : 0);
+      }
+      else
+      {
+         /* Scalars are promoted to int, int64 or double when passed through '...' */
+         if (*fmt == 'f')         (void)va_arg(args, double);
+         else if (elem_size == 8) (void)va_arg(args, int64_t);
+         else                     (void)va_arg(args, int);
+         bytes += elem_size;
+      }
+   }
+   va_end(args);
+
+   return bytes;
+}
+
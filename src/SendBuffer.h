@@ -0,0 +1,56 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+/* Outside the guard, like Metrics.h, because the inline receive wrappers of MRNet_typed.h flush the buffers */
+#include "MRNet_wrappers.h"
+
+#ifndef __SEND_BUFFER_H__
+#define __SEND_BUFFER_H__
+
+#include <stddef.h>
+
+namespace Synapse {
+
+/**
+ * Flush policies for the messages sent with MRN_STREAM_SEND_BUFFERED. Streams without
+ * a policy are flushed after every send, like MRN_STREAM_SEND does. Regardless of the 
+ * policy, the blocking receive wrappers flush all the pending messages before they block.
+ */
+typedef enum
+{
+   FLUSH_ALWAYS,   /* Flush after every send                                   */
+   FLUSH_EXPLICIT, /* Only flush when FlushStream() or FlushPending() is called */
+   FLUSH_BYTES,    /* Flush when the pending messages add up to threshold bytes */
+   FLUSH_COUNT,    /* Flush every threshold messages                           */
+   FLUSH_DELAY     /* Flush when the oldest pending message is threshold ms old,
+                      checked on the next send or FlushPending() call           */
+} FlushMode;
+
+void   SetFlushPolicy(STREAM *stream, FlushMode mode, unsigned long threshold=0);
+int    NotifySend    (STREAM *stream, size_t bytes);
+int    FlushStream   (STREAM *stream);
+int    FlushPending  (bool expired_only=false);
+size_t PackedSize    (const char *format, ...);
+
+} /* namespace Synapse */
+
+#endif /* __SEND_BUFFER_H__ */
@@ -0,0 +1,167 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "StreamWait.h"
+
+using std::vector;
+using namespace Synapse;
+
+/* Bounds of the exponential backoff used when the streams have no notification descriptor */
+#define BACKOFF_MIN_US   1000
+#define BACKOFF_MAX_US 100000
+
+
+/**
+ * Returns the milliseconds left until the deadline, 0 if it already expired, or -1 if there's no deadline.
+ */
+static int RemainingMs(struct timeval *deadline)
+{
+   struct timeval now;
+   long ms;
+
+   if (deadline == NULL) return -1;
+
+   gettimeofday(&now, NULL);
+   ms = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_usec - now.tv_usec) / 1000;
+   return (ms > 0 ? (int)ms : 0);
+}
+
+
+/**
+ * Sleeps until any of the streams notifies that data is available, or the timeout expires.
+ * The lightweight library has no notification descriptors, so it sleeps for the next backoff step instead.
+ * @param streams    The streams to wait for.
+ * @param timeout_ms Maximum time to wait, or -1 to wait forever.
+ * @param backoff_us Current backoff step, doubled on every call that falls back to sleeping.
+ * @return 0 on success; -1 on error.
+ */
+static int SleepForData(vector<STREAM *> &streams, int timeout_ms, useconds_t &backoff_us)
+{
+#if !defined(LIGHTWEIGHT)
+   vector<struct pollfd> fds(streams.size());
+   bool notifiable = true;
+
+   for (unsigned int i=0; i<streams.size(); i++)
+   {
+      fds[i].fd      = streams[i]->get_DataNotificationFd();
+      fds[i].events  = POLLIN;
+      fds[i].revents = 0;
+      if (fds[i].fd == -1) notifiable = false;
+   }
+
+   if (notifiable)
+   {
+      if (poll(&fds[0], fds.size(), timeout_ms) == -1)
+      {
+         return (errno == EINTR ? 0 : -1);
+      }
+      for (unsigned int i=0; i<fds.size(); i++)
+      {
+         if (fds[i].revents & POLLIN) streams[i]->clear_DataNotificationFd();
+      }
+      return 0;
+   }
+#endif
+   useconds_t sleep_us = backoff_us;
+   if ((timeout_ms >= 0) && (sleep_us > (useconds_t)timeout_ms * 1000)) sleep_us = timeout_ms * 1000;
+
+   usleep(sleep_us);
+   backoff_us = (backoff_us * 2 > BACKOFF_MAX_US ? BACKOFF_MAX_US : backoff_us * 2);
+   return 0;
+}
+
+
+/**
+ * Receives the next packet from any of the given streams. The streams are checked in order,
+ * so the first ones have priority when several have data.
+ * @param streams    The streams to receive from.
+ * @param tag        Set to the tag of the packet received.
+ * @param data       Set to the packet received.
+ * @param from       Set to the stream the packet was received from.
+ * @param timeout_ms Maximum time to wait in milliseconds, or -1 to wait forever.
+ * @return 1 if a packet is received; 0 on timeout; -1 on error.
+ */
+int Synapse::RecvAny(vector<STREAM *> &streams, int *tag, PACKET_PTR &data, STREAM *&from, int timeout_ms)
+{
+   struct timeval  deadline;
+   struct timeval *has_deadline = NULL;
+   useconds_t      backoff_us   = BACKOFF_MIN_US;
+
+   if (streams.empty()) return -1;
+
+   /* Do not wait with buffered messages behind (see SendBuffer.h) */
+   FlushPending();
+
+   if (timeout_ms >= 0)
+   {
+      gettimeofday(&deadline, NULL);
+      deadline.tv_sec  += timeout_ms / 1000;
+      deadline.tv_usec += (timeout_ms % 1000) * 1000;
+      if (deadline.tv_usec >= 1000000)
+      {
+         deadline.tv_sec ++;
+         deadline.tv_usec -= 1000000;
+      }
+      has_deadline = &deadline;
+   }
+
+   while (1)
+   {
+      for (unsigned int i=0; i<streams.size(); i++)
+      {
+         int rc = STREAM_recv(streams[i], tag, data, false);
+         if (rc == -1) return -1;
+         if (rc == 1)
+         {
+            from = streams[i];
+            return 1;
+         }
+      }
+
+      int remaining = RemainingMs(has_deadline);
+      if (remaining == 0) return 0;
+
+      if (SleepForData(streams, remaining, backoff_us) == -1) return -1;
+   }
+}
+
+
+/**
+ * Receives the next packet from the given stream.
+ * @param stream     The stream to receive from.
+ * @param tag        Set to the tag of the packet received.
+ * @param data       Set to the packet received.
+ * @param timeout_ms Maximum time to wait in milliseconds, or -1 to wait forever.
+ * @return 1 if a packet is received; 0 on timeout; -1 on error.
+ */
+int Synapse::RecvTimed(STREAM *stream, int *tag, PACKET_PTR &data, int timeout_ms)
+{
+   vector<STREAM *> streams(1, stream);
+   STREAM *from;
+
+   return RecvAny(streams, tag, data, from, timeout_ms);
+}
+
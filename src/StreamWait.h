@@ -0,0 +1,42 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#ifndef __STREAM_WAIT_H__
+#define __STREAM_WAIT_H__
+
+#include <vector>
+#include "MRNet_wrappers.h"
+
+namespace Synapse {
+
+/**
+ * Receives without spinning: the calling thread sleeps on the data notification file descriptor 
+ * of the streams and wakes up as soon as a packet arrives, or when the timeout expires. 
+ * A negative timeout waits forever. All return 1 when a packet is received, 0 on timeout 
+ * and -1 on error.
+ */
+int RecvTimed(STREAM *stream, int *tag, PACKET_PTR &data, int timeout_ms=-1);
+int RecvAny  (std::vector<STREAM *> &streams, int *tag, PACKET_PTR &data, STREAM *&from, int timeout_ms=-1);
+
+} /* namespace Synapse */
+
+#endif /* __STREAM_WAIT_H__ */
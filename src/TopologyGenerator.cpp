@@ -0,0 +1,400 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "TopologyGenerator.h"
+
+using std::cerr;
+using std::endl;
+using std::ifstream;
+using std::ofstream;
+using std::stringstream;
+using std::map;
+using namespace Synapse;
+
+
+/**
+ * Returns the name of the local host.
+ */
+static string LocalHostName()
+{
+   char host[256];
+
+   if (gethostname(host, sizeof(host)) != 0) return "localhost";
+   host[sizeof(host) - 1] = '\0';
+   return host;
+}
+
+
+/**
+ * Constructor that places the whole tree in the local host.
+ */
+TopologyGenerator::TopologyGenerator()
+{
+   FrontEndHost = LocalHostName();
+   Hosts.push_back(FrontEndHost);
+   Fanout = 0;
+   Depth  = 0;
+}
+
+
+/**
+ * Constructor.
+ * @param frontEndHost Host where the front-end runs (the root of the tree).
+ * @param hosts        Hosts where the internal processes (and the spawned back-ends) are placed.
+ */
+TopologyGenerator::TopologyGenerator(string frontEndHost, vector<string> &hosts)
+{
+   FrontEndHost = frontEndHost;
+   Hosts        = hosts;
+   if (Hosts.empty()) Hosts.push_back(FrontEndHost);
+   Fanout = 0;
+   Depth  = 0;
+}
+
+
+/**
+ * Sets the maximum number of children per process. Takes precedence over the depth.
+ * @param fanout The fan-out (at least 2).
+ */
+void TopologyGenerator::SetFanout(unsigned int fanout)
+{
+   Fanout = fanout;
+}
+
+
+/**
+ * Sets the number of levels from the front-end to the back-ends, and the fan-out is 
+ * the smallest that reaches all the back-ends in that many levels.
+ * @param depth The depth of the tree (at least 1).
+ */
+void TopologyGenerator::SetDepth(unsigned int depth)
+{
+   Depth = depth;
+}
+
+
+/**
+ * Sets the host of every back-end, to place each leaf in the host of the back-ends it serves.
+ * @param beHosts Host of every back-end, in rank order.
+ */
+void TopologyGenerator::SetBackendHosts(vector<string> &beHosts)
+{
+   BackendHosts = beHosts;
+}
+
+
+/**
+ * Computes the fan-out of the tree for the given number of back-ends.
+ * @param numBackends Number of back-ends.
+ * @return the fan-out.
+ */
+unsigned int TopologyGenerator::GetFanout(unsigned int numBackends)
+{
+   unsigned int fanout = DEFAULT_TOPOLOGY_FANOUT;
+
+   if (Fanout > 0)
+   {
+      fanout = Fanout;
+   }
+   else if (Depth > 0)
+   {
+      /* Smallest k such that k^Depth >= numBackends */
+      for (fanout = 2; fanout < numBackends; fanout ++)
+      {
+         unsigned long long reach = 1;
+         for (unsigned int d = 0; (d < Depth) && (reach < numBackends); d ++) reach *= fanout;
+         if (reach >= numBackends) break;
+      }
+   }
+   return (fanout < 2 ? 2 : fanout);
+}
+
+
+/* A process of the generated tree, serving a contiguous block of back-ends */
+typedef struct
+{
+   unsigned int         firstBackend;
+   unsigned int         numBackends;
+   bool                 isBackend;
+   string               name;
+   vector<unsigned int> children;
+} TreeNode;
+
+
+/**
+ * Generates the topology. The tree is built from the root down: a process that serves more 
+ * back-ends than the fan-out splits them evenly among the fewest children that can still 
+ * reach them in the remaining levels. A single back-end is never relayed through a process 
+ * of its own, so when the back-end count is not a power of the fan-out the tree is shallower 
+ * in some branches instead of having internal processes with a single child.
+ * @param numBackends  Number of back-ends.
+ * @param withBackends True if the back-ends are spawned by MRNet and are the leaves of the topology; 
+ *                     false if they attach later to the leaves.
+ * @param topology     Set to the topology, in the MRNet topology file syntax.
+ * @return 0 on success; -1 otherwise.
+ */
+int TopologyGenerator::Generate(unsigned int numBackends, bool withBackends, string &topology)
+{
+   vector<TreeNode> nodes; /* In breadth-first order, the root first */
+   unsigned int     fanout = GetFanout(numBackends);
+
+   if (numBackends == 0)
+   {
+      cerr << "TopologyGenerator: ERROR: the number of back-ends has to be greater than 0" << endl;
+      return -1;
+   }
+
+   TreeNode root;
+   root.firstBackend = 0;
+   root.numBackends  = numBackends;
+   root.isBackend    = false;
+   nodes.push_back(root);
+
+   for (unsigned int n = 0; n < nodes.size(); n ++)
+   {
+      unsigned int first = nodes[n].firstBackend;
+      unsigned int count = nodes[n].numBackends;
+      unsigned int num_children;
+
+      if (nodes[n].isBackend) continue;
+
+      if (count <= fanout)
+      {
+         /* A leaf: the back-ends are its children, or attach to it later */
+         if (! withBackends) continue;
+         num_children = count;
+      }
+      else
+      {
+         /* Back-ends that every child can reach in the levels left below it */
+         unsigned long long reach = 1;
+         while (reach * fanout < count) reach *= fanout;
+         num_children = (count + reach - 1) / reach;
+      }
+
+      for (unsigned int c = 0; c < num_children; c ++)
+      {
+         TreeNode child;
+         child.firstBackend = first;
+         child.numBackends  = count / num_children + (c < count % num_children ? 1 : 0);
+         child.isBackend    = (withBackends && (child.numBackends == 1));
+         first += child.numBackends;
+
+         nodes[n].children.push_back(nodes.size());
+         nodes.push_back(child);
+      }
+   }
+
+   /* Name the processes from the root, numbering the instances of every host. Every process goes to the 
+      host of the first back-end it serves, so that sibling subtrees stay in the same host */
+   map<string, unsigned int> nextInstance;
+
+   for (unsigned int n = 0; n < nodes.size(); n ++)
+   {
+      TreeNode &node = nodes[n];
+      bool      leaf = (node.isBackend || ((! withBackends) && (node.children.empty())));
+      string    host;
+
+      if (n == 0)
+      {
+         host = FrontEndHost;
+      }
+      else if ((leaf) && (BackendHosts.size() >= numBackends))
+      {
+         /* Leaves (or back-ends) go to the host of the first back-end they serve */
+         host = BackendHosts[node.firstBackend];
+      }
+      else
+      {
+         host = Hosts[(unsigned long long)node.firstBackend * Hosts.size() / numBackends];
+      }
+
+      stringstream name;
+      name << host << ":" << nextInstance[host] ++;
+      node.name = name.str();
+   }
+
+   stringstream out;
+   for (unsigned int n = 0; n < nodes.size(); n ++)
+   {
+      vector<unsigned int> &children = nodes[n].children;
+
+      if (children.empty()) continue;
+
+      out << nodes[n].name << " =>" << endl;
+      for (unsigned int c = 0; c < children.size(); c ++)
+      {
+         out << "\t" << nodes[children[c]].name << (c == children.size() - 1 ? " ;" : "") << endl;
+      }
+      out << endl;
+   }
+   if (nodes.size() == 1)
+   {
+      /* Only the front-end, the back-ends attach to it */
+      out << nodes[0].name << " ;" << endl;
+   }
+   topology = out.str();
+   return 0;
+}
+
+
+/**
+ * Generates the topology and writes it to the given file.
+ * @param file         Path of the topology file.
+ * @param numBackends  Number of back-ends.
+ * @param withBackends True if the back-ends are spawned by MRNet (see Generate).
+ * @return 0 on success; -1 otherwise.
+ */
+int TopologyGenerator::Write(const char *file, unsigned int numBackends, bool withBackends)
+{
+   string topology;
+
+   if (Generate(numBackends, withBackends, topology) != 0) return -1;
+
+   ofstream ofs(file);
+   if (! ofs.is_open())
+   {
+      cerr << "TopologyGenerator: ERROR: cannot write topology file '" << file << "'" << endl;
+      return -1;
+   }
+   ofs << topology;
+   ofs.close();
+   return (ofs.fail() ? -1 : 0);
+}
+
+
+/**
+ * Generates the topology into a new temporary file, that the caller removes when done.
+ * @param numBackends  Number of back-ends.
+ * @param withBackends True if the back-ends are spawned by MRNet (see Generate).
+ * @param file         Set to the path of the temporary file.
+ * @return 0 on success; -1 otherwise.
+ */
+int TopologyGenerator::WriteTemp(unsigned int numBackends, bool withBackends, string &file)
+{
+   string topology;
+   const char *tmpdir = getenv("TMPDIR");
+
+   if (Generate(numBackends, withBackends, topology) != 0) return -1;
+
+   string path = string(tmpdir != NULL ? tmpdir : "/tmp") + "/synapse_topology.XXXXXX";
+   vector<char> tmpl(path.begin(), path.end());
+   tmpl.push_back('\0');
+
+   int fd = mkstemp(&tmpl[0]);
+   if (fd == -1)
+   {
+      cerr << "TopologyGenerator: ERROR: cannot create temporary topology file '" << path << "'" << endl;
+      return -1;
+   }
+   bool ok = (write(fd, topology.c_str(), topology.size()) == (ssize_t)topology.size());
+   close(fd);
+   file = &tmpl[0];
+   if (! ok)
+   {
+      unlink(file.c_str());
+      cerr << "TopologyGenerator: ERROR: cannot write temporary topology file '" << file << "'" << endl;
+      return -1;
+   }
+   return 0;
+}
+
+
+/**
+ * Reads a list of hosts from a file, one per line.
+ * @param file  The hosts file.
+ * @param hosts Set to the hosts in the file.
+ * @return 0 on success; -1 otherwise.
+ */
+int TopologyGenerator::ReadHosts(const char *file, vector<string> &hosts)
+{
+   ifstream ifs(file);
+   string   host;
+
+   if (! ifs.is_open())
+   {
+      cerr << "TopologyGenerator: ERROR: cannot open hosts file '" << file << "'" << endl;
+      return -1;
+   }
+   while (ifs >> host)
+   {
+      hosts.push_back(host);
+   }
+   return 0;
+}
+
+
+/**
+ * Configures a generator from the environment: SYNAPSE_TOPOLOGY_FANOUT or SYNAPSE_TOPOLOGY_DEPTH give 
+ * the shape of the tree, SYNAPSE_TOPOLOGY_HOSTS a file with the hosts for the internal processes 
+ * (the local host if undefined), and SYNAPSE_BE_HOSTFILE the hosts of the back-ends.
+ * @param generator The generator to configure.
+ * @return 0 on success; -1 otherwise.
+ */
+int TopologyGenerator::FromEnvironment(TopologyGenerator &generator)
+{
+   vector<string> hosts, beHosts;
+
+   char *env_SYNAPSE_TOPOLOGY_HOSTS = getenv("SYNAPSE_TOPOLOGY_HOSTS");
+   if ((env_SYNAPSE_TOPOLOGY_HOSTS != NULL) && (ReadHosts(env_SYNAPSE_TOPOLOGY_HOSTS, hosts) != 0))
+   {
+      return -1;
+   }
+   char *env_SYNAPSE_BE_HOSTFILE = getenv("SYNAPSE_BE_HOSTFILE");
+   if ((env_SYNAPSE_BE_HOSTFILE != NULL) && (ReadHosts(env_SYNAPSE_BE_HOSTFILE, beHosts) != 0))
+   {
+      return -1;
+   }
+
+   generator = TopologyGenerator(LocalHostName(), hosts);
+   generator.SetBackendHosts(beHosts);
+
+   char *env_SYNAPSE_TOPOLOGY_FANOUT = getenv("SYNAPSE_TOPOLOGY_FANOUT");
+   if (env_SYNAPSE_TOPOLOGY_FANOUT != NULL) generator.SetFanout(atoi(env_SYNAPSE_TOPOLOGY_FANOUT));
+
+   char *env_SYNAPSE_TOPOLOGY_DEPTH = getenv("SYNAPSE_TOPOLOGY_DEPTH");
+   if (env_SYNAPSE_TOPOLOGY_DEPTH != NULL) generator.SetDepth(atoi(env_SYNAPSE_TOPOLOGY_DEPTH));
+
+   return 0;
+}
+
+
+/**
+ * Checks whether the topology has to be generated instead of read from a file, which 
+ * is requested by setting SYNAPSE_TOPOLOGY to "auto".
+ * @param TopologyFile The value of SYNAPSE_TOPOLOGY.
+ * @return true if the topology has to be generated; false otherwise.
+ */
+bool TopologyGenerator::Requested(const char *TopologyFile)
+{
+   return ((TopologyFile != NULL) && (strcmp(TopologyFile, "auto") == 0));
+}
+
@@ -0,0 +1,76 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#ifndef __TOPOLOGY_GENERATOR_H__
+#define __TOPOLOGY_GENERATOR_H__
+
+#include <string>
+#include <vector>
+
+#define DEFAULT_TOPOLOGY_FANOUT 32 /* Children per process when neither the fan-out nor the depth are given */
+
+using std::string;
+using std::vector;
+
+namespace Synapse {
+
+/**
+ * Builds balanced k-ary MRNet topologies for a number of back-ends, so that the shape of the tree 
+ * follows the size of the job. The fan-out is either given, or derived from the target depth 
+ * (levels from the front-end to the back-ends). Every process is placed in the host of the first 
+ * back-end it serves, with the back-ends spread in blocks over the hosts, so that sibling subtrees 
+ * stay in the same host.
+ *
+ * When the back-ends are spawned by MRNet they are the leaves of the topology. Otherwise, the leaves 
+ * are the processes the back-ends attach to, each one serving up to fan-out back-ends (see 
+ * PendingConnections::Write), and are placed in the hosts of their back-ends when these are known.
+ */
+class TopologyGenerator
+{
+   public:
+      TopologyGenerator();
+      TopologyGenerator(string frontEndHost, vector<string> &hosts);
+
+      void SetFanout      (unsigned int fanout);
+      void SetDepth       (unsigned int depth);
+      void SetBackendHosts(vector<string> &beHosts);
+      unsigned int GetFanout(unsigned int numBackends);
+
+      int  Generate (unsigned int numBackends, bool withBackends, string &topology);
+      int  Write    (const char *file, unsigned int numBackends, bool withBackends);
+      int  WriteTemp(unsigned int numBackends, bool withBackends, string &file);
+
+      static int  ReadHosts      (const char *file, vector<string> &hosts);
+      static int  FromEnvironment(TopologyGenerator &generator);
+      static bool Requested      (const char *TopologyFile);
+
+   private:
+      string         FrontEndHost;
+      vector<string> Hosts;
+      vector<string> BackendHosts; /* Host of every back-end in rank order, empty if unknown */
+      unsigned int   Fanout;
+      unsigned int   Depth;
+};
+
+} /* namespace Synapse */
+
+#endif /* __TOPOLOGY_GENERATOR_H__ */
@@ -0,0 +1,418 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "Trace.h"
+
+using std::cerr;
+using std::endl;
+using std::ofstream;
+using std::stringstream;
+using std::vector;
+using std::map;
+using namespace Synapse;
+
+/* An event, recorded when it ends */
+typedef struct
+{
+   uint8_t  kind;
+   uint32_t value;
+   int32_t  stream;
+   uint64_t begin;
+   uint64_t end;
+} TraceRecord;
+
+/* Events of a thread. Only the owner thread appends, so no locking is needed until the flush */
+typedef struct
+{
+   unsigned int        thread;  /* 1-based, in order of the first event */
+   vector<TraceRecord> records;
+   uint64_t            dropped; /* Events lost because the buffer was full */
+} ThreadBuffer;
+
+/* Beginning or end of an event in the Paraver timeline */
+typedef struct
+{
+   uint64_t     time;
+   unsigned int thread;
+   bool         end;
+   TraceRecord *record;
+} TracePoint;
+
+bool Synapse::traceEnabled = false;
+
+static __thread ThreadBuffer *threadBuffer = NULL;
+static vector<ThreadBuffer *>  threadBuffers;
+static map<unsigned int, string> protocolNames;
+static size_t                  bufferEvents = TRACE_BUFFER_EVENTS;
+static pthread_mutex_t         traceLock    = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *KindNames[NUM_TRACE_KINDS] = 
+   { "Synapse dispatch", "Synapse control phase", "Synapse barrier", "Synapse send", "Synapse receive" };
+
+static const char *PhaseNames[NUM_TRACE_PHASES] = 
+   { "End", "Request broadcast", "FE Run", "ACK reduction", "Wait for request", 
+     "Pre-protocol callback", "BE Run", "Post-protocol callback", "ACK send", "Announce streams" };
+
+/* Same order as in MRNet_tags.h */
+static const char *TagNames[] = 
+   { "TAG_EXIT", "TAG_STREAM", "TAG_PROT_ID", "TAG_PROT_BATCH", "TAG_ACK", 
+     "TAG_BARRIER_STATS", "TAG_CHUNK", "TAG_CHUNK_CREDIT" };
+
+/* Fails to compile when a tag is added to MRNet_tags.h without its name */
+typedef char TagNamesMatchTags[(sizeof(TagNames) / sizeof(TagNames[0]) == TAG_ANY - FirstApplicationTag) ? 1 : -1];
+
+
+/**
+ * Enables or disables the tracing. It is enabled at start-up when SYNAPSE_TRACE is set.
+ * @param enable True to enable.
+ */
+void Synapse::EnableTrace(bool enable)
+{
+   char *env_SYNAPSE_TRACE_BUFFER = getenv("SYNAPSE_TRACE_BUFFER");
+   if ((env_SYNAPSE_TRACE_BUFFER != NULL) && (atoi(env_SYNAPSE_TRACE_BUFFER) > 0))
+   {
+      bufferEvents = atoi(env_SYNAPSE_TRACE_BUFFER);
+   }
+   traceEnabled = enable;
+}
+
+
+/**
+ * Names a protocol in the traces. Called when the protocol is loaded.
+ * @param prot_idx Numeric ID of the protocol.
+ * @param prot_id  Protocol identifier.
+ */
+void Synapse::TraceProtocolName(unsigned int prot_idx, string prot_id)
+{
+   pthread_mutex_lock(&traceLock);
+   protocolNames[prot_idx + 1] = prot_id;
+   pthread_mutex_unlock(&traceLock);
+}
+
+
+/**
+ * Returns the current time for the traces, in nanoseconds since the epoch, so that the traces
+ * of different processes can be merged (as accurate as the clocks of the nodes are synchronized).
+ */
+uint64_t Synapse::TraceTime(void)
+{
+   struct timeval now;
+   gettimeofday(&now, NULL);
+   return ((uint64_t)now.tv_sec * 1000000 + now.tv_usec) * 1000;
+}
+
+
+/**
+ * Records an event in the buffer of the calling thread.
+ * @param kind   What is traced.
+ * @param value  Protocol, phase or tag, depending on the kind.
+ * @param stream Stream ID of the sends and receives; -1 otherwise.
+ * @param begin  When the event started (see TraceTime).
+ * @param end    When the event ended.
+ */
+void Synapse::TraceEvent(TraceKind kind, uint32_t value, int32_t stream, uint64_t begin, uint64_t end)
+{
+   if (threadBuffer == NULL)
+   {
+      threadBuffer = new ThreadBuffer;
+      threadBuffer->dropped = 0;
+      threadBuffer->records.reserve(bufferEvents < 4096 ? bufferEvents : 4096);
+
+      pthread_mutex_lock(&traceLock);
+      threadBuffers.push_back(threadBuffer);
+      threadBuffer->thread = threadBuffers.size();
+      pthread_mutex_unlock(&traceLock);
+   }
+   if (threadBuffer->records.size() >= bufferEvents)
+   {
+      threadBuffer->dropped ++;
+      return;
+   }
+
+   TraceRecord record;
+   record.kind   = kind;
+   record.value  = value;
+   record.stream = stream;
+   record.begin  = begin;
+   record.end    = end;
+   threadBuffer->records.push_back(record);
+}
+
+
+/**
+ * Returns the name of the value of an event.
+ */
+static string ValueName(TraceRecord &record)
+{
+   stringstream ss;
+
+   switch (record.kind)
+   {
+      case TRACE_DISPATCH:
+      case TRACE_BARRIER:
+         if (protocolNames.find(record.value) != protocolNames.end()) return protocolNames[record.value];
+         ss << "Protocol #" << record.value - 1;
+         break;
+      case TRACE_PHASE:
+         if (record.value < NUM_TRACE_PHASES) return PhaseNames[record.value];
+         break;
+      default:
+         if ((record.value >= (uint32_t)FirstApplicationTag) && (record.value < (uint32_t)TAG_ANY)) 
+            return TagNames[record.value - FirstApplicationTag];
+         ss << "Tag " << record.value;
+         break;
+   }
+   return ss.str();
+}
+
+
+static bool ComparePoints(const TracePoint &a, const TracePoint &b)
+{
+   return (a.time < b.time);
+}
+
+
+/**
+ * Writes the Paraver trace (.prv) and its configuration (.pcf). The times are absolute, and the process 
+ * is task 'task' of a single application, so that synapse-trace-merge can put all the processes together.
+ */
+static int WriteParaver(string prefix, unsigned int task, unsigned int num_threads, vector<TracePoint> &points)
+{
+   string prv = prefix + ".prv", pcf = prefix + ".pcf";
+
+   FILE *f;
+   if ((f = fopen(prv.c_str(), "w")) == NULL)
+   {
+      perror("fopen");
+      return -1;
+   }
+
+   /* #Paraver (date):duration_ns:nodes(cpus):applications:tasks(threads:node,...) */
+   char       date[32];
+   time_t     now = time(NULL);
+   strftime(date, sizeof(date), "%d/%m/%y at %H:%M", localtime(&now));
+   fprintf(f, "#Paraver (%s):%llu_ns:1(%u):1:%u(", date, 
+           (unsigned long long)(points.size() > 0 ? points.back().time : 0), task, task);
+   for (unsigned int t=1; t<=task; t++)
+   {
+      fprintf(f, "%u:1%s", (t == task ? num_threads : 1), (t == task ? ")\n" : ","));
+   }
+
+   for (unsigned int i=0; i<points.size(); i++)
+   {
+      TracePoint  &point  = points[i];
+      TraceRecord *record = point.record;
+      fprintf(f, "2:%u:1:%u:%u:%llu:%u:%u", task, task, point.thread, (unsigned long long)point.time, 
+              TRACE_TYPE_BASE + record->kind, (point.end ? 0 : record->value));
+      if (record->stream >= 0)
+      {
+         fprintf(f, ":%u:%u", TRACE_TYPE_STREAM, (point.end ? 0 : record->stream + 1));
+      }
+      fprintf(f, "\n");
+   }
+   if (fclose(f) != 0)
+   {
+      perror("fclose");
+      return -1;
+   }
+
+   ofstream ofs(pcf.c_str());
+   if (! ofs)
+   {
+      cerr << "ERROR: FlushTrace: Can not write " << pcf << endl;
+      return -1;
+   }
+   for (unsigned int k=0; k<NUM_TRACE_KINDS; k++)
+   {
+      ofs << "EVENT_TYPE" << endl << "0    " << TRACE_TYPE_BASE + k << "    " << KindNames[k] << endl << "VALUES" << endl;
+      ofs << "0      End" << endl;
+      if ((k == TRACE_DISPATCH) || (k == TRACE_BARRIER))
+      {
+         for (map<unsigned int, string>::iterator it = protocolNames.begin(); it != protocolNames.end(); ++it)
+            ofs << it->first << "      " << it->second << endl;
+      }
+      else if (k == TRACE_PHASE)
+      {
+         for (unsigned int ph=1; ph<NUM_TRACE_PHASES; ph++) ofs << ph << "      " << PhaseNames[ph] << endl;
+      }
+      else
+      {
+         for (unsigned int tag=FirstApplicationTag; tag<(unsigned int)TAG_ANY; tag++) 
+            ofs << tag << "      " << TagNames[tag - FirstApplicationTag] << endl;
+      }
+      ofs << endl << endl;
+   }
+   ofs << "EVENT_TYPE" << endl << "0    " << TRACE_TYPE_STREAM << "    Synapse stream (ID + 1)" << endl;
+   return 0;
+}
+
+
+/**
+ * Escapes a string to be written between quotes in JSON, as the traces and the metrics dumps do. 
+ * The protocol identifiers and stream labels are chosen by the users and can contain anything.
+ * @param str The string.
+ * @return the string with quotes, backslashes and control characters escaped.
+ */
+string Synapse::JSONEscape(const string &str)
+{
+   string escaped;
+
+   for (unsigned int i=0; i<str.size(); i++)
+   {
+      unsigned char c = str[i];
+
+      if ((c == '"') || (c == '\\'))
+      {
+         escaped += '\\';
+         escaped += c;
+      }
+      else if (c < 0x20)
+      {
+         char code[8];
+         snprintf(code, sizeof(code), "\\u%04x", c);
+         escaped += code;
+      }
+      else
+      {
+         escaped += c;
+      }
+   }
+   return escaped;
+}
+
+
+/**
+ * Writes the Chrome trace (JSON, one event per line), with the process as pid 'task'.
+ */
+static int WriteChrome(string prefix, string process, unsigned int task, vector<TraceRecord *> &records, vector<unsigned int> &threads)
+{
+   string json = prefix + ".json";
+
+   FILE *f;
+   if ((f = fopen(json.c_str(), "w")) == NULL)
+   {
+      perror("fopen");
+      return -1;
+   }
+   fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+   fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %u, \"args\": {\"name\": \"%s\"}},\n", task, JSONEscape(process).c_str());
+   fprintf(f, "{\"name\": \"process_sort_index\", \"ph\": \"M\", \"pid\": %u, \"args\": {\"sort_index\": %u}}", task, task);
+   for (unsigned int i=0; i<records.size(); i++)
+   {
+      TraceRecord *record = records[i];
+      string       name   = ValueName(*record);
+
+      if ((record->kind == TRACE_SEND) || (record->kind == TRACE_RECV))
+      {
+         name = string(record->kind == TRACE_SEND ? "send " : "recv ") + name;
+      }
+      else if (record->kind == TRACE_BARRIER)
+      {
+         name = "Barrier " + name;
+      }
+      fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %llu.%03u, \"dur\": %llu.%03u, \"pid\": %u, \"tid\": %u",
+              JSONEscape(name).c_str(), KindNames[record->kind], 
+              (unsigned long long)(record->begin / 1000), (unsigned int)(record->begin % 1000),
+              (unsigned long long)((record->end - record->begin) / 1000), (unsigned int)((record->end - record->begin) % 1000),
+              task, threads[i]);
+      if (record->stream >= 0) fprintf(f, ", \"args\": {\"stream\": %d}", record->stream);
+      fprintf(f, "}");
+   }
+   fprintf(f, "\n]}\n");
+   if (fclose(f) != 0)
+   {
+      perror("fclose");
+      return -1;
+   }
+   return 0;
+}
+
+
+/**
+ * Writes the events of all the threads and empties the buffers. Called at Shutdown, when the other
+ * threads are no longer tracing. The format is SYNAPSE_TRACE_FORMAT ("paraver", "chrome" or "both", the default).
+ * @param prefix  Path of the output without extension (.prv, .pcf and .json are appended).
+ * @param process Name of this process ("fe", "be<rank>").
+ * @param task    Number of this process in the merged timeline (Paraver task and Chrome pid).
+ * @return 0 on success; -1 otherwise.
+ */
+int Synapse::FlushTrace(string prefix, string process, unsigned int task)
+{
+   vector<TracePoint>    points;
+   vector<TraceRecord *> records;
+   vector<unsigned int>  threads;
+   uint64_t              dropped = 0;
+   int                   rc = 0;
+
+   pthread_mutex_lock(&traceLock);
+   for (unsigned int i=0; i<threadBuffers.size(); i++)
+   {
+      ThreadBuffer *buffer = threadBuffers[i];
+      for (unsigned int j=0; j<buffer->records.size(); j++)
+      {
+         TracePoint point;
+         point.thread = buffer->thread;
+         point.record = &buffer->records[j];
+         point.time   = point.record->begin;
+         point.end    = false;
+         points.push_back(point);
+         point.time   = point.record->end;
+         point.end    = true;
+         points.push_back(point);
+
+         records.push_back(point.record);
+         threads.push_back(buffer->thread);
+      }
+      dropped += buffer->dropped;
+   }
+   std::stable_sort(points.begin(), points.end(), ComparePoints);
+
+   char *env_SYNAPSE_TRACE_FORMAT = getenv("SYNAPSE_TRACE_FORMAT");
+   string format = (env_SYNAPSE_TRACE_FORMAT != NULL ? env_SYNAPSE_TRACE_FORMAT : "both");
+   if ((format != "chrome") && (WriteParaver(prefix, task, (threadBuffers.size() > 0 ? threadBuffers.size() : 1), points) != 0)) rc = -1;
+   if ((format != "paraver") && (WriteChrome(prefix, process, task, records, threads) != 0)) rc = -1;
+
+   for (unsigned int i=0; i<threadBuffers.size(); i++)
+   {
+      threadBuffers[i]->records.clear();
+      threadBuffers[i]->dropped = 0;
+   }
+   pthread_mutex_unlock(&traceLock);
+
+   if (dropped > 0)
+   {
+      cerr << "WARNING: FlushTrace: " << dropped << " events were lost because the trace buffers were full (see SYNAPSE_TRACE_BUFFER)" << endl;
+   }
+   return rc;
+}
+
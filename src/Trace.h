@@ -0,0 +1,116 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+/* Outside the guard for the same reason as in Metrics.h: MRNet_typed.h traces its sends and receives */
+#include "MRNet_wrappers.h"
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <string>
+#include <stdint.h>
+#include <sys/time.h>
+
+#define TRACE_BUFFER_EVENTS 1048576 /* Default events kept per thread (can be overriden with SYNAPSE_TRACE_BUFFER) */
+
+/* Paraver event types. Every kind of event has its own type so that they can nest */
+#define TRACE_TYPE_BASE 70000000
+
+/* Traces the rest of the enclosing block, for the macros that are not functions */
+#define TRACE_BLOCK(kind, value, stream) Synapse::TraceScope trace_scope((kind), (value), (stream))
+
+using std::string;
+
+namespace Synapse {
+
+/* What is traced. The values are the offsets of their Paraver event types */
+typedef enum
+{
+   TRACE_DISPATCH,  /* FE: sending a request, and completing it (value: protocol index + 1)     */
+   TRACE_PHASE,     /* FE and BE: a phase of the control plane (value: TracePhase)               */
+   TRACE_BARRIER,   /* FE and BE: blocked in a barrier (value: protocol index + 1)               */
+   TRACE_SEND,      /* Wrapped send (value: tag)                                                 */
+   TRACE_RECV,      /* Wrapped receive, including the wait for the packet (value: tag received) */
+   NUM_TRACE_KINDS
+} TraceKind;
+
+#define TRACE_TYPE_STREAM (TRACE_TYPE_BASE + NUM_TRACE_KINDS) /* Stream of the sends and receives */
+
+typedef enum
+{
+   TRACE_REQUEST_SEND = 1, /* FE: broadcast of TAG_PROT_ID / TAG_PROT_BATCH (0 ends the phase in Paraver) */
+   TRACE_FE_RUN,           /* FE: Protocol::Run                                         */
+   TRACE_ACK_REDUCTION,    /* FE: waiting for the reduction of the TAG_ACK              */
+   TRACE_WAIT_REQUEST,     /* BE: BackEnd::Loop waiting for the next request            */
+   TRACE_PRE_CALLBACK,     /* BE: pre-protocol callback of BackEnd::Loop                */
+   TRACE_BE_RUN,           /* BE: Protocol::Run                                         */
+   TRACE_POST_CALLBACK,    /* BE: post-protocol callback of BackEnd::Loop               */
+   TRACE_ACK_SEND,         /* BE: sending the TAG_ACK of the request                    */
+   TRACE_ANNOUNCE,         /* FE: AnnounceStreams; BE: receiving the announced streams  */
+   NUM_TRACE_PHASES
+} TracePhase;
+
+extern bool traceEnabled;
+
+void     EnableTrace      (bool enable=true);
+void     TraceProtocolName(unsigned int prot_idx, string prot_id);
+void     TraceEvent       (TraceKind kind, uint32_t value, int32_t stream, uint64_t begin, uint64_t end);
+uint64_t TraceTime        (void);
+int      FlushTrace       (string prefix, string process, unsigned int task);
+string   JSONEscape       (const string &str);
+
+/**
+ * Traces an event from its construction to its destruction. Does nothing unless the tracing is enabled.
+ */
+class TraceScope
+{
+   public:
+      TraceScope(TraceKind kind, uint32_t value, STREAM *stream=NULL)
+      {
+         active = traceEnabled;
+         if (active)
+         {
+            this->kind   = kind;
+            this->value  = value;
+            this->stream = (stream != NULL ? (int32_t)STREAM_get_Id(stream) : -1);
+            begin = TraceTime();
+         }
+      }
+      ~TraceScope()
+      {
+         if (active) TraceEvent(kind, value, stream, begin, TraceTime());
+      }
+      /* Change what is recorded, e.g. the tag actually received */
+      void SetValue(uint32_t value) { this->value = value; }
+      void SetStream(STREAM *stream) { if ((active) && (stream != NULL)) this->stream = STREAM_get_Id(stream); }
+
+   private:
+      bool      active;
+      TraceKind kind;
+      uint32_t  value;
+      int32_t   stream;
+      uint64_t  begin;
+};
+
+} /* namespace Synapse */
+
+#endif /* __TRACE_H__ */
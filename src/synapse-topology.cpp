@@ -0,0 +1,109 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "TopologyGenerator.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using namespace Synapse;
+
+/**
+ * Prints the command-line help.
+ */
+static void Usage(const char *prog)
+{
+   cerr << "Usage: " << prog << " -n <back-ends> [-f <fan-out> | -d <depth>] [-h <hosts file>] [-b <back-ends hosts file>]" << endl
+        << "       " << "[-r <front-end host>] [-s] [-o <topology file>]" << endl
+        << endl
+        << "Generates a balanced MRNet topology for the given number of back-ends." << endl
+        << "  -n  Number of back-ends." << endl
+        << "  -f  Maximum children per process (default " << DEFAULT_TOPOLOGY_FANOUT << ")." << endl
+        << "  -d  Levels from the front-end to the back-ends, the fan-out is derived from it." << endl
+        << "  -h  File with the hosts for the internal processes, one per line (default: local host)." << endl
+        << "  -b  File with the host of every back-end in rank order, to place the leaves next to them." << endl
+        << "  -r  Host of the front-end (default: local host)." << endl
+        << "  -s  The back-ends are spawned by MRNet and are included as the leaves of the topology." << endl
+        << "      Otherwise, they attach to the leaves later (FrontEnd::Init with a connections file)." << endl
+        << "  -o  Output file (default: standard output)." << endl;
+}
+
+int main(int argc, char *argv[])
+{
+   int            opt;
+   unsigned int   numBackends  = 0;
+   unsigned int   fanout       = 0, depth = 0;
+   bool           withBackends = false;
+   const char    *output       = NULL;
+   string         feHost;
+   vector<string> hosts, beHosts;
+
+   while ((opt = getopt(argc, argv, "n:f:d:h:b:r:so:")) != -1)
+   {
+      switch (opt)
+      {
+         case 'n': numBackends = atoi(optarg); break;
+         case 'f': fanout      = atoi(optarg); break;
+         case 'd': depth       = atoi(optarg); break;
+         case 'h': if (TopologyGenerator::ReadHosts(optarg, hosts)   != 0) return EXIT_FAILURE; break;
+         case 'b': if (TopologyGenerator::ReadHosts(optarg, beHosts) != 0) return EXIT_FAILURE; break;
+         case 'r': feHost       = optarg; break;
+         case 's': withBackends = true;   break;
+         case 'o': output       = optarg; break;
+         default:
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+      }
+   }
+   if (numBackends == 0)
+   {
+      Usage(argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if (feHost.empty())
+   {
+      char local[256];
+      if (gethostname(local, sizeof(local)) != 0) strcpy(local, "localhost");
+      local[sizeof(local) - 1] = '\0';
+      feHost = local;
+   }
+
+   TopologyGenerator generator(feHost, hosts);
+   generator.SetBackendHosts(beHosts);
+   generator.SetFanout(fanout);
+   generator.SetDepth(depth);
+
+   if (output != NULL)
+   {
+      return (generator.Write(output, numBackends, withBackends) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+   }
+
+   string topology;
+   if (generator.Generate(numBackends, withBackends, topology) != 0) return EXIT_FAILURE;
+   cout << topology;
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,242 @@
+/*****************************************************************************\
+ *                              Synapse library                              *
+ *               Simple interface to create MRNet applications               *
+ *****************************************************************************
+ *     ___          This library is free software; you can redistribute it   *
+ *    /  __         and/or modify it under the terms of the GNU LGPL as pub- *
+ *   /  /  _____    lished by the Free Software Foundation; either version   *
+ *  /  /  /     \   2.1 of the License or (at your option) any later version.*
+ * (  (  ( B S C )                                                           *
+ *  \  \  \_____/   This library is distributed in hope that it will be      *
+ *   \  \__         useful but WITHOUT ANY WARRANTY; without even the        *
+ *    \___          implied warranty of MERCHANTABILITY or FITNESS FOR A     *
+ *                  PARTICULAR PURPOSE. See the GNU LGPL for more details.   *
+ *                                                                           *
+ * You should have received a copy of the GNU Lesser General Public License  *
+ * along with this library; if not, write to the Free Software Foundation,   *
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA          *
+ * The GNU LEsser General Public License is contained in the file COPYING.   *
+ * ------------------------------------------------------------------------- *
+ *   Barcelona Supercomputing Center - Centro Nacional de Supercomputacion   *
+\*****************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::endl;
+using std::ifstream;
+using std::ofstream;
+using std::string;
+using std::stringstream;
+using std::vector;
+using std::map;
+
+/* A record of a Paraver trace, with the fields that are rewritten when merging */
+typedef struct
+{
+   uint64_t     time;
+   unsigned int task;
+   unsigned int thread;
+   string       line;
+} PrvRecord;
+
+/**
+ * Prints the command-line help.
+ */
+static void Usage(const char *prog)
+{
+   cerr << "Usage: " << prog << " -o <output prefix> <trace files...>" << endl
+        << endl
+        << "Merges the traces written by the front-end and the back-ends (SYNAPSE_TRACE) into a single timeline." << endl
+        << "  Paraver traces (.prv) are merged into <output prefix>.prv and .pcf, with the times relative to the" << endl
+        << "  first event. Chrome traces (.json) are merged into <output prefix>.json." << endl;
+}
+
+
+static bool CompareRecords(const PrvRecord &a, const PrvRecord &b)
+{
+   return (a.time < b.time);
+}
+
+
+/**
+ * Splits a Paraver record in its colon-separated fields.
+ */
+static void SplitFields(const string &line, vector<string> &fields)
+{
+   stringstream ss(line);
+   string       field;
+
+   fields.clear();
+   while (getline(ss, field, ':')) fields.push_back(field);
+}
+
+
+/**
+ * Merges Paraver traces. The tasks keep the number they were given by every process, and the
+ * times are rebased to the first event of all the traces.
+ */
+static int MergeParaver(string output, vector<string> &inputs)
+{
+   vector<PrvRecord>            records;
+   map<unsigned int, unsigned int> threads; /* Threads of every task */
+   unsigned int                 numTasks = 0;
+   uint64_t                     first = (uint64_t)-1, last = 0;
+   vector<string>               fields;
+
+   for (unsigned int i=0; i<inputs.size(); i++)
+   {
+      ifstream ifs(inputs[i].c_str());
+      if (! ifs)
+      {
+         cerr << "ERROR: Can not read " << inputs[i] << endl;
+         return -1;
+      }
+      string line;
+      while (getline(ifs, line))
+      {
+         /* Only event records are written by Synapse, the header is rebuilt */
+         if ((line.size() < 2) || (line.compare(0, 2, "2:") != 0)) continue;
+
+         SplitFields(line, fields);
+         if (fields.size() < 8) continue;
+
+         PrvRecord record;
+         record.task   = atoi(fields[3].c_str());
+         record.thread = atoi(fields[4].c_str());
+         record.time   = strtoull(fields[5].c_str(), NULL, 10);
+         record.line   = line.substr(fields[0].size() + fields[1].size() + fields[2].size() + fields[3].size() + 
+                                     fields[4].size() + fields[5].size() + 6);
+         records.push_back(record);
+
+         if (record.time < first) first = record.time;
+         if (record.time > last)  last  = record.time;
+         if (record.task > numTasks) numTasks = record.task;
+         if (record.thread > threads[record.task]) threads[record.task] = record.thread;
+      }
+   }
+   if (records.size() == 0)
+   {
+      cerr << "ERROR: No events found in the Paraver traces" << endl;
+      return -1;
+   }
+   std::stable_sort(records.begin(), records.end(), CompareRecords);
+
+   string prv = output + ".prv";
+   ofstream ofs(prv.c_str());
+   if (! ofs)
+   {
+      cerr << "ERROR: Can not write " << prv << endl;
+      return -1;
+   }
+   ofs << "#Paraver (01/01/70 at 00:00):" << last - first << "_ns:1(" << numTasks << "):1:" << numTasks << "(";
+   for (unsigned int t=1; t<=numTasks; t++)
+   {
+      ofs << (threads[t] > 0 ? threads[t] : 1) << ":1" << (t < numTasks ? "," : ")\n");
+   }
+   for (unsigned int i=0; i<records.size(); i++)
+   {
+      PrvRecord &record = records[i];
+      ofs << "2:" << record.task << ":1:" << record.task << ":" << record.thread << ":" << record.time - first << ":" << record.line << "\n";
+   }
+   ofs.close();
+
+   /* The event names are the same in all the processes */
+   string in_pcf  = inputs[0].substr(0, inputs[0].size() - 4) + ".pcf";
+   string out_pcf = output + ".pcf";
+   ifstream pcf_in(in_pcf.c_str());
+   ofstream pcf_out(out_pcf.c_str());
+   if ((! pcf_in) || (! pcf_out))
+   {
+      cerr << "WARNING: Could not copy " << in_pcf << " to " << out_pcf << endl;
+   }
+   else
+   {
+      pcf_out << pcf_in.rdbuf();
+   }
+   return 0;
+}
+
+
+/**
+ * Merges Chrome traces, which are written by Synapse with one event per line.
+ */
+static int MergeChrome(string output, vector<string> &inputs)
+{
+   string json = output + ".json";
+   ofstream ofs(json.c_str());
+   if (! ofs)
+   {
+      cerr << "ERROR: Can not write " << json << endl;
+      return -1;
+   }
+
+   bool first = true;
+   ofs << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+   for (unsigned int i=0; i<inputs.size(); i++)
+   {
+      ifstream ifs(inputs[i].c_str());
+      if (! ifs)
+      {
+         cerr << "ERROR: Can not read " << inputs[i] << endl;
+         return -1;
+      }
+      string line;
+      while (getline(ifs, line))
+      {
+         if ((line.size() > 0) && (line[line.size() - 1] == ',')) line.erase(line.size() - 1);
+         if ((line.size() == 0) || (line[0] != '{') || (line.compare(0, 2, "{\"") != 0) || 
+             (line.find("\"traceEvents\"") != string::npos)) continue;
+
+         ofs << (first ? "\n" : ",\n") << line;
+         first = false;
+      }
+   }
+   ofs << "\n]}\n";
+   return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+   int            opt;
+   string         output;
+   vector<string> prv_inputs, json_inputs;
+
+   while ((opt = getopt(argc, argv, "o:")) != -1)
+   {
+      switch (opt)
+      {
+         case 'o': output = optarg; break;
+         default:
+            Usage(argv[0]);
+            return EXIT_FAILURE;
+      }
+   }
+   for (int i=optind; i<argc; i++)
+   {
+      string input = argv[i];
+      if      ((input.size() > 4) && (input.compare(input.size() - 4, 4, ".prv")  == 0)) prv_inputs.push_back(input);
+      else if ((input.size() > 5) && (input.compare(input.size() - 5, 5, ".json") == 0)) json_inputs.push_back(input);
+      else cerr << "WARNING: Ignoring " << input << " (not a .prv or .json trace)" << endl;
+   }
+   if ((output == "") || (prv_inputs.size() + json_inputs.size() == 0))
+   {
+      Usage(argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if ((prv_inputs.size()  > 0) && (MergeParaver(output, prv_inputs)  != 0)) return EXIT_FAILURE;
+   if ((json_inputs.size() > 0) && (MergeChrome (output, json_inputs) != 0)) return EXIT_FAILURE;
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include "Protocol.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using namespace Synapse;
+
+/**
+ * Tests of the flow control of StreamLarge/ReceiveLarge: how the buffers are split in chunks, and
+ * that the credits given by the receiver let the sender finish without ever having more than a
+ * window of chunks in flight.
+ */
+
+static int errors = 0;
+
+#define CHECK(cond, what)                               \
+{                                                       \
+   if (! (cond))                                        \
+   {                                                    \
+      cerr << "FAILED: " << what << endl;               \
+      errors ++;                                        \
+   }                                                    \
+}
+
+static void TestChunkCount()
+{
+   CHECK(Protocol::ChunkCount(0, 0) == 1,          "an empty buffer is sent as one empty chunk");
+   CHECK(Protocol::ChunkCount(0, 65536) == 1,      "an empty buffer with a chunk size");
+   CHECK(Protocol::ChunkCount(1, 1) == 1,          "one byte");
+   CHECK(Protocol::ChunkCount(65536, 65536) == 1,  "a buffer of exactly one chunk");
+   CHECK(Protocol::ChunkCount(65537, 65536) == 2,  "one byte over a chunk");
+   CHECK(Protocol::ChunkCount(10 * 4096, 4096) == 10, "a whole number of chunks");
+   CHECK(Protocol::ChunkCount((uint64_t)1 << 32, 1 << 16) == 65536, "a buffer over 4 GB");
+}
+
+static void TestCreditsToGrant()
+{
+   /* Transfers that fit in the window never need credits */
+   CHECK(Protocol::CreditsToGrant(1, 0, 1, 1) == 0, "window 1, empty buffer");
+   CHECK(Protocol::CreditsToGrant(1, 0, 8, 1) == 0, "window 8, empty buffer");
+   CHECK(Protocol::CreditsToGrant(8, 0, 8, 8) == 0, "window 8, 8 chunks");
+
+   /* Window 1 and 2 give one credit per chunk consumed */
+   CHECK(Protocol::CreditsToGrant(1, 0, 1, 3) == 1, "window 1, first chunk");
+   CHECK(Protocol::CreditsToGrant(2, 1, 1, 3) == 1, "window 1, second chunk");
+   CHECK(Protocol::CreditsToGrant(3, 2, 1, 3) == 0, "window 1, all credits given");
+   CHECK(Protocol::CreditsToGrant(1, 0, 2, 5) == 1, "window 2, first chunk");
+   CHECK(Protocol::CreditsToGrant(1, 1, 2, 5) == 0, "window 2, credit already given");
+
+   /* Window 8 gives half a window at a time, and no more than the chunks left */
+   CHECK(Protocol::CreditsToGrant(3, 0, 8, 20) == 0, "window 8, before half a window");
+   CHECK(Protocol::CreditsToGrant(4, 0, 8, 20) == 4, "window 8, half a window");
+   CHECK(Protocol::CreditsToGrant(8, 4, 8, 14) == 2, "window 8, last credits");
+   CHECK(Protocol::CreditsToGrant(12, 6, 8, 14) == 0, "window 8, all credits given");
+}
+
+/**
+ * Runs a transfer where the sender sends while it has credits and the receiver only consumes
+ * when the sender is blocked, which keeps the most chunks in flight.
+ */
+static void Simulate(unsigned int num_chunks, unsigned int window)
+{
+   unsigned int sent = 0, consumed = 0, granted = 0;
+
+   while (consumed < num_chunks)
+   {
+      if ((sent < num_chunks) && (sent < window + granted))
+      {
+         sent ++;
+         if (sent - consumed > window)
+         {
+            cerr << "FAILED: " << num_chunks << " chunks, window " << window << ": " << sent - consumed << " chunks in flight" << endl;
+            errors ++;
+            return;
+         }
+      }
+      else if (consumed < sent)
+      {
+         consumed ++;
+         granted += Protocol::CreditsToGrant(consumed, granted, window, num_chunks);
+      }
+      else
+      {
+         cerr << "FAILED: " << num_chunks << " chunks, window " << window << ": the sender blocks after " << sent << " chunks" << endl;
+         errors ++;
+         return;
+      }
+   }
+   CHECK(granted == (num_chunks > window ? num_chunks - window : 0),
+         num_chunks << " chunks, window " << window << ": " << granted << " credits given");
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned int windows[] = { 1, 2, 8 };
+
+   TestChunkCount();
+   TestCreditsToGrant();
+
+   for (unsigned int w=0; w<sizeof(windows)/sizeof(windows[0]); w++)
+   {
+      Simulate(Protocol::ChunkCount(0, 0), windows[w]);
+      for (unsigned int num_chunks=1; num_chunks<=50; num_chunks++)
+      {
+         Simulate(num_chunks, windows[w]);
+      }
+   }
+
+   if (errors > 0)
+   {
+      cerr << errors << " errors" << endl;
+      return 1;
+   }
+   cout << "Chunking tests passed" << endl;
+   return 0;
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include "MRNet_wrappers.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::vector;
+using namespace Synapse;
+
+/**
+ * Tests of the LZF codec of the compressed payloads (Compression.h): buffers of different shapes
+ * survive a round trip, payloads that do not shrink are left uncompressed, and corrupt payloads
+ * or sizes that the data can not produce are rejected.
+ */
+
+static int errors = 0;
+
+#define CHECK(cond, what)                               \
+{                                                       \
+   if (! (cond))                                        \
+   {                                                    \
+      cerr << "FAILED: " << what << endl;               \
+      errors ++;                                        \
+   }                                                    \
+}
+
+/**
+ * Compresses and decompresses a buffer with the payload functions, as SendPayload and UnpackPayload do.
+ */
+static void RoundTrip(const char *name, const vector<unsigned char> &in, bool compressible)
+{
+   vector<unsigned char> packed, out;
+   unsigned int          codec = CompressPayload((in.empty() ? NULL : &in[0]), in.size(), 0, packed);
+
+   CHECK((codec == COMPRESSION_LZF) == compressible, name << ": codec " << codec);
+   if (codec == COMPRESSION_LZF)
+   {
+      CHECK(packed.size() < in.size(), name << ": " << packed.size() << " compressed bytes from " << in.size());
+      CHECK((DecompressPayload(codec, &packed[0], packed.size(), in.size(), out) == 0) && (out == in), name << ": round trip");
+   }
+   else
+   {
+      CHECK((DecompressPayload(codec, (in.empty() ? NULL : &in[0]), in.size(), in.size(), out) == 0) && (out == in), name << ": uncompressed");
+   }
+}
+
+static void TestRoundTrips()
+{
+   vector<unsigned char> buffer;
+
+   RoundTrip("empty", buffer, false);
+
+   buffer.assign(1, 'x');
+   RoundTrip("one byte", buffer, false);
+
+   /* The longest matches */
+   buffer.assign(100000, 0);
+   RoundTrip("zeros", buffer, true);
+
+   /* Short matches between literals */
+   buffer.clear();
+   for (int i=0; i<50000; i++)
+   {
+      buffer.push_back("synapse"[i % 7]);
+      if (i % 13 == 0) buffer.push_back(i & 0xff);
+   }
+   RoundTrip("text", buffer, true);
+
+   /* Matches at the largest offsets */
+   srand(1);
+   vector<unsigned char> block;
+   for (int i=0; i<LZF_MAX_OFFSET - 1; i++) block.push_back(rand() & 0xff);
+   buffer = block;
+   buffer.insert(buffer.end(), block.begin(), block.end());
+   buffer.insert(buffer.end(), block.begin(), block.end());
+   RoundTrip("far matches", buffer, true);
+
+   /* Random data does not compress */
+   buffer.clear();
+   for (int i=0; i<10000; i++) buffer.push_back(rand() & 0xff);
+   RoundTrip("random", buffer, false);
+}
+
+static void TestThreshold()
+{
+   vector<unsigned char> buffer(1000, 'a'), packed;
+
+   CHECK(CompressPayload(&buffer[0], buffer.size(), 1024, packed) == COMPRESSION_NONE, "below the threshold");
+   CHECK(CompressPayload(&buffer[0], buffer.size(), 1000, packed) == COMPRESSION_LZF,  "at the threshold");
+}
+
+static void TestCorrupt()
+{
+   vector<unsigned char> buffer(10000, 'a'), packed, out;
+
+   CompressPayload(&buffer[0], buffer.size(), 0, packed);
+
+   CHECK(DecompressPayload(COMPRESSION_LZF, &packed[0], packed.size(), buffer.size() + 1, out) == -1, "wrong uncompressed size");
+   CHECK(DecompressPayload(COMPRESSION_LZF, &packed[0], packed.size() - 1, buffer.size(), out) == -1, "truncated payload");
+   CHECK(DecompressPayload(COMPRESSION_LZF, &packed[0], packed.size(), 0, out) == -1, "empty uncompressed size");
+   CHECK(DecompressPayload(7, &packed[0], packed.size(), buffer.size(), out) == -1, "unknown codec");
+   CHECK(DecompressPayload(COMPRESSION_NONE, &buffer[0], buffer.size(), buffer.size() - 1, out) == -1, "uncompressed size mismatch");
+
+   /* A size that the payload can not expand to is rejected before allocating it */
+   CHECK(DecompressPayload(COMPRESSION_LZF, &packed[0], packed.size(), (uint64_t)1 << 50, out) == -1, "huge uncompressed size");
+   CHECK(DecompressPayload(COMPRESSION_LZF, &packed[0], packed.size(), (uint64_t)packed.size() * LZF_MAX_EXPANSION + 1, out) == -1,
+         "uncompressed size over the expansion limit");
+
+   /* A back-reference before the start of the output */
+   unsigned char bad[] = { 0, 'a', (2 << 5), 5 };
+   CHECK(DecompressPayload(COMPRESSION_LZF, bad, sizeof(bad), 5, out) == -1, "back-reference out of the output");
+}
+
+int main(int argc, char *argv[])
+{
+   TestRoundTrips();
+   TestThreshold();
+   TestCorrupt();
+
+   if (errors > 0)
+   {
+      cerr << errors << " errors" << endl;
+      return 1;
+   }
+   cout << "Compression tests passed" << endl;
+   return 0;
+}
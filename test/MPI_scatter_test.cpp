@@ -0,0 +1,80 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpi.h>
+#include "PendingConnections.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using namespace Synapse;
+
+/**
+ * Distributes the connections file among the tasks of a local MPI launch with 
+ * PendingConnections::ScatterParentInfo, the way BackEnd::InitMPI does before connecting, 
+ * in text and binary formats.
+ */
+
+static int Check(const char *file, ConnectionsFormat format, int rank, int size)
+{
+   char phost[64], pport[10], prank[10], expected[64];
+
+   if (rank == 0)
+   {
+      vector<ConnectionsRecord> records(size);
+      for (int i=0; i<size; i++)
+      {
+         memset(&records[i], 0, sizeof(ConnectionsRecord));
+         snprintf(records[i].host, CONNECTIONS_HOST_LEN, "cp%d", i / 2);
+         records[i].port       = 7000 + i;
+         records[i].parentRank = 1000 + i / 2;
+      }
+      PendingConnections writer(file, format);
+      if (writer.Write(records) != 0) return 1;
+   }
+
+   PendingConnections reader(file);
+   if (reader.ScatterParentInfo(MPI_COMM_WORLD, phost, pport, prank) != 0)
+   {
+      cerr << "Task " << rank << ": ScatterParentInfo failed" << endl;
+      return 1;
+   }
+
+   snprintf(expected, sizeof(expected), "cp%d", rank / 2);
+   if ((strcmp(phost, expected) != 0) || (atoi(pport) != 7000 + rank) || (atoi(prank) != 1000 + rank / 2))
+   {
+      cerr << "Task " << rank << ": wrong parent " << phost << ":" << pport << ":" << prank << endl;
+      return 1;
+   }
+   return 0;
+}
+
+int main(int argc, char *argv[])
+{
+   int rank, size, errors = 0, total = 0;
+   char text_file[64], binary_file[64];
+
+   MPI_Init(&argc, &argv);
+   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+   MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+   snprintf(text_file,   sizeof(text_file),   "mpi_scatter_test.%d.txt", (int)getpid());
+   snprintf(binary_file, sizeof(binary_file), "mpi_scatter_test.%d.bin", (int)getpid());
+   MPI_Bcast(text_file,   sizeof(text_file),   MPI_CHAR, 0, MPI_COMM_WORLD);
+   MPI_Bcast(binary_file, sizeof(binary_file), MPI_CHAR, 0, MPI_COMM_WORLD);
+
+   errors += Check(text_file,   CONNECTIONS_TEXT,   rank, size);
+   errors += Check(binary_file, CONNECTIONS_BINARY, rank, size);
+
+   MPI_Reduce(&errors, &total, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+   if (rank == 0)
+   {
+      unlink(text_file);
+      unlink(binary_file);
+      cout << (total == 0 ? "PASSED" : "FAILED") << endl;
+   }
+   MPI_Bcast(&total, 1, MPI_INT, 0, MPI_COMM_WORLD);
+   MPI_Finalize();
+   return (total == 0 ? 0 : 1);
+}
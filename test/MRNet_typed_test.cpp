@@ -0,0 +1,199 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <string.h>
+#include "MRNet_wrappers.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using namespace Synapse;
+
+/**
+ * Tests of the typed message layer (MRNet_typed.h): the formats derived from the types match the
+ * hand-written MRNet formats, and packets built with them, either from the typed send slots or
+ * from plain varargs as MRN_STREAM_SEND does, unpack back into the same values.
+ */
+
+typedef struct
+{
+   int32_t rank;
+   double  value;
+} Sample;
+
+MRN_TYPED_AS_BYTES(Sample)
+
+#define TEST_TAG 1000
+
+static int errors = 0;
+
+#define CHECK(cond, what)                               \
+{                                                       \
+   if (! (cond))                                        \
+   {                                                    \
+      cerr << "FAILED: " << what << endl;               \
+      errors ++;                                        \
+   }                                                    \
+}
+
+template <class A, class B> static string Format2()
+{
+   return MessageFormat(Field<A>::Format(), Field<B>::Format());
+}
+
+static void TestFormats()
+{
+   CHECK((Format2<int32_t, vector<double> >() == "%d %alf"),     "int32_t, vector<double>");
+   CHECK((Format2<uint32_t, uint32_t>()       == "%ud %ud"),     "uint32_t, uint32_t");
+   CHECK((Format2<int64_t, uint64_t>()        == "%ld %uld"),    "int64_t, uint64_t");
+   CHECK((Format2<char, unsigned char>()      == "%c %uc"),      "char, unsigned char");
+   CHECK((Format2<int16_t, uint16_t>()        == "%hd %uhd"),    "int16_t, uint16_t");
+   CHECK((Format2<float, double>()            == "%f %lf"),      "float, double");
+   CHECK((Format2<string, const char *>()     == "%s %s"),       "string, const char *");
+   CHECK((Format2<vector<int32_t>, vector<unsigned char> >() == "%ad %auc"), "vector<int32_t>, vector<unsigned char>");
+   CHECK((Format2<Sample, vector<Sample> >()  == "%auc %auc"),   "Sample, vector<Sample>");
+}
+
+static void TestScalars()
+{
+   /* Built like MRN_STREAM_SEND(stream, TEST_TAG, "%d %uld %lf", ...) */
+   PacketPtr p(new Packet(0, TEST_TAG, "%d %uld %lf", -5, (uint64_t)1 << 40, 3.25));
+   int32_t   i = 0;
+   uint64_t  u = 0;
+   double    d = 0;
+
+   CHECK((Unpack(p, i, u, d) == 0) && (i == -5) && (u == ((uint64_t)1 << 40)) && (d == 3.25), "unpack int32_t, uint64_t, double");
+
+   PacketPtr q(new Packet(0, TEST_TAG, "%c %uhd %f", 'x', 65000, 1.5));
+   char      c = 0;
+   uint16_t  h = 0;
+   float     f = 0;
+
+   CHECK((Unpack(q, c, h, f) == 0) && (c == 'x') && (h == 65000) && (f == 1.5), "unpack char, uint16_t, float");
+}
+
+static void TestStrings()
+{
+   PacketPtr p(new Packet(0, TEST_TAG, "%s %ud", "protocol", 7));
+   string    s;
+   uint32_t  n = 0;
+
+   CHECK((Unpack(p, s, n) == 0) && (s == "protocol") && (n == 7), "unpack string, uint32_t");
+
+   /* Sent from the typed slots */
+   string    sent = "from the slots";
+   PacketPtr q(new Packet(0, TEST_TAG, Field<string>::Format(), Field<string>::Slot0(sent)));
+   string    received;
+
+   CHECK((Unpack(q, received) == 0) && (received == sent), "string from the send slots");
+}
+
+static void TestVectors()
+{
+   vector<double>   values;
+   vector<uint32_t> ranks;
+
+   for (int i=0; i<100; i++)
+   {
+      values.push_back(i * 0.5);
+      ranks.push_back(i * 3);
+   }
+
+   /* Sent from the typed slots, as Send(stream, TEST_TAG, values, ranks) does */
+   string    format = Format2< vector<double>, vector<uint32_t> >();
+   PacketPtr p(new Packet(0, TEST_TAG, format.c_str(),
+                          Field< vector<double> >::Slot0(values),   Field< vector<double> >::Slot1(values),
+                          Field< vector<uint32_t> >::Slot0(ranks), Field< vector<uint32_t> >::Slot1(ranks)));
+   vector<double>   values_out;
+   vector<uint32_t> ranks_out;
+
+   CHECK((Unpack(p, values_out, ranks_out) == 0) && (values_out == values) && (ranks_out == ranks), "unpack vector<double>, vector<uint32_t>");
+
+   /* Empty vectors */
+   vector<int32_t> empty, empty_out(3, 1);
+   PacketPtr q(new Packet(0, TEST_TAG, "%ad", Field< vector<int32_t> >::Slot0(empty), Field< vector<int32_t> >::Slot1(empty)));
+
+   CHECK((Unpack(q, empty_out) == 0) && (empty_out.empty()), "unpack an empty vector");
+}
+
+static void TestStructs()
+{
+   Sample sample;
+   memset(&sample, 0, sizeof(sample));
+   sample.rank  = 42;
+   sample.value = -2.5;
+
+   PacketPtr p(new Packet(0, TEST_TAG, "%auc %d", Field<Sample>::Slot0(sample), Field<Sample>::Slot1(sample), 9));
+   Sample    sample_out;
+   int32_t   extra = 0;
+
+   CHECK((Unpack(p, sample_out, extra) == 0) && (sample_out.rank == 42) && (sample_out.value == -2.5) && (extra == 9), "unpack a struct");
+
+   vector<Sample> samples;
+   for (int i=0; i<10; i++)
+   {
+      sample.rank  = i;
+      sample.value = i * 1.25;
+      samples.push_back(sample);
+   }
+   PacketPtr q(new Packet(0, TEST_TAG, "%auc", Field< vector<Sample> >::Slot0(samples), Field< vector<Sample> >::Slot1(samples)));
+   vector<Sample> samples_out;
+
+   bool same = (Unpack(q, samples_out) == 0) && (samples_out.size() == samples.size());
+   for (unsigned int i=0; (same) && (i<samples.size()); i++)
+   {
+      same = (samples_out[i].rank == samples[i].rank) && (samples_out[i].value == samples[i].value);
+   }
+   CHECK(same, "unpack a vector of structs");
+
+   /* A byte array that is not a whole number of structs is rejected */
+   unsigned char bytes[sizeof(Sample) + 1];
+   memset(bytes, 0, sizeof(bytes));
+   PacketPtr r(new Packet(0, TEST_TAG, "%auc", bytes, (uint32_t)sizeof(bytes)));
+
+   CHECK(Unpack(r, sample_out) == -1, "reject a struct of the wrong size");
+   PacketPtr s(new Packet(0, TEST_TAG, "%auc", bytes, (uint32_t)sizeof(bytes)));
+   CHECK(Unpack(s, samples_out) == -1, "reject a partial struct in a vector");
+}
+
+static void TestSizes()
+{
+   /* The bytes counted in the metrics of the typed sends */
+   vector<double> values(100, 1.0);
+   string         name = "protocol";
+   Sample         sample;
+   memset(&sample, 0, sizeof(sample));
+
+   CHECK((Marshal2<FIELD_SCALAR, FIELD_SCALAR>::Size("%ud %ud", (uint32_t)1, (uint32_t)2) == 8), "size of uint32_t, uint32_t");
+   CHECK((Marshal2<FIELD_SCALAR, FIELD_ARRAY>::Size("%s %alf", name, values) == name.size() + 1 + 800), "size of string, vector<double>");
+   CHECK((Marshal3<FIELD_ARRAY, FIELD_SCALAR, FIELD_SCALAR>::Size("%auc %lf %c", sample, 1.0, 'x') == sizeof(Sample) + 9), "size of a struct, double, char");
+}
+
+static void TestMismatch()
+{
+   PacketPtr p(new Packet(0, TEST_TAG, "%d", 1));
+   double    d;
+
+   CHECK(Unpack(p, d) == -1, "reject a packet with other types");
+}
+
+int main(int argc, char *argv[])
+{
+   TestFormats();
+   TestScalars();
+   TestStrings();
+   TestVectors();
+   TestStructs();
+   TestSizes();
+   TestMismatch();
+
+   if (errors > 0)
+   {
+      cerr << errors << " errors" << endl;
+      return 1;
+   }
+   cout << "Typed message tests passed" << endl;
+   return 0;
+}
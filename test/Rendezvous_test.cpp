@@ -0,0 +1,124 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Rendezvous.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using namespace Synapse;
+
+#define NUM_BACKENDS 64
+#define NUM_CLIENTS  8
+
+/**
+ * Local-loopback test of the rendezvous service: a server publishes the parent of every 
+ * back-end, and several threads ask for them concurrently, as the back-ends would.
+ */
+
+static int port   = -1;
+static int errors = 0;
+static pthread_mutex_t errorsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void * Client(void *arg)
+{
+   long id = (long)arg;
+
+   for (int rank=id; rank<NUM_BACKENDS; rank+=NUM_CLIENTS)
+   {
+      ConnectionsRecord record;
+      char expected[CONNECTIONS_HOST_LEN];
+
+      snprintf(expected, sizeof(expected), "cp%d", rank / 8);
+      if ((RendezvousQuery("localhost", port, rank, record, 10) != 0) ||
+          (strcmp(record.host, expected) != 0) ||
+          (record.port != 7000 + rank / 8) || 
+          (record.parentRank != 1000 + rank / 8))
+      {
+         cerr << "Wrong answer for back-end " << rank << endl;
+         pthread_mutex_lock(&errorsLock);
+         errors ++;
+         pthread_mutex_unlock(&errorsLock);
+      }
+   }
+   return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+   RendezvousServer          server;
+   vector<ConnectionsRecord> records;
+   ConnectionsRecord         record;
+   pthread_t                 clients[NUM_CLIENTS];
+   struct timeval            start, end;
+
+   for (int rank=0; rank<NUM_BACKENDS; rank++)
+   {
+      memset(&record, 0, sizeof(record));
+      snprintf(record.host, sizeof(record.host), "cp%d", rank / 8);
+      record.port       = 7000 + rank / 8;
+      record.parentRank = 1000 + rank / 8;
+      records.push_back(record);
+   }
+
+   if (server.Start(0, records) != 0)
+   {
+      cerr << "Cannot start the rendezvous server" << endl;
+      return 1;
+   }
+   port = server.GetPort();
+   cout << "Rendezvous server listening on port " << port << endl;
+
+   /* A back-end that connects and never sends its rank must not delay the others */
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family      = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr.sin_port        = htons(port);
+   int stalled = socket(AF_INET, SOCK_STREAM, 0);
+   if (connect(stalled, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+   {
+      cerr << "Cannot connect the stalled client" << endl;
+      errors ++;
+   }
+
+   gettimeofday(&start, NULL);
+   for (long i=0; i<NUM_CLIENTS; i++)
+   {
+      pthread_create(&clients[i], NULL, Client, (void *)i);
+   }
+   for (int i=0; i<NUM_CLIENTS; i++)
+   {
+      pthread_join(clients[i], NULL);
+   }
+   gettimeofday(&end, NULL);
+   if (end.tv_sec - start.tv_sec >= RENDEZVOUS_CLIENT_TIMEOUT)
+   {
+      cerr << "The back-ends waited behind the stalled one" << endl;
+      errors ++;
+   }
+   close(stalled);
+
+   /* Unknown ranks are rejected */
+   if (RendezvousQuery("localhost", port, NUM_BACKENDS, record, 10) != -1)
+   {
+      cerr << "Back-end " << NUM_BACKENDS << " should be unknown" << endl;
+      errors ++;
+   }
+
+   /* Once stopped, the back-ends give up after the timeout */
+   server.Stop();
+   if (RendezvousQuery("localhost", port, 0, record, 1) != -1)
+   {
+      cerr << "The server should be stopped" << endl;
+      errors ++;
+   }
+
+   cout << (errors == 0 ? "PASSED" : "FAILED") << endl;
+   return (errors == 0 ? 0 : 1);
+}
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include "RingBuffer.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::vector;
+using namespace Synapse;
+
+#define RING_CAPACITY  64
+#define NUM_ITEMS      200000
+#define NUM_PRODUCERS  4
+
+/**
+ * Tests of the lock-free rings: full and empty conditions and wrap-around in a single thread,
+ * and FIFO order across threads with a small ring, so that the indexes wrap many times.
+ */
+
+static int errors = 0;
+
+#define CHECK(cond, what)                               \
+{                                                       \
+   if (! (cond))                                        \
+   {                                                    \
+      cerr << "FAILED: " << what << endl;               \
+      errors ++;                                        \
+   }                                                    \
+}
+
+template <class Ring> static void TestFullEmpty(const char *name)
+{
+   Ring     ring(3);
+   uint64_t value = 0;
+
+   CHECK(ring.Capacity() == 4, name << ": capacity rounded up to a power of two");
+   CHECK(! ring.Pop(value), name << ": pop from an empty ring");
+
+   /* Fill and drain several times so that the indexes wrap around the slots */
+   for (uint64_t round=0; round<10; round++)
+   {
+      for (uint64_t i=0; i<4; i++)
+      {
+         CHECK(ring.Push(round * 4 + i), name << ": push into a ring with free slots");
+      }
+      CHECK(! ring.Push(999), name << ": push into a full ring");
+      for (uint64_t i=0; i<4; i++)
+      {
+         CHECK(ring.Pop(value) && (value == round * 4 + i), name << ": pop in FIFO order");
+      }
+      CHECK(! ring.Pop(value), name << ": pop from a drained ring");
+   }
+
+   /* Interleaved pushes and pops with the ring half full */
+   ring.Push(0);
+   ring.Push(1);
+   for (uint64_t i=2; i<100; i++)
+   {
+      CHECK(ring.Push(i), name << ": push with a half full ring");
+      CHECK(ring.Pop(value) && (value == i - 2), name << ": pop with a half full ring");
+   }
+}
+
+static SPSCRing<uint64_t> spsc(RING_CAPACITY);
+static MPSCRing<uint64_t> mpsc(RING_CAPACITY);
+
+static void * SPSCProducer(void *)
+{
+   for (uint64_t i=0; i<NUM_ITEMS; i++)
+   {
+      while (! spsc.Push(i)) sched_yield();
+   }
+   return NULL;
+}
+
+static void * MPSCProducer(void *arg)
+{
+   uint64_t id = (uint64_t)(long)arg;
+
+   for (uint64_t i=0; i<NUM_ITEMS; i++)
+   {
+      while (! mpsc.Push((id << 32) | i)) sched_yield();
+   }
+   return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+   pthread_t producers[NUM_PRODUCERS];
+   uint64_t  value;
+
+   TestFullEmpty< SPSCRing<uint64_t> >("SPSCRing");
+   TestFullEmpty< MPSCRing<uint64_t> >("MPSCRing");
+
+   /* One producer, the consumer must see every value in order */
+   pthread_create(&producers[0], NULL, SPSCProducer, NULL);
+   for (uint64_t i=0; i<NUM_ITEMS; i++)
+   {
+      while (! spsc.Pop(value)) sched_yield();
+      if (value != i)
+      {
+         cerr << "FAILED: SPSCRing: popped " << value << ", expected " << i << endl;
+         errors ++;
+         break;
+      }
+   }
+   pthread_join(producers[0], NULL);
+   CHECK(spsc.Count() == 0, "SPSCRing: empty after the transfer");
+
+   /* Several producers, the values of every producer must arrive in order and none lost */
+   vector<uint64_t> next(NUM_PRODUCERS, 0);
+   for (long i=0; i<NUM_PRODUCERS; i++)
+   {
+      pthread_create(&producers[i], NULL, MPSCProducer, (void *)i);
+   }
+   for (uint64_t i=0; i<(uint64_t)NUM_ITEMS * NUM_PRODUCERS; i++)
+   {
+      while (! mpsc.Pop(value)) sched_yield();
+      uint64_t id  = value >> 32;
+      uint64_t seq = value & 0xFFFFFFFF;
+      if ((id >= NUM_PRODUCERS) || (seq != next[id]))
+      {
+         cerr << "FAILED: MPSCRing: popped " << seq << " from producer " << id << ", expected " << next[id] << endl;
+         errors ++;
+         break;
+      }
+      next[id] ++;
+   }
+   for (int i=0; i<NUM_PRODUCERS; i++)
+   {
+      pthread_join(producers[i], NULL);
+   }
+   CHECK(! mpsc.Pop(value), "MPSCRing: empty after the transfer");
+
+   if (errors > 0)
+   {
+      cerr << errors << " errors" << endl;
+      return 1;
+   }
+   cout << "Ring buffer tests passed" << endl;
+   return 0;
+}
@@ -0,0 +1,160 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include "TopologyGenerator.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::stringstream;
+using std::vector;
+using std::map;
+using namespace Synapse;
+
+/**
+ * Checks the shape of the generated topologies: number of leaves, depth, children per process,
+ * and that no process but the front-end relays a single child.
+ */
+
+static int errors = 0;
+
+typedef map< string, vector<string> > Tree;
+
+/**
+ * Parses a topology in the MRNet syntax into the children of every process, and returns the root.
+ */
+static string Parse(const string &topology, Tree &tree)
+{
+   stringstream ss(topology);
+   string       token, parent, root;
+
+   while (ss >> token)
+   {
+      if (token == "=>") continue;
+      if (token == ";")
+      {
+         parent = "";
+         continue;
+      }
+      if (parent == "")
+      {
+         parent = token;
+         if (root == "") root = token;
+         tree[parent];
+      }
+      else
+      {
+         tree[parent].push_back(token);
+      }
+   }
+   return root;
+}
+
+/**
+ * Walks the tree counting the leaves and the deepest level, and checking the children of every process.
+ */
+static void Walk(Tree &tree, const string &node, unsigned int depth, bool is_root, unsigned int fanout,
+                 unsigned int &leaves, unsigned int &max_depth, const char *name)
+{
+   vector<string> &children = tree[node];
+
+   if (children.empty())
+   {
+      leaves ++;
+      if (depth > max_depth) max_depth = depth;
+      return;
+   }
+   if (children.size() > fanout)
+   {
+      cerr << name << ": " << node << " has " << children.size() << " children, fan-out is " << fanout << endl;
+      errors ++;
+   }
+   if ((! is_root) && (children.size() == 1))
+   {
+      cerr << name << ": " << node << " relays a single child" << endl;
+      errors ++;
+   }
+   for (unsigned int i=0; i<children.size(); i++)
+   {
+      Walk(tree, children[i], depth + 1, false, fanout, leaves, max_depth, name);
+   }
+}
+
+static void Check(const char *name, TopologyGenerator &generator, unsigned int numBackends, bool withBackends,
+                  unsigned int expectedLeaves, unsigned int expectedDepth, unsigned int expectedRootChildren)
+{
+   string       topology;
+   Tree         tree;
+   unsigned int leaves = 0, depth = 0;
+   unsigned int fanout = generator.GetFanout(numBackends);
+
+   if (generator.Generate(numBackends, withBackends, topology) != 0)
+   {
+      cerr << name << ": Generate failed" << endl;
+      errors ++;
+      return;
+   }
+   string root = Parse(topology, tree);
+   Walk(tree, root, 0, true, fanout, leaves, depth, name);
+
+   if ((leaves != expectedLeaves) || (depth != expectedDepth) || (tree[root].size() != expectedRootChildren))
+   {
+      cerr << name << ": " << leaves << " leaves, depth " << depth << ", " << tree[root].size() << " children of the root; expected "
+           << expectedLeaves << ", " << expectedDepth << " and " << expectedRootChildren << endl << topology;
+      errors ++;
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   vector<string> hosts;
+   hosts.push_back("h0");
+   hosts.push_back("h1");
+
+   TopologyGenerator fanout2("fe", hosts);
+   fanout2.SetFanout(2);
+
+   /* 5 back-ends in a binary tree: 3 levels, with one branch shorter instead of single-child relays */
+   Check("spawn n=5 f=2",  fanout2, 5, true,  5, 3, 2);
+   /* Attach mode: the leaves serve 2, 1 and 2 back-ends */
+   Check("attach n=5 f=2", fanout2, 5, false, 3, 2, 2);
+   Check("spawn n=8 f=2",  fanout2, 8, true,  8, 3, 2);
+   Check("spawn n=1 f=2",  fanout2, 1, true,  1, 1, 1);
+   Check("attach n=2 f=2", fanout2, 2, false, 1, 0, 0);
+
+   TopologyGenerator fanout4("fe", hosts);
+   fanout4.SetFanout(4);
+   Check("attach n=64 f=4", fanout4, 64, false, 16, 2, 4);
+   Check("spawn n=17 f=4",  fanout4, 17, true,  17, 3, 2);
+
+   TopologyGenerator depth3("fe", hosts);
+   depth3.SetDepth(3);
+   Check("spawn n=1000 d=3", depth3, 1000, true, 1000, 3, 10);
+   Check("spawn n=900 d=3",  depth3, 900,  true, 900,  3, 9);
+
+   TopologyGenerator defaults("fe", hosts);
+   Check("attach n=32 default", defaults, 32, false, 1, 0, 0);
+   Check("spawn n=100 default", defaults, 100, true, 100, 2, 4);
+
+   /* Sibling subtrees are placed in blocks over the hosts */
+   string topology;
+   TopologyGenerator placement("fe", hosts);
+   placement.SetFanout(2);
+   placement.Generate(4, true, topology);
+   if (topology.find("fe:0 =>\n\th0:0\n\th1:0 ;") != 0)
+   {
+      cerr << "placement: the children of the root should be h0:0 and h1:0" << endl << topology;
+      errors ++;
+   }
+
+   if (errors > 0)
+   {
+      cerr << errors << " errors" << endl;
+      return 1;
+   }
+   cout << "Topology generator tests passed" << endl;
+   return 0;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+# Runs the MPI distribution test in a local MPI launch. Set MPIRUN to override the launcher.
+${MPIRUN:-mpirun} -np 4 ./test_mpi_scatter